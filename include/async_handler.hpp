@@ -6,21 +6,75 @@
 
 #pragma once
 
+#include "metrics.hpp"
 #include "protected_queue.hpp"
+#include "spsc_ring.hpp"
 #include "sl_log.hpp"
+#include "thread_config.hpp"
 #include <mutex>
 #include <thread>
 #include <atomic>
 #include <condition_variable>
+#include <string>
+#include <vector>
 
 
 namespace hek {
 
-template <typename T>
+/**
+ * What TriggerHandlerThread() does when the queue of a bounded AsyncHandler is full.
+ */
+enum class OverflowPolicy {
+    EDropNewest = 0,    // Discard the action being triggered
+    EDropOldest = 1,    // Discard the oldest queued action (needs a queue with SupportsProducerPop())
+    EBlockProducer = 2  // Block the triggering thread until the handle thread made room
+};
+
+/**
+ * Where HandleTriggerAction() runs.
+ */
+enum class DispatchMode {
+    EHandleThread = 0,  // Queue the action for the handle thread (default)
+    EInline = 1         // Handle the action right away on the triggering thread (run to completion)
+};
+
+struct AsyncHandlerStats {
+    uint64_t queueDepth = 0;
+    uint64_t queueDepthHighWaterMark = 0;
+    uint64_t droppedActions = 0;
+};
+
+/**
+ * Runs HandleTriggerAction() on a dedicated handle thread for every action passed to TriggerHandlerThread().
+ *
+ * QueuePolicy is the queue between the triggering thread(s) and the handle thread. It must offer
+ * Push(T&&), Pop(T&), Pop(), Empty(), Clear(), MaxSize() and SupportsProducerPop():
+ * - ProtectedQueue<T> (default): unbounded, mutex protected, any number of triggering threads.
+ * - SpscRing<T>: bounded and lock-free, only valid when actions are triggered from one single thread.
+ *
+ * The handle thread spins briefly on an empty queue before parking on a condition variable, and the
+ * triggering side only takes the mutex to wake it up when it is actually parked.
+ *
+ * By default the queue is unbounded (or bounded by the queue policy itself). SetQueueCapacity() bounds it
+ * and selects what happens on overflow, so an overloaded handler sheds load instead of growing its backlog.
+ *
+ * SetDispatchMode(DispatchMode::EInline) skips the queue and the handle thread altogether, saving the
+ * handoff and wakeup per action when the triggering thread can afford to do the work itself.
+ */
+template <typename T, typename QueuePolicy = ProtectedQueue<T>>
 class AsyncHandler {
 public:
     AsyncHandler() :
-        m_handleThreadRunning{false} {
+        m_handleThreadRunning{false},
+        m_handleThreadParked{false},
+        m_queueCapacity{QueuePolicy::MaxSize()},
+        m_overflowPolicy{OverflowPolicy::EBlockProducer},
+        m_queueDepth{0},
+        m_queueDepthHighWaterMark{0},
+        m_droppedActions{0},
+        m_blockedProducers{0},
+        m_dispatchMode{DispatchMode::EHandleThread} {
+        m_handleThreadConfig.name = DEFAULT_HANDLE_THREAD_NAME;
         StartHandleThread();
         SLLog::LogInfo("AsyncHandler::AsyncHandler - Parent constructed");
     }
@@ -37,18 +91,132 @@ public:
      */
     virtual void HandleTriggerAction(T& t) { (void)t; }
 
+    /**
+     * Called on the handle thread each time the queue has been drained, i.e. after the last
+     * HandleTriggerAction() of a burst. Use it to flush work that was batched up while handling
+     * the individual actions. Not pure virtual for the same reason as HandleTriggerAction().
+     */
+    virtual void HandleTriggerActionsDone() {}
+
+    /**
+     * Bound the number of queued actions. A capacity of 0 (or above the queue policy's MaxSize()) means
+     * the queue policy's own limit. EDropOldest falls back to EDropNewest for queues that only allow
+     * the handle thread to pop (SpscRing).
+     */
+    void SetQueueCapacity(size_t capacity, OverflowPolicy policy = OverflowPolicy::EDropNewest) {
+        if (capacity == 0 || capacity > QueuePolicy::MaxSize()) {
+            capacity = QueuePolicy::MaxSize();
+        }
+
+        if (policy == OverflowPolicy::EDropOldest && !QueuePolicy::SupportsProducerPop()) {
+            SLLog::LogWarn("AsyncHandler::SetQueueCapacity - Queue does not support EDropOldest, using EDropNewest");
+            policy = OverflowPolicy::EDropNewest;
+        }
+
+        m_queueCapacity.store(capacity);
+        m_overflowPolicy.store(policy);
+
+        // Blocked producers may fit in the new capacity
+        std::lock_guard<std::mutex> lock(m_handleThreadMutex);
+        m_queueSpaceCondVar.notify_all();
+    }
+
+    /**
+     * EInline stops the handle thread (dropping whatever is still queued) and from then on handles every
+     * action inside TriggerHandlerThread(), followed by HandleTriggerActionsDone(). Inline actions are
+     * serialized by a mutex, so the handler is still never called concurrently; an action must not
+     * trigger another one from within the handler though. EHandleThread restarts the handle thread.
+     */
+    void SetDispatchMode(DispatchMode mode) {
+        if (mode == m_dispatchMode.load()) {
+            return;
+        }
+
+        StopHandleThread();
+        m_dispatchMode.store(mode);
+
+        if (mode == DispatchMode::EHandleThread) {
+            StartHandleThread();
+        } else {
+            std::lock_guard<std::mutex> lock(m_handleThreadMutex);
+            m_handleThreadRunning = true;
+        }
+    }
+
+    /**
+     * Name, pin and/or prioritize the handle thread (default name: "handler"), now and whenever it is
+     * restarted. Call it from the thread controlling the handler, not from within a handler.
+     */
+    void SetHandleThreadConfig(const ThreadConfig& config) {
+        m_handleThreadConfig = config;
+        if (m_handleThreadConfig.name.empty()) {
+            m_handleThreadConfig.name = DEFAULT_HANDLE_THREAD_NAME;
+        }
+
+        if (m_handleThread.joinable()) {
+            ApplyThreadConfig(m_handleThread.native_handle(), m_handleThreadConfig);
+        }
+    }
+
+    DispatchMode GetDispatchMode() const {
+        return m_dispatchMode.load();
+    }
+
+    AsyncHandlerStats GetQueueStats() const {
+        AsyncHandlerStats stats;
+        stats.queueDepth = m_queueDepth.load(std::memory_order_relaxed);
+        stats.queueDepthHighWaterMark = m_queueDepthHighWaterMark.load(std::memory_order_relaxed);
+        stats.droppedActions = m_droppedActions.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    /**
+     * Export the queue statistics as metrics (see MetricsRegistry) with the given labels, for as long as
+     * the handler lives. They are read when the metrics are, so this costs nothing per action.
+     */
+    void ExportQueueMetrics(const std::string& labels) {
+        MetricsRegistry& registry = MetricsRegistry::Default();
+        m_queueMetrics.clear();
+        m_queueMetrics.push_back(registry.AddCallback(
+            "async_handler_queue_depth", "Actions queued for the handle thread", MetricType::EGauge, labels,
+            [this] { return static_cast<uint64_t>(m_queueDepth.load(std::memory_order_relaxed)); }));
+        m_queueMetrics.push_back(registry.AddCallback(
+            "async_handler_queue_depth_high_water_mark", "Most actions ever queued for the handle thread",
+            MetricType::EGauge, labels,
+            [this] { return static_cast<uint64_t>(m_queueDepthHighWaterMark.load(std::memory_order_relaxed)); }));
+        m_queueMetrics.push_back(registry.AddCallback(
+            "async_handler_dropped_actions_total", "Actions dropped by the overflow policy of a full queue",
+            MetricType::ECounter, labels, [this] { return m_droppedActions.load(std::memory_order_relaxed); }));
+    }
+
 protected:
     void TriggerHandlerThread(const T& triggerActionStruct) {
-        if (!m_handleThreadRunning) {
+        if (m_dispatchMode.load(std::memory_order_relaxed) == DispatchMode::EInline) {
+            T inlineActionStruct = triggerActionStruct;
+            HandleInline(inlineActionStruct);
             return;
         }
 
-        {
-            std::unique_lock<std::mutex> lock(m_handleThreadMutex);
-            m_triggerActionQueue.Push(triggerActionStruct);
+        if (!m_handleThreadRunning || !ReserveQueueSlot()) {
+            return;
         }
 
-        m_handleThreadCondVar.notify_all();
+        m_triggerActionQueue.Push(triggerActionStruct);
+        WakeHandleThread();
+    }
+
+    void TriggerHandlerThread(T&& triggerActionStruct) {
+        if (m_dispatchMode.load(std::memory_order_relaxed) == DispatchMode::EInline) {
+            HandleInline(triggerActionStruct);
+            return;
+        }
+
+        if (!m_handleThreadRunning || !ReserveQueueSlot()) {
+            return;
+        }
+
+        m_triggerActionQueue.Push(std::move(triggerActionStruct));
+        WakeHandleThread();
     }
 
     void Stop() {
@@ -57,6 +225,9 @@ protected:
     }
 
 private:
+    static constexpr int HANDLE_THREAD_SPIN_COUNT = 4096;
+    static constexpr char DEFAULT_HANDLE_THREAD_NAME[] = "handler";
+
     void StartHandleThread() {
         StopHandleThread();
 
@@ -66,14 +237,13 @@ private:
         }
 
         m_handleThread = std::thread(&AsyncHandler::RunHandleThread, this);
+        ApplyThreadConfig(m_handleThread.native_handle(), m_handleThreadConfig);
     }
 
     void StopHandleThread() {
         {
             std::unique_lock<std::mutex> triggerHandlerThreadlock(m_handleThreadMutex);
 
-            m_triggerActionQueue.Clear();
-
             if (!m_handleThreadRunning) {
                 return;
             }
@@ -82,35 +252,143 @@ private:
         }
 
         m_handleThreadCondVar.notify_all();
+        m_queueSpaceCondVar.notify_all();
 
         if (m_handleThread.joinable()) {
             m_handleThread.join();
         }
+
+        // Wait for an inline action in flight
+        std::lock_guard<std::mutex> inlineLock(m_inlineMutex);
+
+        // The handle thread is gone, so this thread may act as the (single) consumer of the queue
+        m_triggerActionQueue.Clear();
+        m_queueDepth.store(0);
     }
 
-    void RunHandleThread() {
-        SLLog::LogInfo("AsyncHandler::RunHandleThread - Handle thread started");
+    void HandleInline(T& triggerActionStruct) {
+        std::lock_guard<std::mutex> lock(m_inlineMutex);
+        if (!m_handleThreadRunning) {
+            return;
+        }
+
+        HandleTriggerAction(triggerActionStruct);
+        HandleTriggerActionsDone();
+    }
+
+    /**
+     * Account for one more queued action, applying the overflow policy when the queue is full.
+     * Returns false when the action must be dropped.
+     */
+    bool ReserveQueueSlot() {
+        while (true) {
+            size_t capacity = m_queueCapacity.load(std::memory_order_relaxed);
+            size_t depth = m_queueDepth.load(std::memory_order_relaxed);
 
-        while (m_handleThreadRunning) {
-            {
+            if (depth < capacity) {
+                if (m_queueDepth.compare_exchange_weak(depth, depth + 1, std::memory_order_relaxed)) {
+                    UpdateHighWaterMark(depth + 1);
+                    return true;
+                }
+                continue;
+            }
+
+            switch (m_overflowPolicy.load(std::memory_order_relaxed)) {
+            case OverflowPolicy::EDropOldest:
+                if constexpr (QueuePolicy::SupportsProducerPop()) {
+                    if (m_triggerActionQueue.Pop()) {
+                        m_queueDepth.fetch_sub(1, std::memory_order_relaxed);
+                        m_droppedActions.fetch_add(1, std::memory_order_relaxed);
+                    }
+                    continue;
+                }
+                m_droppedActions.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case OverflowPolicy::EBlockProducer: {
                 std::unique_lock<std::mutex> lock(m_handleThreadMutex);
-                m_handleThreadCondVar.wait(lock, [this] {
-                    return !m_triggerActionQueue.Empty() || !m_handleThreadRunning;
+                m_blockedProducers.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                m_queueSpaceCondVar.wait(lock, [this] {
+                    return m_queueDepth.load() < m_queueCapacity.load() || !m_handleThreadRunning;
                 });
+                m_blockedProducers.fetch_sub(1, std::memory_order_relaxed);
+                if (!m_handleThreadRunning) {
+                    return false;
+                }
+                continue;
+            }
+            case OverflowPolicy::EDropNewest:
+            default:
+                m_droppedActions.fetch_add(1, std::memory_order_relaxed);
+                return false;
             }
+        }
+    }
 
-            if (!m_handleThreadRunning) {
-                SLLog::LogInfo("AsyncHandler::RunHandleThread - Handle thread terminated gracefully");
-                return;
+    void ReleaseQueueSlot() {
+        m_queueDepth.fetch_sub(1, std::memory_order_relaxed);
+
+        // Pairs with the fence in ReserveQueueSlot(), see WakeHandleThread()
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_blockedProducers.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(m_handleThreadMutex);
+            m_queueSpaceCondVar.notify_all();
+        }
+    }
+
+    void UpdateHighWaterMark(size_t depth) {
+        size_t highWaterMark = m_queueDepthHighWaterMark.load(std::memory_order_relaxed);
+        while (depth > highWaterMark &&
+               !m_queueDepthHighWaterMark.compare_exchange_weak(highWaterMark, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    void WakeHandleThread() {
+        // Pairs with the fence in WaitForActions(): either the handle thread sees the new action
+        // before parking, or this thread sees it parked and wakes it up
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_handleThreadParked.load(std::memory_order_relaxed)) {
+            std::lock_guard<std::mutex> lock(m_handleThreadMutex);
+            m_handleThreadCondVar.notify_one();
+        }
+    }
+
+    bool WaitForActions() {
+        for (int i = 0; i < HANDLE_THREAD_SPIN_COUNT; ++i) {
+            if (!m_triggerActionQueue.Empty() || !m_handleThreadRunning) {
+                return m_handleThreadRunning;
             }
+            CpuRelax();
+        }
 
-            while (!m_triggerActionQueue.Empty()) {
+        std::unique_lock<std::mutex> lock(m_handleThreadMutex);
+        m_handleThreadParked.store(true, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        m_handleThreadCondVar.wait(lock, [this] {
+            return !m_triggerActionQueue.Empty() || !m_handleThreadRunning;
+        });
+        m_handleThreadParked.store(false, std::memory_order_relaxed);
+
+        return m_handleThreadRunning;
+    }
+
+    void RunHandleThread() {
+        SLLog::LogInfo("AsyncHandler::RunHandleThread - Handle thread started");
+
+        while (WaitForActions()) {
+            bool handled = false;
+            while (m_handleThreadRunning) {
                 T triggerActionStruct = {};
-                if (m_triggerActionQueue.Pop(triggerActionStruct)) {
-                    HandleTriggerAction(triggerActionStruct);
-                } else {
-                    SLLog::LogError("AsyncHandler::RunHandleThread - ERROR! Failed to pop an action request from the queue");
+                if (!m_triggerActionQueue.Pop(triggerActionStruct)) {
+                    break;
                 }
+                ReleaseQueueSlot();
+                HandleTriggerAction(triggerActionStruct);
+                handled = true;
+            }
+
+            if (handled) {
+                HandleTriggerActionsDone();
             }
         }
 
@@ -118,11 +396,27 @@ private:
     }
 
 private:
-    ProtectedQueue<T> m_triggerActionQueue;
+    QueuePolicy m_triggerActionQueue;
     std::thread m_handleThread;
     std::atomic<bool> m_handleThreadRunning;
+    std::atomic<bool> m_handleThreadParked;
     std::condition_variable m_handleThreadCondVar;
+    std::condition_variable m_queueSpaceCondVar;
     std::mutex m_handleThreadMutex;
+
+    std::atomic<size_t> m_queueCapacity;
+    std::atomic<OverflowPolicy> m_overflowPolicy;
+    std::atomic<size_t> m_queueDepth;
+    std::atomic<size_t> m_queueDepthHighWaterMark;
+    std::atomic<uint64_t> m_droppedActions;
+    std::atomic<int> m_blockedProducers;
+
+    std::atomic<DispatchMode> m_dispatchMode;
+    std::mutex m_inlineMutex;
+    ThreadConfig m_handleThreadConfig;
+
+    // Declared last: removed before the counters they read
+    std::vector<Metric> m_queueMetrics;
 };
 
 } // namespace hek
@@ -0,0 +1,411 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include "async_handler.hpp"
+#include "metrics.hpp"
+#include "sl_log.hpp"
+#include "thread_config.hpp"
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+
+namespace hek {
+
+/**
+ * Multi-worker counterpart of AsyncHandler: HandleTriggerAction() runs on a pool of worker threads.
+ *
+ * Every worker has its own deques. Unordered actions are spread round-robin and idle workers steal
+ * them from busy ones. Actions triggered with an ordering key always go to worker (key % workers) and
+ * are never stolen, so actions with the same key are handled in order while different keys run in
+ * parallel.
+ *
+ * HandleTriggerAction() and HandleTriggerActionsDone() are called concurrently from several workers.
+ *
+ * The queues are unbounded by default. SetQueueCapacity() bounds the number of actions queued over all
+ * workers, with the same overflow policies as AsyncHandler; EDropOldest drops the oldest action queued
+ * for the worker the new action goes to.
+ */
+template <typename T>
+class AsyncHandlerPool {
+public:
+    explicit AsyncHandlerPool(size_t workerCount = std::thread::hardware_concurrency()) :
+        m_running{false},
+        m_nextWorker{0},
+        m_idleWorkers{0},
+        m_queueCapacity{SIZE_MAX},
+        m_overflowPolicy{OverflowPolicy::EBlockProducer},
+        m_queueDepth{0},
+        m_queueDepthHighWaterMark{0},
+        m_droppedActions{0},
+        m_blockedProducers{0} {
+        StartWorkers(workerCount == 0 ? 1 : workerCount);
+        SLLog::LogInfo("AsyncHandlerPool::AsyncHandlerPool - Started " + std::to_string(m_workers.size()) + " worker(s)");
+    }
+
+    virtual ~AsyncHandlerPool() {
+        StopWorkers();
+        SLLog::LogInfo("AsyncHandlerPool::~AsyncHandlerPool - AsyncHandlerPool terminated gracefully");
+    }
+
+    /**
+     * Not pure virtual for the same reason as AsyncHandler::HandleTriggerAction().
+     */
+    virtual void HandleTriggerAction(T& t) { (void)t; }
+
+    /**
+     * Called on a worker each time it has run out of work.
+     */
+    virtual void HandleTriggerActionsDone() {}
+
+    size_t WorkerCount() const { return m_workers.size(); }
+
+    /**
+     * Bound the number of queued actions over all workers (0: unbounded) and select what happens on overflow
+     */
+    void SetQueueCapacity(size_t capacity, OverflowPolicy policy = OverflowPolicy::EDropNewest) {
+        m_queueCapacity.store(capacity == 0 ? SIZE_MAX : capacity);
+        m_overflowPolicy.store(policy);
+
+        // Blocked producers may fit in the new capacity
+        std::lock_guard<std::mutex> lock(m_queueSpaceMutex);
+        m_queueSpaceCondVar.notify_all();
+    }
+
+    AsyncHandlerStats GetQueueStats() const {
+        AsyncHandlerStats stats;
+        stats.queueDepth = m_queueDepth.load(std::memory_order_relaxed);
+        stats.queueDepthHighWaterMark = m_queueDepthHighWaterMark.load(std::memory_order_relaxed);
+        stats.droppedActions = m_droppedActions.load(std::memory_order_relaxed);
+        return stats;
+    }
+
+    /**
+     * Export the queue statistics as metrics, see AsyncHandler::ExportQueueMetrics()
+     */
+    void ExportQueueMetrics(const std::string& labels) {
+        MetricsRegistry& registry = MetricsRegistry::Default();
+        m_queueMetrics.clear();
+        m_queueMetrics.push_back(registry.AddCallback(
+            "async_handler_queue_depth", "Actions queued for the handle thread", MetricType::EGauge, labels,
+            [this] { return static_cast<uint64_t>(m_queueDepth.load(std::memory_order_relaxed)); }));
+        m_queueMetrics.push_back(registry.AddCallback(
+            "async_handler_queue_depth_high_water_mark", "Most actions ever queued for the handle thread",
+            MetricType::EGauge, labels,
+            [this] { return static_cast<uint64_t>(m_queueDepthHighWaterMark.load(std::memory_order_relaxed)); }));
+        m_queueMetrics.push_back(registry.AddCallback(
+            "async_handler_dropped_actions_total", "Actions dropped by the overflow policy of a full queue",
+            MetricType::ECounter, labels, [this] { return m_droppedActions.load(std::memory_order_relaxed); }));
+    }
+
+    /**
+     * Name, pin and/or prioritize the workers (default name: "worker"); worker i gets
+     * ThreadConfig::ForIndex(i).
+     */
+    void SetWorkerThreadConfig(const ThreadConfig& config) {
+        ThreadConfig workerConfig = config;
+        if (workerConfig.name.empty()) {
+            workerConfig.name = DEFAULT_WORKER_THREAD_NAME;
+        }
+
+        for (size_t i = 0; i < m_workers.size(); ++i) {
+            if (m_workers[i]->thread.joinable()) {
+                ApplyThreadConfig(m_workers[i]->thread.native_handle(), workerConfig.ForIndex(i));
+            }
+        }
+    }
+
+protected:
+    /**
+     * Trigger an action that may be handled by any worker.
+     */
+    void TriggerHandlerThread(T&& triggerActionStruct) {
+        if (!m_running) {
+            return;
+        }
+
+        size_t index = m_nextWorker.fetch_add(1, std::memory_order_relaxed) % m_workers.size();
+        Worker& worker = *m_workers[index];
+        if (!ReserveQueueSlot(worker)) {
+            return;
+        }
+
+        bool parked = false;
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.shared.push_back(std::move(triggerActionStruct));
+            parked = worker.parked;
+        }
+
+        if (parked) {
+            worker.condVar.notify_one();
+        } else if (m_idleWorkers.load(std::memory_order_relaxed) > 0) {
+            // The target is busy: let an idle worker steal the action
+            WakeIdleWorker(index);
+        }
+    }
+
+    /**
+     * Trigger an action that is handled in order with all other actions of the same key.
+     */
+    void TriggerHandlerThread(T&& triggerActionStruct, uint64_t orderingKey) {
+        if (!m_running) {
+            return;
+        }
+
+        Worker& worker = *m_workers[orderingKey % m_workers.size()];
+        if (!ReserveQueueSlot(worker)) {
+            return;
+        }
+
+        bool parked = false;
+        {
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            worker.ordered.push_back(std::move(triggerActionStruct));
+            parked = worker.parked;
+        }
+
+        if (parked) {
+            worker.condVar.notify_one();
+        }
+    }
+
+    void Stop() {
+        SLLog::LogInfo("AsyncHandlerPool::Stop - StopWorkers");
+        StopWorkers();
+    }
+
+private:
+    static constexpr char DEFAULT_WORKER_THREAD_NAME[] = "worker";
+
+    struct alignas(64) Worker {
+        std::mutex mutex;
+        std::condition_variable condVar;
+        std::deque<T> ordered; // Never stolen
+        std::deque<T> shared;  // May be stolen by other workers
+        bool parked = false;
+        bool stealRequested = false;
+        std::thread thread;
+    };
+
+    void StartWorkers(size_t workerCount) {
+        m_running = true;
+
+        for (size_t i = 0; i < workerCount; ++i) {
+            m_workers.push_back(std::make_unique<Worker>());
+        }
+
+        for (size_t i = 0; i < workerCount; ++i) {
+            m_workers[i]->thread = std::thread(&AsyncHandlerPool::RunWorker, this, i);
+        }
+        SetWorkerThreadConfig(ThreadConfig());
+    }
+
+    void StopWorkers() {
+        if (!m_running.exchange(false)) {
+            return;
+        }
+
+        for (auto& worker : m_workers) {
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->condVar.notify_all();
+        }
+        {
+            std::lock_guard<std::mutex> lock(m_queueSpaceMutex);
+            m_queueSpaceCondVar.notify_all();
+        }
+
+        for (auto& worker : m_workers) {
+            if (worker->thread.joinable()) {
+                worker->thread.join();
+            }
+            std::lock_guard<std::mutex> lock(worker->mutex);
+            worker->ordered.clear();
+            worker->shared.clear();
+        }
+        m_queueDepth.store(0);
+    }
+
+    /**
+     * Account for one more queued action, applying the overflow policy when the queues are full.
+     * Returns false when the action must be dropped.
+     */
+    bool ReserveQueueSlot(Worker& target) {
+        while (true) {
+            size_t capacity = m_queueCapacity.load(std::memory_order_relaxed);
+            size_t depth = m_queueDepth.load(std::memory_order_relaxed);
+
+            if (depth < capacity) {
+                if (m_queueDepth.compare_exchange_weak(depth, depth + 1, std::memory_order_relaxed)) {
+                    UpdateHighWaterMark(depth + 1);
+                    return true;
+                }
+                continue;
+            }
+
+            switch (m_overflowPolicy.load(std::memory_order_relaxed)) {
+            case OverflowPolicy::EDropOldest:
+                if (DropOldest(target)) {
+                    // Its slot goes to the new action
+                    return true;
+                }
+                // Nothing queued for the target worker: drop the new action instead
+                m_droppedActions.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            case OverflowPolicy::EBlockProducer: {
+                std::unique_lock<std::mutex> lock(m_queueSpaceMutex);
+                m_blockedProducers.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                m_queueSpaceCondVar.wait(lock, [this] {
+                    return m_queueDepth.load() < m_queueCapacity.load() || !m_running;
+                });
+                m_blockedProducers.fetch_sub(1, std::memory_order_relaxed);
+                if (!m_running) {
+                    return false;
+                }
+                continue;
+            }
+            case OverflowPolicy::EDropNewest:
+            default:
+                m_droppedActions.fetch_add(1, std::memory_order_relaxed);
+                return false;
+            }
+        }
+    }
+
+    bool DropOldest(Worker& worker) {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        std::deque<T>& queue = !worker.ordered.empty() ? worker.ordered : worker.shared;
+        if (queue.empty()) {
+            return false;
+        }
+        queue.pop_front();
+        m_droppedActions.fetch_add(1, std::memory_order_relaxed);
+        return true;
+    }
+
+    void ReleaseQueueSlot() {
+        m_queueDepth.fetch_sub(1, std::memory_order_relaxed);
+
+        // Pairs with the fence in ReserveQueueSlot(): either the producer sees the freed slot before
+        // waiting, or this thread sees it blocked and wakes it up
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (m_blockedProducers.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(m_queueSpaceMutex);
+            m_queueSpaceCondVar.notify_all();
+        }
+    }
+
+    void UpdateHighWaterMark(size_t depth) {
+        size_t highWaterMark = m_queueDepthHighWaterMark.load(std::memory_order_relaxed);
+        while (depth > highWaterMark &&
+               !m_queueDepthHighWaterMark.compare_exchange_weak(highWaterMark, depth, std::memory_order_relaxed)) {
+        }
+    }
+
+    void WakeIdleWorker(size_t busyIndex) {
+        for (size_t i = 1; i < m_workers.size(); ++i) {
+            Worker& worker = *m_workers[(busyIndex + i) % m_workers.size()];
+            std::lock_guard<std::mutex> lock(worker.mutex);
+            if (worker.parked) {
+                worker.stealRequested = true;
+                worker.condVar.notify_one();
+                return;
+            }
+        }
+    }
+
+    bool PopOwn(Worker& worker, T& outItem) {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (!worker.ordered.empty()) {
+            outItem = std::move(worker.ordered.front());
+            worker.ordered.pop_front();
+            return true;
+        }
+        if (!worker.shared.empty()) {
+            outItem = std::move(worker.shared.front());
+            worker.shared.pop_front();
+            return true;
+        }
+        return false;
+    }
+
+    bool Steal(size_t thiefIndex, T& outItem) {
+        for (size_t i = 1; i < m_workers.size(); ++i) {
+            Worker& victim = *m_workers[(thiefIndex + i) % m_workers.size()];
+            std::lock_guard<std::mutex> lock(victim.mutex);
+            if (!victim.shared.empty()) {
+                // Steal from the back, the owner works from the front
+                outItem = std::move(victim.shared.back());
+                victim.shared.pop_back();
+                return true;
+            }
+        }
+        return false;
+    }
+
+    void RunWorker(size_t index) {
+        SLLog::LogInfo("AsyncHandlerPool::RunWorker - Worker " + std::to_string(index) + " started");
+
+        Worker& worker = *m_workers[index];
+        bool handled = false;
+
+        while (m_running) {
+            T triggerActionStruct = {};
+            if (PopOwn(worker, triggerActionStruct) || Steal(index, triggerActionStruct)) {
+                ReleaseQueueSlot();
+                HandleTriggerAction(triggerActionStruct);
+                handled = true;
+                continue;
+            }
+
+            if (handled) {
+                HandleTriggerActionsDone();
+                handled = false;
+            }
+
+            std::unique_lock<std::mutex> lock(worker.mutex);
+            worker.parked = true;
+            m_idleWorkers.fetch_add(1, std::memory_order_relaxed);
+            worker.condVar.wait(lock, [this, &worker] {
+                return !worker.ordered.empty() || !worker.shared.empty() || worker.stealRequested || !m_running;
+            });
+            m_idleWorkers.fetch_sub(1, std::memory_order_relaxed);
+            worker.parked = false;
+            worker.stealRequested = false;
+        }
+
+        SLLog::LogInfo("AsyncHandlerPool::RunWorker - Worker " + std::to_string(index) + " terminated gracefully");
+    }
+
+private:
+    std::atomic<bool> m_running;
+    std::atomic<size_t> m_nextWorker;
+    std::atomic<size_t> m_idleWorkers;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+
+    std::atomic<size_t> m_queueCapacity;
+    std::atomic<OverflowPolicy> m_overflowPolicy;
+    std::atomic<size_t> m_queueDepth;
+    std::atomic<size_t> m_queueDepthHighWaterMark;
+    std::atomic<uint64_t> m_droppedActions;
+    std::atomic<int> m_blockedProducers;
+    std::mutex m_queueSpaceMutex;
+    std::condition_variable m_queueSpaceCondVar;
+
+    // Declared last: removed before the counters they read
+    std::vector<Metric> m_queueMetrics;
+};
+
+} // namespace hek
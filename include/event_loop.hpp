@@ -0,0 +1,107 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include "thread_config.hpp"
+
+#include <atomic>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
+#include <vector>
+#include <sys/epoll.h>
+
+
+namespace hek {
+
+class IEventHandler {
+public:
+    virtual ~IEventHandler() = default;
+
+    /**
+     * Called on an event loop thread when the registered file descriptor is ready.
+     * @param events The epoll event mask (EPOLLIN, EPOLLERR, ...)
+     */
+    virtual void HandleEvents(uint32_t events) = 0;
+};
+
+/**
+ * epoll based reactor. Hosts any number of file descriptors on a fixed set of threads; each
+ * registered descriptor is bound to one thread, so its handler is never called concurrently.
+ * Every thread has an eventfd to wake it up, so stopping the loop is immediate.
+ */
+class EventLoop {
+public:
+    /**
+     * @param threadConfig Placement of the loop's threads, see SetThreadConfig()
+     */
+    explicit EventLoop(size_t threadCount = 1, const ThreadConfig& threadConfig = ThreadConfig());
+    ~EventLoop();
+
+    EventLoop(const EventLoop&) = delete;
+    EventLoop& operator=(const EventLoop&) = delete;
+
+    /**
+     * Register a file descriptor (level triggered). The descriptor is assigned to the least loaded
+     * thread. Returns 0 on success, -1 on failure.
+     */
+    int Add(int fd, IEventHandler* handler, uint32_t events = EPOLLIN);
+
+    /**
+     * Unregister a file descriptor. When this function returns, the handler will not be called again, and
+     * it is not running either, unless Remove() is called from within a handler running on another event
+     * loop thread (of this or another loop): that does not wait, to avoid a lock order deadlock between two
+     * threads removing each other's descriptors, so the handler may still be finishing its current call.
+     * May be called from within a handler, including the handler being removed.
+     */
+    void Remove(int fd);
+
+    size_t ThreadCount() const;
+
+    /**
+     * Name, pin and/or prioritize the loop's threads (default name: "event-loop"). With several threads,
+     * thread i gets ThreadConfig::ForIndex(i).
+     */
+    void SetThreadConfig(const ThreadConfig& threadConfig);
+
+private:
+    struct Registration {
+        int fd = -1;
+        std::atomic<IEventHandler*> handler{nullptr};  // nullptr once removed
+        size_t workerIndex = 0;
+    };
+
+    struct Worker {
+        int epollFd = -1;
+        int wakeFd = -1;
+        std::thread thread;
+        size_t registrationCount = 0;
+
+        // Held by the worker while dispatching a batch of events, see Remove()
+        std::mutex dispatchMutex;
+
+        // Removed, freed by the worker after its next batch. Lock order: dispatchMutex before retireMutex.
+        std::mutex retireMutex;
+        std::vector<Registration*> retired;
+    };
+
+    void RunWorker(Worker& worker);
+    void WakeWorker(Worker& worker);
+    void RetireRegistration(Worker& worker, Registration* registration);
+
+private:
+    std::atomic<bool> m_running;
+    std::vector<std::unique_ptr<Worker>> m_workers;
+    ThreadConfig m_threadConfig;
+
+    std::mutex m_registrationMutex;
+    std::unordered_map<int, Registration*> m_registrations;
+};
+
+} // namespace hek
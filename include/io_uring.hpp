@@ -0,0 +1,124 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <linux/io_uring.h>
+
+
+namespace hek {
+
+/**
+ * Minimal io_uring on the raw system calls (no liburing): one submission/completion queue pair and at
+ * most one provided buffer ring. Not thread safe; the owner serializes all calls.
+ */
+class IoUring {
+public:
+    IoUring() = default;
+    ~IoUring();
+
+    IoUring(const IoUring&) = delete;
+    IoUring& operator=(const IoUring&) = delete;
+
+    /**
+     * Create the ring with (at least) the given number of submission and completion queue entries.
+     * Returns 0, or -errno: -ENOSYS without io_uring support, -EPERM when it is disabled by sysctl.
+     */
+    int Init(unsigned entries, unsigned completionEntries);
+    bool IsInitialized() const { return m_ringFd != -1; }
+
+    // Readable (EPOLLIN) while the completion queue is not empty
+    int Fd() const { return m_ringFd; }
+
+    bool IsOpcodeSupported(uint8_t opcode) const { return m_supportedOps[opcode]; }
+
+    /**
+     * A zeroed submission queue entry, or nullptr when the submission queue is full.
+     */
+    io_uring_sqe* GetSqe();
+
+    /**
+     * Submit the entries handed out by GetSqe() and optionally wait for waitCompletions completions.
+     * Returns the number of entries submitted, or -errno.
+     */
+    int Submit(unsigned waitCompletions = 0);
+
+    /**
+     * Call handler(const io_uring_cqe&) for every completion in the queue and consume them. Returns the number of completions.
+     */
+    template <typename Handler>
+    unsigned ReapCompletions(Handler&& handler);
+
+    // The kernel has completions waiting to be posted until this task enters it; Submit() posts them
+    bool CompletionsPending() const {
+        return (__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_TASKRUN) != 0;
+    }
+
+    // The kernel had to hold back completions because the completion queue was full; Submit() flushes them
+    bool CompletionsOverflowed() const {
+        return (__atomic_load_n(m_sqFlags, __ATOMIC_RELAXED) & IORING_SQ_CQ_OVERFLOW) != 0;
+    }
+
+    /**
+     * Register a provided buffer ring of entries (a power of two) buffers for group groupId. Fill it with
+     * AddBuffer() and publish the added buffers with CommitBuffers(). Returns 0 or -errno.
+     */
+    int RegisterBufferRing(uint16_t groupId, unsigned entries);
+    void AddBuffer(void* address, unsigned length, uint16_t bufferId);
+    void CommitBuffers();
+
+private:
+    int m_ringFd = -1;
+
+    void* m_sqRing = nullptr;
+    size_t m_sqRingBytes = 0;
+    void* m_cqRing = nullptr;
+    size_t m_cqRingBytes = 0;
+    io_uring_sqe* m_sqes = nullptr;
+    size_t m_sqesBytes = 0;
+
+    unsigned* m_sqHead = nullptr;
+    unsigned* m_sqTail = nullptr;
+    unsigned* m_sqFlags = nullptr;
+    unsigned m_sqMask = 0;
+    unsigned m_sqEntries = 0;
+    unsigned m_sqLocalTail = 0;
+    unsigned m_sqPending = 0;
+
+    unsigned* m_cqHead = nullptr;
+    unsigned* m_cqTail = nullptr;
+    unsigned m_cqMask = 0;
+    io_uring_cqe* m_cqes = nullptr;
+
+    std::array<bool, 256> m_supportedOps = {};
+
+    io_uring_buf_ring* m_bufferRing = nullptr;
+    size_t m_bufferRingBytes = 0;
+    unsigned m_bufferRingMask = 0;
+    uint16_t m_bufferRingTail = 0;
+    uint16_t m_bufferRingStaged = 0;
+    uint16_t m_bufferGroup = 0;
+};
+
+template <typename Handler>
+unsigned IoUring::ReapCompletions(Handler&& handler) {
+    // Only this side moves the head; the kernel publishes new completions through the tail
+    unsigned head = *m_cqHead;
+    unsigned tail = __atomic_load_n(m_cqTail, __ATOMIC_ACQUIRE);
+    unsigned count = 0;
+
+    for (; head != tail; ++head, ++count) {
+        handler(static_cast<const io_uring_cqe&>(m_cqes[head & m_cqMask]));
+    }
+    __atomic_store_n(m_cqHead, head, __ATOMIC_RELEASE);
+
+    return count;
+}
+
+} // namespace hek
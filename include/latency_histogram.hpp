@@ -0,0 +1,98 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstdint>
+#include <string>
+
+
+namespace hek {
+
+/**
+ * Fixed-memory, log-bucketed latency histogram in the style of HdrHistogram.
+ *
+ * Values below 128 get a bucket of their own; above that every power of two is split into 64 linear
+ * sub-buckets, so a recorded value is off by at most 1/64 (~1.6%) and any uint64_t value fits. Record()
+ * is lock-free and wait-free and may be called from any number of threads; the queries are meant for a
+ * (single) reporting thread and see a consistent enough picture while recording goes on.
+ */
+class LatencyHistogram {
+public:
+    LatencyHistogram();
+
+    LatencyHistogram(const LatencyHistogram&) = delete;
+    LatencyHistogram& operator=(const LatencyHistogram&) = delete;
+
+    void Record(uint64_t value) {
+        m_counts[BucketIndex(value)].fetch_add(1, std::memory_order_relaxed);
+        m_totalCount.fetch_add(1, std::memory_order_relaxed);
+        m_sum.fetch_add(value, std::memory_order_relaxed);
+
+        uint64_t max = m_max.load(std::memory_order_relaxed);
+        while (value > max && !m_max.compare_exchange_weak(max, value, std::memory_order_relaxed)) {
+        }
+        uint64_t min = m_min.load(std::memory_order_relaxed);
+        while (value < min && !m_min.compare_exchange_weak(min, value, std::memory_order_relaxed)) {
+        }
+    }
+
+    uint64_t Count() const { return m_totalCount.load(std::memory_order_relaxed); }
+    uint64_t Max() const { return m_max.load(std::memory_order_relaxed); }
+    uint64_t Min() const;
+    double Mean() const;
+
+    /**
+     * The (highest equivalent) value below which percentile % of the recorded values fall, eg 99.9.
+     */
+    uint64_t ValueAtPercentile(double percentile) const;
+
+    /**
+     * Move all recorded values into total and reset this histogram, eg to report an interval and keep
+     * the overall totals.
+     */
+    void DrainInto(LatencyHistogram& total);
+
+    /**
+     * Add the values recorded in other, eg to combine the histograms of several sockets for a report
+     */
+    void Add(const LatencyHistogram& other);
+
+    void Reset();
+
+    /**
+     * "count, min, p50, p90, p99, p99.9 and max", with values scaled by divider and suffixed with unit
+     */
+    std::string Summary(double divider = 1000.0, const char* unit = "us") const;
+
+private:
+    static constexpr int SUB_BUCKET_BITS = 6;
+    static constexpr uint64_t SUB_BUCKET_COUNT = uint64_t(1) << SUB_BUCKET_BITS;
+    static constexpr size_t BUCKET_COUNT = (64 - SUB_BUCKET_BITS) * SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+
+    static size_t BucketIndex(uint64_t value) {
+        if (value < 2 * SUB_BUCKET_COUNT) {
+            return static_cast<size_t>(value);
+        }
+        int shift = (63 - __builtin_clzll(value)) - SUB_BUCKET_BITS;
+        return static_cast<size_t>(shift) * SUB_BUCKET_COUNT + static_cast<size_t>(value >> shift);
+    }
+
+    static uint64_t HighestEquivalentValue(size_t index);
+
+    void AddCounts(uint64_t totalCount, uint64_t sum, uint64_t min, uint64_t max);
+
+private:
+    std::array<std::atomic<uint64_t>, BUCKET_COUNT> m_counts;
+    std::atomic<uint64_t> m_totalCount;
+    std::atomic<uint64_t> m_sum;
+    std::atomic<uint64_t> m_min;
+    std::atomic<uint64_t> m_max;
+};
+
+} // namespace hek
@@ -0,0 +1,32 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+
+
+namespace hek {
+
+/**
+ * The clock of the send times in the Pings' wire header, see wire_protocol.hpp
+ */
+inline uint64_t MonotonicNowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::steady_clock::now().time_since_epoch()).count());
+}
+
+/**
+ * The clock of the kernel's software RX/TX timestamps, see UdpSocketOptions::rxTimestamps
+ */
+inline uint64_t RealtimeNowNs() {
+    return static_cast<uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+        std::chrono::system_clock::now().time_since_epoch()).count());
+}
+
+} // namespace hek
@@ -0,0 +1,143 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <vector>
+
+
+namespace hek {
+
+enum class MetricType {
+    ECounter = 0,  // Only goes up
+    EGauge = 1     // Goes up and down, eg a queue depth
+};
+
+/**
+ * Registration of a metric in the MetricsRegistry; the metric is removed when its handle is destroyed.
+ * Destroy the handle before whatever a read callback of the metric looks at, eg by declaring it last.
+ */
+class Metric {
+public:
+    Metric() = default;
+    ~Metric() { Reset(); }
+
+    Metric(Metric&& other) noexcept;
+    Metric& operator=(Metric&& other) noexcept;
+    Metric(const Metric&) = delete;
+    Metric& operator=(const Metric&) = delete;
+
+    /**
+     * Remove the metric. When this function returns its read callback is not running and will not be called again.
+     */
+    void Reset();
+
+protected:
+    friend class MetricsRegistry;
+
+    uint64_t m_id = 0;     // 0: not registered
+    uint32_t m_slot = 0;   // Counter slot; 0 is the discard slot, which is never reported
+};
+
+/**
+ * Counter updated on the hot path. Every thread counts in a slot of its own, in a block of slots that no
+ * other thread writes, so Add() is a plain (relaxed atomic) load and store without a lock prefix or any
+ * cache line bouncing. The slots of all threads are only summed when the metrics are read.
+ * A default constructed counter counts into the discard slot.
+ */
+class Counter : public Metric {
+public:
+    void Add(uint64_t value = 1);
+};
+
+/**
+ * Process-wide set of metrics, exposed in the Prometheus text format (see MetricsEndpoint).
+ *
+ * Two kinds of metrics:
+ * - Counters (AddCounter()), per-thread as described above, for events on the hot path.
+ * - Read callbacks (AddCallback()), counters or gauges whose value is already tracked elsewhere, eg a queue
+ *   depth or a pool's statistics. They cost nothing until the metrics are read; they run on the reading
+ *   thread, with the registry locked, so they must not add or remove metrics.
+ *
+ * labels is the Prometheus label set without the braces, eg fd="5",address="0.0.0.0:8080".
+ */
+class MetricsRegistry {
+public:
+    // Counter slots per thread; counters added beyond this count into the discard slot
+    static constexpr size_t MAX_COUNTERS = 8192;
+
+    static MetricsRegistry& Default();
+
+    MetricsRegistry(const MetricsRegistry&) = delete;
+    MetricsRegistry& operator=(const MetricsRegistry&) = delete;
+
+    Counter AddCounter(const std::string& name, const std::string& help, const std::string& labels = "");
+    Metric AddCallback(const std::string& name, const std::string& help, MetricType type, const std::string& labels,
+                       std::function<uint64_t()> read);
+
+    /**
+     * All metrics in the Prometheus text exposition format (version 0.0.4), grouped by name
+     */
+    std::string FormatPrometheus();
+
+private:
+    friend class Metric;
+    friend class Counter;
+    friend struct ThreadCountersHolder;
+
+    struct alignas(64) ThreadCounters {
+        std::atomic<uint64_t> values[MAX_COUNTERS];
+    };
+
+    struct Entry {
+        std::string name;
+        std::string help;
+        MetricType type = MetricType::ECounter;
+        std::string labels;
+        uint32_t slot = 0;
+        std::function<uint64_t()> read;  // Empty for counters
+    };
+
+    MetricsRegistry();
+
+    void Remove(uint64_t id);
+    static std::atomic<uint64_t>* RegisterThread();
+    void RetireThread(ThreadCounters* counters);
+    uint64_t SumLocked(uint32_t slot) const;
+
+    // The counter slots of the calling thread, nullptr until it first counts
+    static inline thread_local std::atomic<uint64_t>* t_counters = nullptr;
+
+    // Lock order: m_entryMutex before m_threadMutex; read callbacks are only called with m_entryMutex held
+    std::mutex m_entryMutex;
+    std::map<uint64_t, Entry> m_entries;  // By id, ie in order of registration
+    uint64_t m_nextId;
+    std::vector<uint32_t> m_freeSlots;
+
+    std::mutex m_threadMutex;
+    std::vector<std::unique_ptr<ThreadCounters>> m_threadCounters;
+    std::vector<uint64_t> m_retiredCounts;  // Counts of the threads that have exited, by slot
+    std::unique_ptr<ThreadCounters> m_exitedThreadCounters;  // Where exiting threads count, never reported
+};
+
+inline void Counter::Add(uint64_t value) {
+    std::atomic<uint64_t>* counters = MetricsRegistry::t_counters;
+    if (!counters) {
+        counters = MetricsRegistry::RegisterThread();
+    }
+    std::atomic<uint64_t>& counter = counters[m_slot];
+    counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed);
+}
+
+} // namespace hek
@@ -0,0 +1,52 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include "event_loop.hpp"
+#include "metrics.hpp"
+
+#include <string>
+
+
+namespace hek {
+
+/**
+ * Serves the metrics of a MetricsRegistry on a local Unix-domain stream socket, eg for
+ *
+ *   curl --unix-socket /tmp/udp_server.metrics http://localhost/metrics
+ *
+ * An HTTP GET gets an HTTP/1.0 response; any other request, or a client that sends nothing (within
+ * REQUEST_TIMEOUT_MS), gets the bare Prometheus text. Every connection is answered once and closed.
+ * The scrapes are served one at a time on a thread of the endpoint's own (named "metrics").
+ */
+class MetricsEndpoint : public IEventHandler {
+public:
+    explicit MetricsEndpoint(MetricsRegistry& registry = MetricsRegistry::Default());
+    ~MetricsEndpoint();
+
+    MetricsEndpoint(const MetricsEndpoint&) = delete;
+    MetricsEndpoint& operator=(const MetricsEndpoint&) = delete;
+
+    /**
+     * Listen on path, replacing a stale socket file left behind there. Returns 0 on success, -1 on failure.
+     */
+    int Init(const std::string& path);
+
+private:
+    static constexpr int REQUEST_TIMEOUT_MS = 200;
+    static constexpr int SEND_TIMEOUT_MS = 1000;
+
+    void HandleEvents(uint32_t events) override;
+    void Serve(int clientFd);
+
+    MetricsRegistry& m_registry;
+    std::string m_path;
+    int m_listenFd;
+    EventLoop m_eventLoop;
+};
+
+} // namespace hek
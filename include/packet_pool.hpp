@@ -0,0 +1,137 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+
+namespace hek {
+
+class PacketPool;
+
+/**
+ * Header of a pooled packet buffer. Lives in a separate header array of the slab, so the payload
+ * memory itself stays contiguous and aligned. Reference counted through PacketView.
+ */
+struct alignas(64) PacketBuffer {
+    uint8_t* data = nullptr;
+    uint32_t capacity = 0;
+    std::atomic<uint32_t> refCount{0};
+    PacketPool* pool = nullptr;
+    PacketBuffer* next = nullptr; // Free list link, only valid while the buffer is not in use
+};
+
+struct PacketPoolOptions {
+    // Capacity of every buffer in bytes
+    size_t bufferSize = 2048;
+
+    // Buffers allocated per slab; the pool starts with one slab and grows a slab at a time
+    size_t buffersPerSlab = 256;
+
+    // Upper bound for the total number of buffers; Allocate() fails (and counts an exhaustion) beyond it
+    size_t maxBuffers = 4096;
+
+    // Back the slabs with explicit huge pages (MAP_HUGETLB). Falls back to regular pages with
+    // MADV_HUGEPAGE when no huge pages are reserved.
+    bool useHugePages = false;
+};
+
+struct PacketPoolStats {
+    uint64_t totalBuffers = 0;     // Buffers owned by the pool (pool size)
+    uint64_t buffersInUse = 0;     // Buffers currently referenced by a PacketView
+    uint64_t highWaterMark = 0;    // Maximum of buffersInUse since construction
+    uint64_t exhaustions = 0;      // Allocate() calls that failed because maxBuffers was reached
+    uint64_t slabAllocations = 0;  // Calls to the system allocator; stays constant in steady state
+};
+
+/**
+ * Fixed-size packet buffer pool. Buffers are carved out of large slabs and recycled through small
+ * per-thread caches (sharded by thread), so the steady state neither calls the system allocator nor
+ * contends on a shared lock. Release happens through the buffer's reference count, on any thread.
+ *
+ * The pool must outlive every buffer allocated from it.
+ */
+class PacketPool {
+public:
+    explicit PacketPool(const PacketPoolOptions& options = PacketPoolOptions());
+    ~PacketPool();
+
+    PacketPool(const PacketPool&) = delete;
+    PacketPool& operator=(const PacketPool&) = delete;
+
+    /**
+     * Allocate a buffer with a reference count of 1, or nullptr when the pool is exhausted.
+     */
+    PacketBuffer* Allocate();
+
+    /**
+     * Allocate up to count buffers at once. Returns the number of buffers allocated.
+     */
+    size_t Allocate(PacketBuffer** buffers, size_t count);
+
+    static void AddRef(PacketBuffer* buffer) {
+        buffer->refCount.fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void Release(PacketBuffer* buffer) {
+        if (buffer->refCount.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            buffer->pool->Free(buffer);
+        }
+    }
+
+    size_t BufferSize() const;
+    PacketPoolStats GetStats() const;
+
+private:
+    static constexpr size_t CACHE_SHARD_COUNT = 16;
+    static constexpr size_t CACHE_TRANSFER_COUNT = 32;
+
+    struct alignas(64) CacheShard {
+        std::atomic_flag lock = ATOMIC_FLAG_INIT;
+        PacketBuffer* head = nullptr;
+        size_t count = 0;
+    };
+
+    struct Slab {
+        uint8_t* memory = nullptr;
+        size_t bytes = 0;
+        bool mapped = false;
+        std::unique_ptr<PacketBuffer[]> headers;
+    };
+
+    void Free(PacketBuffer* buffer);
+    PacketBuffer* RefillAndAllocate(CacheShard& shard);
+    bool AddSlabLocked();
+    void OnAllocated(size_t count);
+
+    static size_t ThreadShardIndex();
+    static void Lock(CacheShard& shard);
+    static void Unlock(CacheShard& shard);
+
+private:
+    PacketPoolOptions m_options;
+    std::array<CacheShard, CACHE_SHARD_COUNT> m_shards;
+
+    mutable std::mutex m_centralMutex;
+    PacketBuffer* m_centralHead;
+    size_t m_centralCount;
+    std::vector<Slab> m_slabs;
+
+    std::atomic<uint64_t> m_totalBuffers;
+    std::atomic<uint64_t> m_buffersInUse;
+    std::atomic<uint64_t> m_highWaterMark;
+    std::atomic<uint64_t> m_exhaustions;
+    std::atomic<uint64_t> m_slabAllocations;
+};
+
+} // namespace hek
@@ -0,0 +1,150 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include "packet_pool.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <string_view>
+#include <utility>
+#include <netinet/in.h>
+
+
+namespace hek {
+
+/**
+ * Reference counted handle on (a range of) a pooled packet buffer. Copying a view only bumps the
+ * reference count of the buffer, moving it hands the reference on; the payload itself is never
+ * copied. The buffer goes back to its PacketPool when the last view on it is released.
+ */
+class PacketView {
+public:
+    PacketView() = default;
+
+    /**
+     * Adopts the reference the caller holds on the buffer (e.g. the one returned by PacketPool::Allocate()).
+     */
+    PacketView(PacketBuffer* buffer, size_t size, const sockaddr_in& senderAddr)
+        : m_buffer(buffer), m_data(buffer ? buffer->data : nullptr), m_size(buffer ? size : 0),
+          m_senderAddr(senderAddr) {}
+
+    /**
+     * Allocate a fresh buffer from the pool; the view is empty when the pool is exhausted.
+     */
+    static PacketView Allocate(PacketPool& pool, size_t size = 0) {
+        return PacketView(pool.Allocate(), size, sockaddr_in{});
+    }
+
+    ~PacketView() { Release(); }
+
+    PacketView(const PacketView& other)
+        : m_buffer(other.m_buffer), m_data(other.m_data), m_size(other.m_size), m_senderAddr(other.m_senderAddr),
+          m_kernelRxTimeNs(other.m_kernelRxTimeNs), m_readTimeNs(other.m_readTimeNs) {
+        if (m_buffer) {
+            PacketPool::AddRef(m_buffer);
+        }
+    }
+
+    PacketView& operator=(const PacketView& other) {
+        if (this != &other) {
+            PacketView copy(other);
+            *this = std::move(copy);
+        }
+        return *this;
+    }
+
+    PacketView(PacketView&& other) noexcept { MoveFrom(other); }
+
+    PacketView& operator=(PacketView&& other) noexcept {
+        if (this != &other) {
+            Release();
+            MoveFrom(other);
+        }
+        return *this;
+    }
+
+    /**
+     * A view on a sub range of this packet, sharing (and referencing) the same buffer.
+     */
+    PacketView Slice(size_t offset, size_t size) const {
+        PacketView slice(*this);
+        slice.m_data += offset;
+        slice.m_size = size;
+        return slice;
+    }
+
+    const uint8_t* Data() const { return m_data; }
+
+    // Only write through this when IsUnique(): other views on the buffer may be read concurrently
+    uint8_t* MutableData() { return m_data; }
+
+    /**
+     * True when this view holds the only reference on its buffer (no clones or slices of it exist),
+     * so the payload can be modified in place.
+     */
+    bool IsUnique() const { return m_buffer && m_buffer->refCount.load(std::memory_order_acquire) == 1; }
+
+    size_t Size() const { return m_size; }
+    size_t Capacity() const { return m_buffer ? m_buffer->capacity - static_cast<size_t>(m_data - m_buffer->data) : 0; }
+    bool Empty() const { return m_buffer == nullptr; }
+    const sockaddr_in& SenderAddr() const { return m_senderAddr; }
+
+    /**
+     * Receive timestamps in CLOCK_REALTIME ns, 0 unless the socket has rxTimestamps enabled: when the
+     * kernel received the datagram (software timestamp), and when the receiver thread read it from the
+     * socket. Their difference is the time spent in the socket's receive queue.
+     */
+    uint64_t KernelRxTimeNs() const { return m_kernelRxTimeNs; }
+    uint64_t ReadTimeNs() const { return m_readTimeNs; }
+
+    void SetSize(size_t size) { m_size = size; }
+
+    // Drop bytes from the front of the view, eg a header the kernel put in front of the payload
+    void Advance(size_t bytes) {
+        m_data += bytes;
+        m_size -= bytes;
+    }
+    void SetSenderAddr(const sockaddr_in& senderAddr) { m_senderAddr = senderAddr; }
+    void SetReceiveTimes(uint64_t kernelRxTimeNs, uint64_t readTimeNs) {
+        m_kernelRxTimeNs = kernelRxTimeNs;
+        m_readTimeNs = readTimeNs;
+    }
+
+    std::string_view AsStringView() const {
+        return std::string_view(reinterpret_cast<const char*>(m_data), m_size);
+    }
+
+    void Release() {
+        if (m_buffer) {
+            PacketPool::Release(m_buffer);
+        }
+        m_buffer = nullptr;
+        m_data = nullptr;
+        m_size = 0;
+    }
+
+private:
+    void MoveFrom(PacketView& other) {
+        m_buffer = std::exchange(other.m_buffer, nullptr);
+        m_data = std::exchange(other.m_data, nullptr);
+        m_size = std::exchange(other.m_size, 0);
+        m_senderAddr = other.m_senderAddr;
+        m_kernelRxTimeNs = other.m_kernelRxTimeNs;
+        m_readTimeNs = other.m_readTimeNs;
+    }
+
+private:
+    PacketBuffer* m_buffer = nullptr;
+    uint8_t* m_data = nullptr;
+    size_t m_size = 0;
+    sockaddr_in m_senderAddr = {};
+    uint64_t m_kernelRxTimeNs = 0;
+    uint64_t m_readTimeNs = 0;
+};
+
+} // namespace hek
@@ -6,21 +6,27 @@
 
 #pragma once
 
-#include <queue>
+#include <limits>
 #include <mutex>
 #include <optional>
+#include <utility>
+#include <vector>
 
 namespace hek {
 
+/**
+ * Unbounded, mutex protected FIFO queue. Items live in a ring of slots that doubles when it is full and
+ * never shrinks, so once it has grown to the peak depth pushing and popping no longer touch the heap.
+ */
 template <typename T>
 class ProtectedQueue {
 public:
-    ProtectedQueue() = default;
+    ProtectedQueue() : m_slots(INITIAL_CAPACITY) {}
     virtual ~ProtectedQueue() = default;
 
     ProtectedQueue(const ProtectedQueue &other) {
         std::lock_guard<std::mutex> guard(other.m_mutex);
-        m_queue = other.m_queue;
+        CopyFrom(other);
     }
 
     ProtectedQueue &operator=(ProtectedQueue &other) {
@@ -31,34 +37,36 @@ public:
         std::unique_lock<std::mutex> lock1(m_mutex, std::defer_lock);
         std::unique_lock<std::mutex> lock2(other.m_mutex, std::defer_lock);
         std::lock(lock1, lock2);
-        m_queue = other.m_queue;
+        CopyFrom(other);
 
         return *this;
     }
 
     bool Pop(T &outItem) {
         std::lock_guard<std::mutex> guard(m_mutex);
-        if (!m_queue.empty()) {
-            outItem = m_queue.front();
-            m_queue.pop();
-            return true;
+        if (m_size == 0) {
+            return false;
         }
-        return false;
+        // The moved-from slot holds nothing any more
+        outItem = std::move(m_slots[m_head]);
+        m_head = (m_head + 1) & m_mask;
+        --m_size;
+        return true;
     }
 
     bool Pop() {
         std::lock_guard<std::mutex> guard(m_mutex);
-        if (!m_queue.empty()) {
-            m_queue.pop();
-            return true;
+        if (m_size == 0) {
+            return false;
         }
-        return false;
+        DiscardFront();
+        return true;
     }
 
     bool Front(T &outItem) {
         std::lock_guard<std::mutex> guard(m_mutex);
-        if (!m_queue.empty()) {
-            outItem = m_queue.front();
+        if (m_size != 0) {
+            outItem = m_slots[m_head];
             return true;
         }
         return false;
@@ -66,42 +74,81 @@ public:
 
     std::optional<std::reference_wrapper<T>> Front() {
         std::lock_guard<std::mutex> guard(m_mutex);
-        if (!m_queue.empty()) {
-            return m_queue.front();
+        if (m_size != 0) {
+            return m_slots[m_head];
         }
         return std::nullopt;
     }
 
 
     void Push(const T &inItem) {
-        std::lock_guard<std::mutex> guard(m_mutex);
-        m_queue.push(inItem);
+        T copy(inItem);
+        Push(std::move(copy));
     }
 
     void Push(T &&inItem) {
         std::lock_guard<std::mutex> guard(m_mutex);
-        m_queue.push(std::move(inItem));
+        if (m_size == m_slots.size()) {
+            Grow();
+        }
+        m_slots[(m_head + m_size) & m_mask] = std::move(inItem);
+        ++m_size;
     }
 
     bool Empty() {
         std::lock_guard<std::mutex> guard(m_mutex);
-        return m_queue.empty();
+        return m_size == 0;
     }
 
     int Size() {
         std::lock_guard<std::mutex> guard(m_mutex);
-        return static_cast<int>(m_queue.size());
+        return static_cast<int>(m_size);
     }
 
     void Clear() {
         std::lock_guard<std::mutex> guard(m_mutex);
-        std::queue<T> emptyQueue;
-        std::swap(m_queue, emptyQueue);
+        while (m_size != 0) {
+            DiscardFront();
+        }
     }
 
+    // Queue policy traits, see AsyncHandler
+    static constexpr size_t MaxSize() { return std::numeric_limits<size_t>::max(); }
+    static constexpr bool SupportsProducerPop() { return true; }
+
 private:
-    std::queue<T> m_queue;
-    std::mutex m_mutex;
+    static constexpr size_t INITIAL_CAPACITY = 64;
+
+    // Reset the slot right away, so eg a packet buffer held by the item goes back to its pool now
+    void DiscardFront() {
+        m_slots[m_head] = T();
+        m_head = (m_head + 1) & m_mask;
+        --m_size;
+    }
+
+    void Grow() {
+        std::vector<T> slots(m_slots.size() * 2);
+        for (size_t i = 0; i < m_size; ++i) {
+            slots[i] = std::move(m_slots[(m_head + i) & m_mask]);
+        }
+        m_slots.swap(slots);
+        m_mask = m_slots.size() - 1;
+        m_head = 0;
+    }
+
+    void CopyFrom(const ProtectedQueue &other) {
+        m_slots = other.m_slots;
+        m_mask = other.m_mask;
+        m_head = other.m_head;
+        m_size = other.m_size;
+    }
+
+    // Power of two sized; m_size items from m_head on, wrapping around
+    std::vector<T> m_slots;
+    size_t m_mask = INITIAL_CAPACITY - 1;
+    size_t m_head = 0;
+    size_t m_size = 0;
+    mutable std::mutex m_mutex;
 };
 
 } // namespace hek
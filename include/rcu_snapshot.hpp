@@ -0,0 +1,109 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+
+namespace hek {
+
+/**
+ * Read-copy-update holder of a value that is read very often and changed rarely, eg a list of observers.
+ *
+ * Readers take an immutable snapshot with Read(), which is lock-free: one increment of a reader counter and
+ * one atomic load, and a decrement when the ReadGuard goes out of scope. Writers are serialized; Update()
+ * copies the current snapshot, lets the caller modify the copy, publishes it with a single atomic swap and
+ * then waits for a grace period before it deletes the old snapshot. So when Update() returns, no reader is
+ * using any snapshot older than the one it published, eg no callback of a removed observer is in flight.
+ *
+ * Readers count themselves in one of two counters, selected by an epoch. The grace period flips the epoch
+ * so new readers move to the other counter, waits for the old counter to drain, and does the same for the
+ * other one, so it ends even when reads never stop.
+ *
+ * Update() must not be called from within a read section of the same holder, it would wait for itself.
+ */
+template <typename T>
+class RcuSnapshot {
+public:
+    class ReadGuard {
+    public:
+        ~ReadGuard() { m_readers.fetch_sub(1, std::memory_order_release); }
+
+        ReadGuard(const ReadGuard&) = delete;
+        ReadGuard& operator=(const ReadGuard&) = delete;
+
+        const T& operator*() const { return *m_snapshot; }
+        const T* operator->() const { return m_snapshot; }
+
+    private:
+        friend class RcuSnapshot;
+        ReadGuard(std::atomic<uint64_t>& readers, const T* snapshot) : m_readers(readers), m_snapshot(snapshot) {}
+
+        std::atomic<uint64_t>& m_readers;
+        const T* m_snapshot;
+    };
+
+    RcuSnapshot() : m_current(new T()) {}
+    ~RcuSnapshot() { delete m_current.load(std::memory_order_relaxed); }
+
+    RcuSnapshot(const RcuSnapshot&) = delete;
+    RcuSnapshot& operator=(const RcuSnapshot&) = delete;
+
+    /**
+     * The current snapshot, valid for as long as the guard lives.
+     */
+    ReadGuard Read() const {
+        std::atomic<uint64_t>& readers = m_readers[m_epoch.load(std::memory_order_relaxed)].count;
+        // Count ourselves before loading the snapshot: either Update() sees the count, or we see its snapshot
+        readers.fetch_add(1, std::memory_order_seq_cst);
+        return ReadGuard(readers, m_current.load(std::memory_order_seq_cst));
+    }
+
+    /**
+     * Publish a modified copy of the current snapshot; modify is called as modify(T&) on the copy.
+     * Returns after the grace period, with the old snapshot deleted.
+     */
+    template <typename Modify>
+    void Update(Modify&& modify) {
+        std::lock_guard<std::mutex> lock(m_writerMutex);
+        std::unique_ptr<T> next(new T(*m_current.load(std::memory_order_relaxed)));
+        std::forward<Modify>(modify)(*next);
+
+        std::unique_ptr<const T> previous(m_current.exchange(next.release(), std::memory_order_seq_cst));
+        WaitForReaders();
+    }
+
+private:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    struct alignas(CACHE_LINE_SIZE) ReaderCount {
+        std::atomic<uint64_t> count{0};
+    };
+
+    void WaitForReaders() {
+        for (int phase = 0; phase < 2; ++phase) {
+            size_t epoch = m_epoch.load(std::memory_order_relaxed);
+            m_epoch.store(epoch ^ 1, std::memory_order_seq_cst);
+            while (m_readers[epoch].count.load(std::memory_order_seq_cst) != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+    std::atomic<const T*> m_current;
+    mutable ReaderCount m_readers[2];
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_epoch{0};
+    std::mutex m_writerMutex;
+};
+
+} // namespace hek
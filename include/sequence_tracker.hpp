@@ -0,0 +1,85 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <array>
+#include <cstdint>
+#include <mutex>
+#include <string>
+#include <unordered_map>
+
+
+namespace hek {
+
+struct SequenceStats {
+    uint64_t received = 0;    // Unique sequence numbers received
+    uint64_t lost = 0;        // Never received (including the ones still missing inside the window)
+    uint64_t reordered = 0;   // Received after a higher sequence number, but inside the window
+    uint64_t duplicates = 0;  // Received more than once
+    uint64_t late = 0;        // Received too late to tell, behind the window; already counted as lost
+
+    SequenceStats& operator+=(const SequenceStats& other);
+    std::string Summary() const;
+};
+
+/**
+ * Loss, reorder and duplicate accounting for one flow of sequence numbered datagrams.
+ *
+ * Keeps a sliding bitmap of the last WINDOW_SIZE sequence numbers below the highest one seen. A sequence
+ * number that slides out of the window without having been received counts as lost. Each packet costs
+ * O(1): a bit test and set, plus one bit per sequence number the window advances (the whole window at
+ * once for gaps beyond it). Not thread safe; every flow is tracked by one thread at a time.
+ */
+class SequenceTracker {
+public:
+    static constexpr uint64_t WINDOW_SIZE = 1024;
+
+    SequenceTracker();
+
+    void Track(uint64_t sequence);
+
+    SequenceStats GetStats() const;
+
+private:
+    static constexpr uint64_t WORD_BITS = 64;
+    static constexpr uint64_t WORD_COUNT = WINDOW_SIZE / WORD_BITS;
+
+    bool TestAndSet(uint64_t sequence);
+    void Advance(uint64_t sequence);
+
+private:
+    bool m_started;
+    uint64_t m_first;
+    uint64_t m_highest;
+    uint64_t m_missing;  // Not (yet) received sequence numbers inside the window
+    SequenceStats m_stats;
+    std::array<uint64_t, WORD_COUNT> m_window;  // Bit (sequence % WINDOW_SIZE) set: received
+};
+
+/**
+ * SequenceTrackers for many flows, eg one per sender. Flows are spread over lock striped maps, so flows
+ * tracked on different threads hardly ever contend.
+ */
+class FlowSequenceTrackers {
+public:
+    void Track(uint64_t flowKey, uint64_t sequence);
+
+    SequenceStats GetTotals() const;
+    size_t FlowCount() const;
+
+private:
+    static constexpr size_t STRIPE_COUNT = 16;
+
+    struct alignas(64) Stripe {
+        mutable std::mutex mutex;
+        std::unordered_map<uint64_t, SequenceTracker> flows;
+    };
+
+    std::array<Stripe, STRIPE_COUNT> m_stripes;
+};
+
+} // namespace hek
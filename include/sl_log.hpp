@@ -6,58 +6,97 @@
 
 #pragma once
 
+#include <atomic>
+#include <cstdint>
 #include <string>
-#include <iostream>
-#include <chrono>
-#include <ctime>
-#include <sstream>
-#include <iomanip>
 
-namespace hek {
+/**
+ * Log levels below SLLOG_COMPILE_LEVEL are compiled out of the SLLOG_* macros and the LogInfo/LogWarn/LogError
+ * functions: 0 = info (default), 1 = warning, 2 = error, 3 = nothing.
+ */
+#ifndef SLLOG_COMPILE_LEVEL
+#define SLLOG_COMPILE_LEVEL 0
+#endif
 
-class SLLog {
-public:
-    static std::string GetTimeStamp() {
-        std::time_t now = std::chrono::system_clock::to_time_t(std::chrono::system_clock::now());
+/**
+ * printf-style logging. The arguments are only evaluated when the level is enabled, and the message is
+ * formatted straight into the log record, so these never allocate.
+ */
+#define SLLOG_INFO(...)  SLLOG_AT(::hek::LogLevel::EInfo, __VA_ARGS__)
+#define SLLOG_WARN(...)  SLLOG_AT(::hek::LogLevel::EWarn, __VA_ARGS__)
+#define SLLOG_ERROR(...) SLLOG_AT(::hek::LogLevel::EError, __VA_ARGS__)
 
-        std::string timestamp(30, '\0');
-        std::strftime(&timestamp[0], timestamp.size(), "%Y-%m-%d %H:%M:%S", std::localtime(&now));
+#define SLLOG_AT(level, ...)                        \
+    do {                                            \
+        if (::hek::SLLog::IsEnabled(level)) {       \
+            ::hek::SLLog::Logf(level, __VA_ARGS__); \
+        }                                           \
+    } while (0)
 
-        // Get the milliseconds
-        int msec = std::chrono::time_point_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now())
-                       .time_since_epoch()
-                       .count() % 100;
-        std::stringstream ss;
-        ss << std::setw(3) << std::setfill('0') << msec;
-        timestamp += ":" + ss.str();
+namespace hek {
 
-        return timestamp;
+enum class LogLevel : uint8_t {
+    EInfo = 0,
+    EWarn = 1,
+    EError = 2,
+    EOff = 3
+};
+
+/**
+ * Logging front end. Producers copy their message into a fixed-size record in a lock-free per-thread ring;
+ * a background thread timestamps, formats and writes the records in batches. Info goes to stdout, warnings
+ * and errors to stderr. When a ring is full the record is dropped and counted, logging never blocks.
+ *
+ * The runtime level defaults to the SLLOG_LEVEL environment variable (info, warn, error or off).
+ */
+class SLLog {
+public:
+    static bool IsEnabled(LogLevel inLevel) {
+#if SLLOG_COMPILE_LEVEL > 0
+        // Only compared when it can be false: against 0 it draws -Wtype-limits
+        if (static_cast<int>(inLevel) < SLLOG_COMPILE_LEVEL) {
+            return false;
+        }
+#endif
+        return inLevel >= s_level.load(std::memory_order_relaxed) && inLevel != LogLevel::EOff;
     }
 
+    static void SetLogLevel(LogLevel inLevel) { s_level.store(inLevel, std::memory_order_relaxed); }
+    static LogLevel GetLogLevel() { return s_level.load(std::memory_order_relaxed); }
+
     static void LogInfo(const std::string &inMsg) {
-        std::cout << "\033[1;32m" // Green color
-                  << GetTimeStamp() << " INFO - " << inMsg.c_str()
-                  << "\033[0m"    // Reset color
-                  << std::endl << std::flush;
+        if (IsEnabled(LogLevel::EInfo)) {
+            Log(LogLevel::EInfo, inMsg.data(), inMsg.size());
+        }
     }
 
     static void LogWarn(const std::string &inMsg) {
-        std::cerr << "\033[1;33m" // Yellow (close to orange)
-                  << GetTimeStamp() << " WARNING - " << inMsg.c_str()
-                  << "\033[0m"    // Reset color
-                  << std::endl << std::flush;
+        if (IsEnabled(LogLevel::EWarn)) {
+            Log(LogLevel::EWarn, inMsg.data(), inMsg.size());
+        }
     }
 
     static void LogError(const std::string &inMsg) {
-        std::cerr << "\033[1;31m" // Red color
-                  << GetTimeStamp() << " ERROR - " << inMsg.c_str()
-                  << "\033[0m"    // Reset color
-                  << std::endl << std::flush;
+        if (IsEnabled(LogLevel::EError)) {
+            Log(LogLevel::EError, inMsg.data(), inMsg.size());
+        }
     }
 
+    static void Log(LogLevel inLevel, const char* inMsg, size_t inLength);
+    static void Logf(LogLevel inLevel, const char* inFormat, ...) __attribute__((format(printf, 2, 3)));
+
+    /**
+     * Block until everything logged before this call has been written.
+     */
+    static void Flush();
+
 private:
     explicit SLLog();
     ~SLLog();
+
+    static LogLevel LevelFromEnvironment();
+
+    static inline std::atomic<LogLevel> s_level{LevelFromEnvironment()};
 };
 
 } // namespace hek
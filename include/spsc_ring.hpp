@@ -0,0 +1,132 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <thread>
+#include <utility>
+#include <vector>
+
+
+namespace hek {
+
+inline void CpuRelax() {
+#if defined(__x86_64__) || defined(__i386__)
+    __builtin_ia32_pause();
+#elif defined(__aarch64__)
+    asm volatile("yield" ::: "memory");
+#endif
+}
+
+/**
+ * Bounded, lock-free single-producer/single-consumer ring buffer. Exactly one thread may push and
+ * exactly one (other) thread may pop. Head and tail live on their own cache lines, and each side keeps
+ * a cached copy of the other side's index, so the common case touches no shared cache line.
+ *
+ * Offers the same Push/Pop/Empty/Size/Clear interface as ProtectedQueue, so it can be used as the
+ * queue policy of an AsyncHandler whose actions are triggered from a single thread.
+ */
+template <typename T, size_t Capacity = 4096>
+class SpscRing {
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0, "SpscRing capacity must be a power of two");
+
+public:
+    SpscRing() : m_slots(Capacity) {}
+
+    SpscRing(const SpscRing&) = delete;
+    SpscRing& operator=(const SpscRing&) = delete;
+
+    /**
+     * Producer side. Returns false when the ring is full.
+     */
+    bool TryPush(T&& inItem) {
+        const size_t tail = m_tail.load(std::memory_order_relaxed);
+        if (tail - m_cachedHead == Capacity) {
+            m_cachedHead = m_head.load(std::memory_order_acquire);
+            if (tail - m_cachedHead == Capacity) {
+                return false;
+            }
+        }
+
+        m_slots[tail & (Capacity - 1)] = std::move(inItem);
+        m_tail.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Producer side. Waits for the consumer to make room when the ring is full.
+     */
+    void Push(T&& inItem) {
+        while (!TryPush(std::move(inItem))) {
+            std::this_thread::yield();
+        }
+    }
+
+    void Push(const T& inItem) {
+        T copy(inItem);
+        Push(std::move(copy));
+    }
+
+    /**
+     * Consumer side. Returns false when the ring is empty.
+     */
+    bool Pop(T& outItem) {
+        const size_t head = m_head.load(std::memory_order_relaxed);
+        if (head == m_cachedTail) {
+            m_cachedTail = m_tail.load(std::memory_order_acquire);
+            if (head == m_cachedTail) {
+                return false;
+            }
+        }
+
+        outItem = std::move(m_slots[head & (Capacity - 1)]);
+        m_head.store(head + 1, std::memory_order_release);
+        return true;
+    }
+
+    /**
+     * Consumer side. Discards one item.
+     */
+    bool Pop() {
+        T discarded;
+        return Pop(discarded);
+    }
+
+    bool Empty() const {
+        return m_head.load(std::memory_order_acquire) == m_tail.load(std::memory_order_acquire);
+    }
+
+    int Size() const {
+        return static_cast<int>(m_tail.load(std::memory_order_acquire) - m_head.load(std::memory_order_acquire));
+    }
+
+    // Queue policy traits, see AsyncHandler
+    static constexpr size_t MaxSize() { return Capacity; }
+    static constexpr bool SupportsProducerPop() { return false; }
+
+    /**
+     * Consumer side. Discards all items.
+     */
+    void Clear() {
+        while (Pop()) {
+        }
+    }
+
+private:
+    static constexpr size_t CACHE_LINE_SIZE = 64;
+
+    std::vector<T> m_slots;
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_head{0}; // Written by the consumer
+    size_t m_cachedTail = 0;                                 // Consumer's copy of m_tail
+
+    alignas(CACHE_LINE_SIZE) std::atomic<size_t> m_tail{0}; // Written by the producer
+    size_t m_cachedHead = 0;                                 // Producer's copy of m_head
+};
+
+} // namespace hek
@@ -0,0 +1,72 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <string>
+#include <thread>
+#include <vector>
+#include <sched.h>
+
+
+namespace hek {
+
+/**
+ * Placement of a thread: its name (as shown by top, perf and gdb), the CPUs it may run on and its
+ * scheduling policy. Every thread the library starts has a config with a default name; all other fields
+ * default to leaving the thread alone.
+ */
+struct ThreadConfig {
+    // pthread_setname_np() name, truncated to 15 characters. Empty leaves the name alone.
+    std::string name;
+
+    // CPUs the thread may run on. Empty leaves the affinity alone.
+    std::vector<int> cpus;
+
+    // SCHED_FIFO or SCHED_RR with a priority of 1-99 make the thread real-time, which needs CAP_SYS_NICE
+    // or an RLIMIT_RTPRIO. SCHED_OTHER leaves the scheduling alone.
+    int schedPolicy = SCHED_OTHER;
+    int schedPriority = 0;
+
+    /**
+     * Config of thread index of a group of threads (eg the workers of an event loop or handler pool):
+     * the name gets "-<index>" appended and the thread is pinned to cpus[index % cpus.size()].
+     */
+    ThreadConfig ForIndex(size_t index) const;
+};
+
+/**
+ * Apply config to a (running) thread. Every setting that fails is logged as a warning and the others are
+ * still applied; returns 0 when all succeeded, -1 otherwise.
+ */
+int ApplyThreadConfig(std::thread::native_handle_type thread, const ThreadConfig& config);
+
+/**
+ * Parse a CPU list in the kernel's format, eg "0,2,4-7". Returns false for malformed lists.
+ */
+bool ParseCpuList(const std::string& text, std::vector<int>& cpus);
+
+/**
+ * Parse a byte count with an optional k or M suffix (x1024), eg "4M", for a socket buffer size: at most
+ * INT_MAX / 2, as the kernel doubles it. Returns false for malformed or out of range sizes.
+ */
+bool ParseByteSize(const std::string& text, int& bytes);
+
+/**
+ * The nearest other CPU sharing a cache with cpu: a hyperthread sibling sharing L1/L2 if there is one,
+ * otherwise a core sharing the L2 or L3. Use it to put a receiver and its handler close together.
+ * Returns -1 when no other CPU shares a cache with cpu (or the topology cannot be read).
+ */
+int FindCacheSiblingCpu(int cpu);
+
+/**
+ * config, pinned to a cache sibling of the first CPU of neighbour, eg a handler thread next to its receiver
+ * thread. Logs a warning and returns config unchanged when neighbour is not pinned or has no cache sibling.
+ */
+ThreadConfig PinToCacheSibling(const ThreadConfig& config, const ThreadConfig& neighbour);
+
+} // namespace hek
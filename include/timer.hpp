@@ -6,29 +6,22 @@
 
 #pragma once
 
-#include "protected_queue.hpp"
+#include "timer_wheel.hpp"
 
-#include <atomic>
-#include <chrono>
-#include <condition_variable>
+#include <cstdint>
 #include <functional>
 #include <mutex>
-#include <thread>
 
 
 namespace hek {
 
-using TimeoutCallback_t = std::function<void(void)>;
-
-struct TimerParams_t {
-    uint32_t timeoutMs = 0;
-    bool repeat = false;
-    bool enabled = false;
-};
-
+/**
+ * One-shot or repeating timer. A thin handle on a TimerWheel (TimerWheel::Default() unless specified):
+ * all Timers share the wheel's thread instead of running a thread each.
+ */
 class Timer {
 public:
-    Timer();
+    explicit Timer(TimerWheel& wheel = TimerWheel::Default());
     ~Timer();
 
     Timer(const Timer&) = delete;
@@ -44,12 +37,10 @@ private:
     void Handler();
 
 private:
-    std::thread m_HandlerThread;
-    std::atomic_bool m_HandlerRunning;
+    TimerWheel& m_Wheel;
 
     std::mutex m_Mutex;
-    std::condition_variable m_TimerCondition;
-    ProtectedQueue<TimerParams_t> m_TimerQueue;
+    TimerWheel::TimerId m_TimerId;
 
     std::mutex m_TimeoutCallbackMutex;
     TimeoutCallback_t m_pTimeoutCallback;
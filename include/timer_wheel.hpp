@@ -0,0 +1,131 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include "metrics.hpp"
+#include "thread_config.hpp"
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+
+namespace hek {
+
+using TimeoutCallback_t = std::function<void(void)>;
+
+/**
+ * Hierarchical timing wheel: any number of one-shot and periodic timers served by one thread.
+ *
+ * Four levels of 256 slots each; a timer is filed in the level that matches its distance to expiry and
+ * cascades down as the wheel turns, so Schedule() and Cancel() are O(1). All timers expiring on the same
+ * tick are dispatched as one batch, outside the wheel's lock. Periodic timers are rescheduled from their
+ * ideal expiry, so they do not drift; missed periods are counted as overruns.
+ */
+class TimerWheel {
+public:
+    using TimerId = uint64_t;
+    static constexpr TimerId INVALID_TIMER_ID = 0;
+
+    explicit TimerWheel(std::chrono::microseconds tickDuration = std::chrono::milliseconds(1));
+    ~TimerWheel();
+
+    TimerWheel(const TimerWheel&) = delete;
+    TimerWheel& operator=(const TimerWheel&) = delete;
+
+    /**
+     * Shared wheel with a 1 ms tick, started on first use.
+     */
+    static TimerWheel& Default();
+
+    /**
+     * Schedule a callback after delay, and then every period when period is non-zero.
+     * Delays are rounded up to whole ticks. The callback runs on the wheel's thread.
+     */
+    TimerId Schedule(std::chrono::nanoseconds delay, TimeoutCallback_t callback,
+                     std::chrono::nanoseconds period = std::chrono::nanoseconds(0));
+
+    /**
+     * Cancel a timer. When called from another thread than the wheel's, the callback of the timer is
+     * guaranteed not to be running when this function returns. Returns false for unknown/expired timers.
+     */
+    bool Cancel(TimerId timerId);
+
+    size_t ActiveTimers() const;
+    uint64_t Overruns() const;
+
+    /**
+     * Name, pin and/or prioritize the wheel's thread (default name: "timer-wheel"); every timer callback runs on it
+     */
+    void SetThreadConfig(const ThreadConfig& threadConfig);
+
+private:
+    static constexpr int LEVEL_COUNT = 4;
+    static constexpr int SLOT_BITS = 8;
+    static constexpr uint32_t SLOT_COUNT = 1u << SLOT_BITS;
+    static constexpr uint32_t SLOT_MASK = SLOT_COUNT - 1;
+    static constexpr int32_t NIL = -1;
+
+    enum class TimerState { EFree, EPending, EFiring };
+
+    struct TimerNode {
+        TimeoutCallback_t callback;
+        uint64_t expiryTick = 0;
+        uint64_t periodTicks = 0;
+        uint32_t generation = 1;
+        TimerState state = TimerState::EFree;
+        std::atomic<bool> cancelled{false}; // Read by the dispatch loop without the lock
+        int32_t prev = NIL;
+        int32_t next = NIL;
+        int32_t* listHead = nullptr;
+    };
+
+    void Run();
+    uint64_t TickNow() const;
+    uint64_t ToTicks(std::chrono::nanoseconds duration) const;
+    std::chrono::steady_clock::time_point TickTime(uint64_t tick) const;
+
+    int32_t AllocateNodeLocked();
+    void FreeNodeLocked(int32_t index);
+    void LinkLocked(int32_t index);
+    void PushLocked(int32_t index, int32_t& head);
+    void UnlinkLocked(int32_t index);
+    void AdvanceLocked(std::vector<int32_t>& expired);
+    void CascadeLocked(int level, uint32_t slot);
+    uint64_t NextWakeTickLocked() const;
+
+private:
+    const std::chrono::steady_clock::duration m_tickDuration;
+    const std::chrono::steady_clock::time_point m_startTime;
+
+    mutable std::mutex m_mutex;
+    std::condition_variable m_wakeCondition;
+    std::condition_variable m_dispatchDoneCondition;
+    bool m_running;
+    uint64_t m_currentTick;
+    uint64_t m_nextWakeTick;
+    size_t m_activeTimers;
+    uint64_t m_overruns;
+
+    std::deque<TimerNode> m_nodes; // deque: nodes keep their address while new ones are added
+    std::vector<int32_t> m_freeNodes;
+    std::array<std::array<int32_t, SLOT_COUNT>, LEVEL_COUNT> m_slots;
+
+    std::thread m_thread;
+
+    // Declared last: removed before the state they read
+    std::vector<Metric> m_metrics;
+};
+
+} // namespace hek
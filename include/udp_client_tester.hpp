@@ -7,38 +7,87 @@
 
 #include "udp_socket.hpp"
 #include "async_handler.hpp"
+#include "latency_histogram.hpp"
+#include "sequence_tracker.hpp"
 #include "timer.hpp"
 
+#include <chrono>
+
 
 namespace hek {
 
-enum class CallbackType {
+enum class CallbackType : uint8_t {
     EUndefined = 0,
     EUdpDataAvailable = 1,
-    ETimeoutCallback = 2
+    ETimeoutCallback = 2,
+    EReportCallback = 3
 };
 
+/**
+ * One event for the handler thread. Move-only: a datagram's payload stays in its pool buffer and only the
+ * reference on it is handed on, and events without a datagram (eg timer ticks) carry an empty view, so
+ * queueing an event never touches the heap or a reference count.
+ */
 struct CallbackAction {
+    CallbackAction() = default;
+    CallbackAction(CallbackAction&&) noexcept = default;
+    CallbackAction& operator=(CallbackAction&&) noexcept = default;
+    CallbackAction(const CallbackAction&) = delete;
+    CallbackAction& operator=(const CallbackAction&) = delete;
+
+    PacketView packet;
     CallbackType type = CallbackType::EUndefined;
-    std::string data;
-    sockaddr_in senderAddr;
+};
+
+struct UdpClientTesterOptions {
+    // When > 0, busy-poll the socket (see UdpSocketOptions::busyPollBudget) and handle the Pongs inline
+    // on the receiver thread, for the lowest round-trip time
+    std::chrono::microseconds busyPollBudget{0};
+
+    // Placement of the receiver and handler threads, see UdpServerTesterOptions. The Ping timers run on
+    // the default TimerWheel, see TimerWheel::SetThreadConfig().
+    ThreadConfig receiverThread;
+    ThreadConfig handlerThread;
+    bool handlerOnCacheSibling = false;
+
+    // See UdpSocketOptions::ioEngine
+    IoEngine ioEngine = IoEngine::EEpoll;
+
+    // See UdpSocketOptions::socketBuffers
+    SocketBufferSizes socketBuffers;
 };
 
 class UdpClientTester : public hek::IUdpObserver, public hek::AsyncHandler< struct CallbackAction > {
 public:
-    UdpClientTester(uint16_t port, const std::string& ipAddress);
+    UdpClientTester(uint16_t port, const std::string& ipAddress,
+                    const UdpClientTesterOptions& options = UdpClientTesterOptions());
     ~UdpClientTester();
 
-    void NewUdpDataCallback(const std::string& data, const sockaddr_in& senderAddr) override;
+    void NewUdpPacketCallback(PacketView&& packet) override;
     void HandleTriggerAction( struct CallbackAction &action ) override;
+    void HandleTriggerActionsDone() override;
 
 private:
-    void HandleUdpData(const std::string& data, const sockaddr_in& senderAddr);
+    void HandleUdpData(const PacketView& packet);
+    void SendPing();
     void TimerCallback();
+    void ReportTimerCallback();
+    void ReportStatistics();
 
 private:
     UdpSocket m_Socket;
     Timer m_timer;
+    Timer m_reportTimer;
+
+    // Handle thread only
+    uint64_t m_pingSequence;
+
+    // Round-trip times in ns: recorded per Pong, reported and drained into the totals per interval
+    LatencyHistogram m_intervalLatency;
+    LatencyHistogram m_totalLatency;
+
+    // Round-trip loss/reorder/duplicate accounting of the Pongs, handle thread only
+    SequenceTracker m_pongSequences;
 };
 
 } // namespace hek
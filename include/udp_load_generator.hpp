@@ -0,0 +1,157 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+#pragma once
+
+#include "udp_socket.hpp"
+#include "event_loop.hpp"
+#include "latency_histogram.hpp"
+#include "sequence_tracker.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+
+namespace hek {
+
+enum class PayloadSizeMode {
+    EFixed = 0,    // Every datagram carries minPayloadSize bytes
+    EUniform = 1,  // Uniformly distributed between minPayloadSize and maxPayloadSize
+    EImix = 2      // Simple IMIX: 7 x 64, 4 x 576 and 1 x 1472 bytes, capped to maxPayloadSize
+};
+
+struct UdpLoadGeneratorOptions {
+    // Target rate. When packetsPerSecond is 0 it is derived from bitsPerSecond (UDP payload bits).
+    double packetsPerSecond = 0;
+    double bitsPerSecond = 0;
+
+    PayloadSizeMode sizeMode = PayloadSizeMode::EFixed;
+    size_t minPayloadSize = 64;
+    size_t maxPayloadSize = 64;
+
+    // Number of concurrent flows: every flow has its own socket, and so its own source port
+    size_t flowCount = 1;
+
+    std::chrono::milliseconds duration{10000};
+
+    // Datagrams per sendmmsg() call
+    size_t batchSize = 32;
+
+    // When > 1, send this many datagrams per flow with one UDP_SEGMENT (GSO) send call instead of sendmmsg().
+    // Needs PayloadSizeMode::EFixed; capped to UdpSocket::MAX_GSO_SEGMENTS and a 64 KB send.
+    size_t gsoSegments = 0;
+
+    // Progress and round-trip time report interval, 0 to only report at the end
+    std::chrono::milliseconds reportInterval{1000};
+
+    // Placement of the thread reading the replies (default name: "udp-load-rx"). Sending happens on the
+    // thread calling Run().
+    ThreadConfig receiverThread;
+
+    // I/O engine of the flows' sockets, see UdpSocketOptions::ioEngine
+    IoEngine ioEngine = IoEngine::EEpoll;
+
+    // Kernel buffer sizes of the flows' sockets, see UdpSocketOptions::socketBuffers
+    SocketBufferSizes socketBuffers;
+};
+
+struct UdpLoadGeneratorReport {
+    double elapsedSeconds = 0;
+    double targetPacketsPerSecond = 0;
+    double targetBitsPerSecond = 0;
+    double achievedPacketsPerSecond = 0;
+    double achievedBitsPerSecond = 0;
+    uint64_t packetsSent = 0;
+    uint64_t bytesSent = 0;
+    uint64_t sendDrops = 0;
+
+    // Datagrams due by the end of the run but never sent, as the generator could not keep up, and the number
+    // of bursts cut short by an exhausted packet pool or a failed send (their rest was retried)
+    uint64_t unsentDatagrams = 0;
+    uint64_t incompleteBursts = 0;
+
+    uint64_t packetsReceived = 0;
+    uint64_t bytesReceived = 0;
+
+    // Round-trip sequence accounting of the replies, summed over all flows
+    SequenceStats replySequences;
+};
+
+/**
+ * Sends datagrams to a server at a paced target rate, spread round-robin over a number of flows, and
+ * counts the replies. Sending happens on the thread calling Run(); replies are read on one event loop
+ * thread shared by all flows. Payloads of at least WIRE_HEADER_SIZE bytes are Pings of the wire protocol
+ * (see wire_protocol.hpp) carrying their flow and a per-flow sequence number, so the round-trip time, loss,
+ * reordering and duplication of every echoed datagram is recorded.
+ */
+class UdpLoadGenerator : public IUdpObserver {
+public:
+    UdpLoadGenerator(uint16_t port, const std::string& ipAddress, const UdpLoadGeneratorOptions& options);
+    ~UdpLoadGenerator();
+
+    UdpLoadGenerator(const UdpLoadGenerator&) = delete;
+    UdpLoadGenerator& operator=(const UdpLoadGenerator&) = delete;
+
+    bool IsInitialized() const;
+
+    /**
+     * Generate load for the configured duration, or until keepRunning turns false.
+     */
+    UdpLoadGeneratorReport Run(const volatile bool& keepRunning);
+
+    void NewUdpPacketBatchCallback(std::vector<PacketView>& batch) override;
+
+    void LogReport(const UdpLoadGeneratorReport& report) const;
+
+    /**
+     * Round-trip times in ns of the replies received up to the last interval report (after Run(): of the whole run)
+     */
+    const LatencyHistogram& GetLatency() const;
+
+private:
+    void ReportInterval(double intervalSeconds);
+    void BuildPayloadSizes();
+    double AveragePayloadSize() const;
+    size_t SendBurst(size_t count);
+    size_t SendSegmentedBurst(size_t count);
+    void EncodePing(uint8_t* datagram, size_t size, size_t flowIndex, uint64_t sequence, uint64_t sendTimeNs);
+
+private:
+    UdpLoadGeneratorOptions m_options;
+    double m_packetsPerSecond;
+
+    EventLoop m_eventLoop;
+    std::vector<std::unique_ptr<UdpSocket>> m_flows;
+    bool m_initialized;
+
+    // Pre-drawn payload sizes, cycled through while sending
+    std::vector<uint16_t> m_payloadSizes;
+    size_t m_nextPayloadSize;
+    size_t m_nextFlow;
+    std::vector<uint8_t> m_payloadPattern;
+
+    // Payload of one GSO send, reused for every send call (sending thread only)
+    std::vector<uint8_t> m_gsoBuffer;
+
+    uint64_t m_packetsSent;
+    uint64_t m_bytesSent;
+    std::vector<uint64_t> m_flowSequences;  // Next sequence number per flow, advanced only once it was sent
+    uint64_t m_intervalPacketsSent;
+    uint64_t m_incompleteBursts;
+    std::atomic<uint64_t> m_packetsReceived;
+    std::atomic<uint64_t> m_bytesReceived;
+    std::atomic<uint64_t> m_intervalPacketsReceived;
+
+    // Recorded on the event loop thread, reported and drained into the totals by Run()
+    LatencyHistogram m_intervalLatency;
+    LatencyHistogram m_totalLatency;
+    FlowSequenceTrackers m_replySequences;
+};
+
+} // namespace hek
@@ -7,35 +7,139 @@
 
 #include "udp_socket.hpp"
 #include "async_handler.hpp"
+#include "async_handler_pool.hpp"
+#include "latency_histogram.hpp"
+#include "sequence_tracker.hpp"
 #include "timer.hpp"
 
+#include <memory>
+
 
 namespace hek {
 
-enum class CallbackType {
+enum class CallbackType : uint8_t {
     EUndefined = 0,
     EUdpDataAvailable = 1
 };
 
+/**
+ * One event for the handler thread. Move-only: a datagram's payload stays in its pool buffer and only the
+ * reference on it is handed on, and events without a datagram (eg timer ticks) carry an empty view, so
+ * queueing an event never touches the heap or a reference count.
+ */
 struct CallbackAction {
+    CallbackAction() = default;
+    CallbackAction(CallbackAction&&) noexcept = default;
+    CallbackAction& operator=(CallbackAction&&) noexcept = default;
+    CallbackAction(const CallbackAction&) = delete;
+    CallbackAction& operator=(const CallbackAction&) = delete;
+
+    PacketView packet;
     CallbackType type = CallbackType::EUndefined;
-    std::string data;
-    sockaddr_in senderAddr;
 };
 
-class UdpServerTester : public hek::IUdpObserver, public hek::AsyncHandler< struct CallbackAction > {
+/**
+ * Where the time of a Ping goes on the server, in ns, from the kernel's software receive timestamp to the
+ * Pong being queued. Recorded for packets carrying receive timestamps, see UdpSocketOptions::rxTimestamps.
+ */
+struct LatencyStages {
+    LatencyHistogram socketQueue;   // Kernel receive timestamp -> read from the socket by the receiver thread
+    LatencyHistogram handlerQueue;  // Read from the socket -> picked up by a handler thread
+    LatencyHistogram processing;    // Picked up by a handler thread -> Pong queued for sending
+};
+
+struct UdpServerTesterOptions {
+    UdpSocketOptions socketOptions;
+
+    // Number of handler threads. With 1 the actions are handled on the AsyncHandler's handle thread;
+    // with more they go to a work-stealing pool, kept in order per sender.
+    size_t handlerWorkers = 1;
+
+    // Bound for the handler queue, or for the queues of all workers together (0: the queue's own limit, the
+    // workers' are unbounded), and what to do with Pings beyond it. EDropOldest needs handlerWorkers > 1: the
+    // single handler's queue is an SpscRing, which only the handler thread may pop from.
+    size_t handlerQueueCapacity = 0;
+    OverflowPolicy overflowPolicy = OverflowPolicy::EBlockProducer;
+
+    // EInline runs to completion on the socket's receiver thread: every receive batch is answered and its
+    // Pongs sent before the next receive call, without a handoff to a handler thread. Use it eg together with
+    // socketOptions.busyPollBudget for the lowest latency. handlerWorkers and the queue options are ignored then.
+    DispatchMode dispatchMode = DispatchMode::EHandleThread;
+
+    // Placement of the handler thread(s); the receiver thread is placed by socketOptions.receiverThread.
+    // handlerOnCacheSibling pins the handler(s) to a CPU sharing a cache with the receiver's (first) CPU.
+    ThreadConfig handlerThread;
+    bool handlerOnCacheSibling = false;
+
+    // Loss/reorder/duplicate accounting of the Pings' sequence numbers, per sender. Share one instance
+    // between all shards of a port, as a sender's datagrams may be steered to several shards.
+    std::shared_ptr<FlowSequenceTrackers> sequenceTrackers;
+
+    // Latency per stage of the Pings, shareable between shards like sequenceTrackers. Needs the
+    // socketOptions.rxTimestamps; with socketOptions.txTimestamps the sockets add the send stage, see
+    // GetTxLatency().
+    std::shared_ptr<LatencyStages> latencyStages;
+};
+
+class UdpServerTester;
+
+/**
+ * Handler pool of a UdpServerTester running with more than one handler worker; forwards every action
+ * to the server.
+ */
+class UdpServerWorkerPool : public hek::AsyncHandlerPool< struct CallbackAction > {
+public:
+    UdpServerWorkerPool(UdpServerTester& server, size_t workerCount);
+    ~UdpServerWorkerPool();
+
+    void Trigger(struct CallbackAction&& action, uint64_t orderingKey);
+
+    void HandleTriggerAction( struct CallbackAction &action ) override;
+    void HandleTriggerActionsDone() override;
+
+private:
+    UdpServerTester& m_server;
+};
+
+// Actions are only triggered from the socket's receiver thread, so the lock-free SPSC ring can be used
+class UdpServerTester : public hek::IUdpObserver,
+                        public hek::AsyncHandler< struct CallbackAction, SpscRing< struct CallbackAction > > {
 public:
     UdpServerTester(uint16_t port, const std::string& ipAddress = "");
+
+    /**
+     * Construct a server with explicit options, e.g. one shard of a SO_REUSEPORT group.
+     * Every instance has its own socket, receiver thread and handler thread(s).
+     */
+    UdpServerTester(uint16_t port, const UdpServerTesterOptions& options, const std::string& ipAddress = "");
+
+    static UdpServerTesterOptions DefaultOptions();
     ~UdpServerTester();
 
-    void NewUdpDataCallback(const std::string& data, const sockaddr_in& senderAddr) override;
+    void NewUdpPacketCallback(PacketView&& packet) override;
+    void NewUdpPacketBatchCallback(std::vector<PacketView>& batch) override;
     void HandleTriggerAction( struct CallbackAction &action ) override;
+    void HandleTriggerActionsDone() override;
+
+    /**
+     * Number of datagrams handled so far, eg to report the throughput
+     */
+    uint64_t GetHandledCount() const;
+
+    /**
+     * Delay from sending a Pong to its kernel transmit timestamp, see UdpSocket::GetTxLatency()
+     */
+    const LatencyHistogram& GetTxLatency() const;
 
 private:
-    void HandleUdpData(const std::string& data, const sockaddr_in& senderAddr);
+    void HandleUdpData(PacketView& packet);
 
 private:
     UdpSocket m_Socket;
+    std::unique_ptr<UdpServerWorkerPool> m_workerPool;
+    std::shared_ptr<FlowSequenceTrackers> m_sequenceTrackers;
+    std::shared_ptr<LatencyStages> m_latencyStages;
+    std::atomic<uint64_t> m_handledCount;
 };
 
 } // namespace hek
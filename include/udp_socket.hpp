@@ -6,56 +6,394 @@
 
 #pragma once
 
-#include <thread>
+#include "event_loop.hpp"
+#include "packet_view.hpp"
+#include "latency_histogram.hpp"
+#include "metrics.hpp"
+#include "rcu_snapshot.hpp"
+
+#include <memory>
 #include <mutex>
 #include <atomic>
+#include <chrono>
 #include <vector>
 #include <string>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <netinet/in.h>
 #include <unistd.h>
 #include <cerrno>
 #include <cstring>
 
+struct io_uring_cqe;
+
 
 namespace hek {
 
 class IUdpObserver {
 public:
     virtual ~IUdpObserver() = default;
-    virtual void NewUdpDataCallback(const std::string& data, const sockaddr_in& senderAddr) = 0;
+
+    /**
+     * Copying delivery: the datagram is copied into a std::string. Only called when the observer does
+     * not override one of the zero-copy callbacks below.
+     */
+    virtual void NewUdpDataCallback(const std::string& data, const sockaddr_in& senderAddr) {
+        (void)data;
+        (void)senderAddr;
+    }
+
+    /**
+     * Zero-copy delivery of a single datagram. The packet still lives in the socket's receive buffer;
+     * the observer may keep it (e.g. by moving it into a queue) for as long as it likes, the buffer is
+     * handed back to the socket when the PacketView is released. All packets must be released before
+     * the UdpSocket is destroyed.
+     * The default implementation copies the payload and calls NewUdpDataCallback().
+     */
+    virtual void NewUdpPacketCallback(PacketView&& packet) {
+        NewUdpDataCallback(std::string(packet.AsStringView()), packet.SenderAddr());
+    }
+
+    /**
+     * Zero-copy delivery of all datagrams pulled from the kernel in one receive call. Packets the
+     * observer does not move out of the batch are released when the callback returns.
+     * The default implementation calls NewUdpPacketCallback() per packet.
+     */
+    virtual void NewUdpPacketBatchCallback(std::vector<PacketView>& batch) {
+        for (PacketView& packet : batch) {
+            NewUdpPacketCallback(std::move(packet));
+        }
+    }
+};
+
+enum class IoEngine {
+    EEpoll = 0,   // Readiness via the event loop, recvmmsg()/sendmmsg() calls
+    EIoUring = 1  // Completions via io_uring: multishot recvmsg into a provided buffer ring, batched sendmsg submissions
+};
+
+/**
+ * Kernel socket buffer sizes, in bytes. 0 keeps the system default (net.core.rmem_default/wmem_default).
+ * SO_RCVBUFFORCE/SO_SNDBUFFORCE are tried first, which go beyond net.core.rmem_max/wmem_max but need
+ * CAP_NET_ADMIN; without it the sizes are capped at those limits (with a warning).
+ */
+struct SocketBufferSizes {
+    int receiveBytes = 0;
+    int sendBytes = 0;
+
+    // Adaptive receive buffer: when > 0, the receive buffer doubles, up to this size, whenever the kernel
+    // reports drops (SO_RXQ_OVFL) or the receive queue was found more than half full
+    int maxReceiveBytes = 0;
+};
+
+struct UdpSocketOptions {
+    // Maximum size of a single received datagram. Larger datagrams are dropped and counted, see
+    // UdpSocket::GetTruncatedDatagrams(). The default fits a full datagram of a 1500 byte MTU link.
+    size_t bufferSize = 2048;
+
+    // Maximum number of datagrams pulled from the kernel per recvmmsg() call, and maximum number of
+    // queued datagrams sent per sendmmsg() call. 1 keeps the classic one syscall per datagram behaviour.
+    size_t batchSize = 1;
+
+    // Pool the receive buffers (and queued send payloads) come from. Several sockets may share a
+    // pool, as long as its buffer size is at least bufferSize. Leave empty to let the socket create a
+    // private pool configured by the three fields below.
+    std::shared_ptr<PacketPool> packetPool;
+
+    // Buffers per slab of the private pool. A received packet holds on to its buffer until the observer
+    // releases it; when maxReceiveBufferCount buffers are in use, datagrams are dropped.
+    size_t receiveBufferCount = 256;
+    size_t maxReceiveBufferCount = 4096;
+    bool useHugePages = false;
+
+    // Set SO_REUSEPORT before binding, so several sockets (shards) can share one SERVER port
+    bool reusePort = false;
+
+    // When > 0 (and reusePort is set), attach a classic BPF program to the reuseport group that
+    // steers each datagram to shard (receiving CPU % reusePortSteeringGroupSize) instead of the
+    // kernel's default 4-tuple hash
+    uint32_t reusePortSteeringGroupSize = 0;
+
+    // Enable kernel software timestamps (SO_TIMESTAMPING, or SO_TIMESTAMPNS when that is unavailable).
+    // rxTimestamps stamps every received packet with its kernel receive time, see PacketView::KernelRxTimeNs().
+    // txTimestamps reads the kernel's transmit time of every sent datagram from the socket's error queue
+    // and records the delay since the send call, see UdpSocket::GetTxLatency().
+    bool rxTimestamps = false;
+    bool txTimestamps = false;
+
+    // Low-latency receive: when > 0, the receiver thread keeps spinning on the non-blocking socket until it
+    // stayed empty for this long, and only then goes back to waiting in the event loop. SO_BUSY_POLL and
+    // SO_PREFER_BUSY_POLL are set as well, so every empty receive call polls the device queue. Burns a core;
+    // other sockets sharing the event loop thread wait while this one spins.
+    std::chrono::microseconds busyPollBudget{0};
+
+    // Placement of the receiver thread started by StartReading() (default name: "udp-rx"). Sockets reading
+    // on a shared event loop run on that loop's threads instead, see EventLoop::SetThreadConfig().
+    ThreadConfig receiverThread;
+
+    // UDP_GRO: let the kernel hand over runs of datagrams of one sender as a single coalesced buffer,
+    // which is split back into datagrams (PacketView slices sharing the buffer) before observers see them.
+    // Raises bufferSize to MAX_GRO_BUFFER_SIZE, as a coalesced buffer may be up to 64 KB.
+    bool gro = false;
+
+    // I/O engine. EIoUring falls back to EEpoll (with a warning) when the kernel lacks io_uring, has it
+    // disabled, or predates multishot recvmsg (6.0). With io_uring, receive and send completions share one
+    // ring per socket: datagrams land directly in pool buffers handed to the kernel up front, and QueueData()
+    // always queues, also with a batchSize of 1, until FlushData() or the end of a receive batch submits the
+    // queue with one system call. busyPollBudget does not apply.
+    IoEngine ioEngine = IoEngine::EEpoll;
+
+    // SO_RCVBUF/SO_SNDBUF, and the adaptive receive buffer
+    SocketBufferSizes socketBuffers;
 };
 
-class UdpSocket {
+class IoUring;
+
+class UdpSocket : public IEventHandler {
 public:
-    explicit UdpSocket(size_t bufferSize = 1024);
+    /**
+     * @param bufferSize Maximum size of a single received datagram
+     * @param batchSize  See UdpSocketOptions::batchSize
+     */
+    explicit UdpSocket(size_t bufferSize = 2048, size_t batchSize = 1);
+    explicit UdpSocket(const UdpSocketOptions& options);
     ~UdpSocket();
 
     int Init(uint16_t port, const std::string& ipAddress = ""); // Leave ipAddress empty for Server Socket
     bool IsInitialized() const;
 
+    /**
+     * Start reading on a private event loop thread owned by this socket.
+     */
     void StartReading();
+
+    /**
+     * Start reading on a shared event loop, so many sockets can be served by one (or a few) threads.
+     * The loop must outlive the reading, i.e. call StopReading() before destroying the loop.
+     */
+    void StartReading(EventLoop& eventLoop);
+
+    /**
+     * Stop reading. Returns immediately; when it returns no observer callback is in flight anymore.
+     */
     void StopReading();
 
+    /**
+     * When UnregisterObserver() returns, no callback of the observer is in flight anymore and none will follow.
+     * Do not call either of them from within an observer callback.
+     */
     void RegisterObserver(IUdpObserver* observer);
     void UnregisterObserver(IUdpObserver* observer);
 
     int WriteData(const std::string& data, const sockaddr_in& destination);
     int WriteData(const std::string& data);
+    int WriteData(const PacketView& packet, const sockaddr_in& destination);
+
+    /**
+     * Queue a datagram for a batched send. The send queue is flushed with a single sendmmsg() call
+     * once it holds batchSize datagrams, at the end of every receive batch, or when FlushData() is
+     * called explicitly. With a batch size of 1 the datagram is sent immediately.
+     * Returns 0 on success (or the number of bytes sent when sent immediately), -1 on failure.
+     */
+    int QueueData(const std::string& data, const sockaddr_in& destination);
+    int QueueData(const std::string& data);
+
+    /**
+     * Queue a pooled packet (e.g. a received one, to echo it) without copying its payload.
+     */
+    int QueueData(const PacketView& packet, const sockaddr_in& destination);
+    int QueueData(const PacketView& packet);
+
+    /**
+     * Send size bytes as datagrams of segmentSize bytes each (the last one may be shorter) with a single
+     * UDP_SEGMENT (GSO) send call; the kernel, or the NIC, does the splitting. Up to MAX_GSO_SEGMENTS
+     * segments and MAX_GSO_SIZE bytes per call. Falls back to one sendmmsg() of all segments when the
+     * kernel or device does not support GSO. Not ordered with datagrams still queued by QueueData().
+     * Returns the number of datagrams sent, or -1 on failure. Datagrams not sent because the send buffer
+     * was full are counted in GetSendDrops().
+     */
+    int WriteSegmented(const uint8_t* data, size_t size, size_t segmentSize, const sockaddr_in& destination);
+    int WriteSegmented(const uint8_t* data, size_t size, size_t segmentSize);
+
+    static constexpr size_t MAX_GSO_SEGMENTS = 64;
+    static constexpr size_t MAX_GSO_SIZE = 65507;
+    static constexpr size_t MAX_GRO_BUFFER_SIZE = 65536;
+
+    /**
+     * Send all queued datagrams. Returns the number of datagrams sent, or -1 on failure. Datagrams that
+     * do not fit in the (non-blocking) socket's send buffer are dropped and counted, see GetSendDrops().
+     */
+    int FlushData();
+
+    uint64_t GetSendDrops() const;
+
+    /**
+     * Datagrams the kernel dropped because the socket's receive buffer was full, as last reported with a
+     * received datagram (SO_RXQ_OVFL). Drops after the last datagram read only show up with the next one.
+     */
+    uint64_t GetKernelDrops() const;
+
+    /**
+     * Datagrams dropped because they did not fit in the receive buffer (bufferSize)
+     */
+    uint64_t GetTruncatedDatagrams() const;
+
+    // Current size of the kernel receive buffer (SO_RCVBUF, ie including the kernel's bookkeeping overhead)
+    int GetReceiveBufferSize() const;
+
+    /**
+     * Labels of the metrics of this socket (see MetricsRegistry), eg fd="5",role="server",address="0.0.0.0:8080".
+     * Set by Init().
+     */
+    const std::string& GetMetricLabels() const;
+
+    /**
+     * Delay in ns from the send call to the kernel's software transmit timestamp of the datagrams sent
+     * so far (txTimestamps only). Datagrams sent concurrently from several threads without queueing may
+     * be attributed to each other's send call.
+     */
+    const LatencyHistogram& GetTxLatency() const;
+
+    /**
+     * The pool receive buffers come from. Use it to build outgoing payloads in place.
+     */
+    PacketPool& GetPacketPool();
+    PacketPoolStats GetPacketPoolStats() const;
+
+    // The engine in use, which is EEpoll when io_uring was requested but is not available
+    IoEngine GetIoEngine() const;
 
 private:
-    void ReceiverThreadFunc();
-    void NotifyObservers(const std::string& data, const sockaddr_in& senderAddr);
+    void HandleEvents(uint32_t events) override;
+    void BusyPoll();
+    void EnableBusyPoll();
+    bool ReceiveSingle();
+    bool ReceiveBatch();
+    bool DropDatagram();
+    void CountSendDrops(size_t count);
+    void NotifyObservers(std::vector<PacketView>& packets);
+    int FlushDataLocked();
+    int AttachReusePortSteering();
+    void EnableTimestamps();
+    static void ParseReceiveControl(msghdr& hdr, uint64_t& kernelRxTimeNs, size_t& groSegmentSize, uint32_t& kernelDrops);
+    void EnableGro();
+    void EnableKernelDropCount();
+    void ConfigureSocketBuffers();
+    int SetSocketBufferSize(int option, int forceOption, int bytes);
+    void AdaptReceiveBuffer();
+    void CountTruncatedDatagram(size_t datagramSize);
+    void RegisterMetrics();
+    void AddReceivedPacket(PacketView&& packet, msghdr& hdr, uint64_t readTimeNs);
+    int WriteSegments(const uint8_t* data, size_t size, size_t segmentSize, const sockaddr_in& destination);
+    void StampTxSendTimes(size_t count);
+    void ReadErrorQueue();
 
-    std::thread m_receiverThread;
+    // io_uring engine; the *Locked functions expect m_ringMutex to be held
+    void InitIoUring();
+    void ShutdownIoUring();
+    void HandleRingEvents();
+    void ReapRingCompletionsLocked(bool deliver);
+    void HandleRingReceive(const io_uring_cqe& cqe, bool deliver, uint64_t readTimeNs);
+    void RefillBufferRingLocked();
+    void ArmRingReceiveLocked();
+    void CancelRingRequestsLocked();
+    // Expects m_sendMutex to be held (not m_ringMutex, which it takes itself)
+    int FlushRingSendQueue();
+
+    std::unique_ptr<EventLoop> m_ownEventLoop;
+    EventLoop* m_eventLoop;
     std::atomic<bool> m_running;
-    std::mutex m_observerMutex;
-    std::vector<IUdpObserver*> m_observers;
+    // Read without a lock for every receive batch, copied on (un)registration
+    RcuSnapshot<std::vector<IUdpObserver*>> m_observers;
 
+    UdpSocketOptions m_options;
     int m_socketFd;
     sockaddr_in m_socketAddress;
-    std::vector<uint8_t> m_receiveBuffer;
     size_t m_bufferSize;
+
+    std::shared_ptr<PacketPool> m_packetPool;
+    std::vector<uint8_t> m_dropBuffer;
+    std::atomic<uint64_t> m_receiveDrops;
+    std::atomic<uint64_t> m_sendDrops;
+    std::atomic<uint64_t> m_kernelDrops;
+    std::atomic<uint64_t> m_truncatedDatagrams;
+
+    // Adaptive receive buffer, only touched by the receiving thread: the size of the receive buffer (without the
+    // kernel's overhead), and the kernel drop count and received datagram count at the last check
+    int m_receiveBufferBytes;
+    uint64_t m_adaptKernelDrops;
+    uint64_t m_adaptReceivedPackets;
+
+    // recvmmsg() state
+    size_t m_batchSize;
+    uint64_t m_receivedPackets;
+    std::vector<mmsghdr> m_batchHeaders;
+    std::vector<iovec> m_batchIovecs;
+    std::vector<sockaddr_in> m_batchAddrs;
+    std::vector<PacketBuffer*> m_batchBuffers;
+    std::vector<PacketView> m_packets;
+    std::vector<PacketView> m_clonedPackets;
+
+    // Control message buffers of the receive timestamps, GRO segment size and kernel drop count, one per batch entry
+    struct alignas(cmsghdr) ControlBuffer {
+        char data[CMSG_SPACE(sizeof(timespec) * 3) + CMSG_SPACE(sizeof(timespec)) + CMSG_SPACE(sizeof(int)) +
+                  CMSG_SPACE(sizeof(uint32_t))];
+    };
+    bool m_rxTimestamps;
+    bool m_gro;
+    std::atomic<bool> m_gsoSupported;
+    std::vector<ControlBuffer> m_batchControl;
+
+    // Transmit timestamps: the send time of timestamp id N lives in slot N % TX_TIMESTAMP_SLOTS, until the
+    // kernel's transmit timestamp with that id is read from the error queue. The kernel numbers the sent
+    // datagrams from 0 (SOF_TIMESTAMPING_OPT_ID); m_txNextId is the id of the next datagram to send.
+    static constexpr size_t TX_TIMESTAMP_SLOTS = 4096;
+    bool m_txTimestamps;
+    std::atomic<uint32_t> m_txNextId;
+    std::unique_ptr<std::atomic<uint64_t>[]> m_txSendTimes;
+    LatencyHistogram m_txLatency;
+
+    // io_uring state, protected by m_ringMutex. m_ringBuffers[id] is the pool buffer handed to the kernel as
+    // provided buffer id (nullptr while the pool could not refill it); a send in flight keeps its payload
+    // in m_ringSends until its completion.
+    struct RingSend {
+        PacketView packet;
+        sockaddr_in destination;
+        iovec iov;
+        msghdr hdr;
+    };
+    std::unique_ptr<IoUring> m_ioUring;
+    std::mutex m_ringMutex;
+    bool m_ringReading;
+    bool m_ringReceiveActive;
+    bool m_ringPollActive;
+    msghdr m_ringReceiveHeader;
+    size_t m_ringBufferSize;
+    std::vector<PacketBuffer*> m_ringBuffers;
+    std::vector<uint16_t> m_ringEmptyBuffers;
+    std::vector<RingSend> m_ringSends;
+    std::vector<uint32_t> m_ringFreeSends;
+
+    // sendmmsg() state, protected by m_sendMutex. m_sendBatchSize is the batch size of the send queue.
+    std::mutex m_sendMutex;
+    size_t m_sendBatchSize;
+    size_t m_sendQueued;
+    std::vector<PacketView> m_sendPackets;
+    std::vector<sockaddr_in> m_sendAddrs;
+    std::vector<mmsghdr> m_sendHeaders;
+    std::vector<iovec> m_sendIovecs;
+
+    // Metrics, registered by Init(). Declared last, so they are removed before the state their callbacks read.
+    struct SocketMetrics {
+        Counter receivedDatagrams;
+        Counter receivedBytes;
+        Counter receiveErrors;
+        Counter sentDatagrams;
+        Counter sentBytes;
+        Counter sendErrors;
+        std::vector<Metric> callbacks;
+    };
+    std::string m_metricLabels;
+    SocketMetrics m_metrics;
 };
 
 } // namespace hek
@@ -0,0 +1,164 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+
+
+namespace hek {
+
+/**
+ * Binary test traffic: every datagram starts with a fixed 32 byte header, all fields big endian, followed
+ * by payloadLength bytes of filler:
+ *
+ *   offset  size  field
+ *        0     2  magic (WIRE_MAGIC)
+ *        2     1  version (WIRE_VERSION)
+ *        3     1  type (WireMessageType)
+ *        4     4  flow id
+ *        8     8  sequence number, per flow
+ *       16     8  send time in ns, CLOCK_MONOTONIC of the sender, so only meaningful to the host that sent it
+ *       24     4  payload length
+ *       28     4  reserved, zero
+ *
+ * The server answers a Ping by turning it into a Pong in place, so the reply carries the original flow id,
+ * sequence number and send time back to the client. The codec works on the receive buffer as is: no
+ * allocation, no alignment requirements, and all of it is constexpr.
+ */
+enum class WireMessageType : uint8_t {
+    EPing = 1,
+    EPong = 2
+};
+
+struct WireHeader {
+    WireMessageType type = WireMessageType::EPing;
+    uint32_t flowId = 0;
+    uint64_t sequence = 0;
+    uint64_t sendTimeNs = 0;
+    uint32_t payloadLength = 0;
+};
+
+static constexpr uint16_t WIRE_MAGIC = 0x484b;  // "HK"
+static constexpr uint8_t WIRE_VERSION = 1;
+static constexpr size_t WIRE_HEADER_SIZE = 32;
+
+static constexpr size_t WIRE_MAGIC_OFFSET = 0;
+static constexpr size_t WIRE_VERSION_OFFSET = 2;
+static constexpr size_t WIRE_TYPE_OFFSET = 3;
+static constexpr size_t WIRE_FLOW_ID_OFFSET = 4;
+static constexpr size_t WIRE_SEQUENCE_OFFSET = 8;
+static constexpr size_t WIRE_SEND_TIME_OFFSET = 16;
+static constexpr size_t WIRE_PAYLOAD_LENGTH_OFFSET = 24;
+static constexpr size_t WIRE_RESERVED_OFFSET = 28;
+
+/**
+ * Big endian load and store of an unsigned integer at any address. Compilers turn the loops into a single
+ * (byte swapping) move.
+ */
+template <typename T>
+constexpr T LoadBigEndian(const uint8_t* in) {
+    static_assert(std::is_unsigned<T>::value, "LoadBigEndian needs an unsigned integer type");
+    T value = 0;
+    for (size_t i = 0; i < sizeof(T); ++i) {
+        value = static_cast<T>((value << 8) | in[i]);
+    }
+    return value;
+}
+
+template <typename T>
+constexpr void StoreBigEndian(uint8_t* out, T value) {
+    static_assert(std::is_unsigned<T>::value, "StoreBigEndian needs an unsigned integer type");
+    for (size_t i = sizeof(T); i > 0; --i) {
+        out[i - 1] = static_cast<uint8_t>(value);
+        value = static_cast<T>(value >> 8);
+    }
+}
+
+/**
+ * Write header into the first WIRE_HEADER_SIZE bytes of out, which the caller guarantees to have.
+ */
+constexpr void EncodeWireHeader(uint8_t* out, const WireHeader& header) {
+    StoreBigEndian<uint16_t>(out + WIRE_MAGIC_OFFSET, WIRE_MAGIC);
+    out[WIRE_VERSION_OFFSET] = WIRE_VERSION;
+    out[WIRE_TYPE_OFFSET] = static_cast<uint8_t>(header.type);
+    StoreBigEndian<uint32_t>(out + WIRE_FLOW_ID_OFFSET, header.flowId);
+    StoreBigEndian<uint64_t>(out + WIRE_SEQUENCE_OFFSET, header.sequence);
+    StoreBigEndian<uint64_t>(out + WIRE_SEND_TIME_OFFSET, header.sendTimeNs);
+    StoreBigEndian<uint32_t>(out + WIRE_PAYLOAD_LENGTH_OFFSET, header.payloadLength);
+    StoreBigEndian<uint32_t>(out + WIRE_RESERVED_OFFSET, 0);
+}
+
+/**
+ * Encode a whole message of WIRE_HEADER_SIZE + header.payloadLength bytes; the payload is left as it is.
+ * Returns its size, or 0 when it does not fit in capacity bytes.
+ */
+constexpr size_t EncodeWireMessage(uint8_t* out, size_t capacity, const WireHeader& header) {
+    size_t size = WIRE_HEADER_SIZE + header.payloadLength;
+    if (size > capacity) {
+        return 0;
+    }
+    EncodeWireHeader(out, header);
+    return size;
+}
+
+/**
+ * Decode the header of a datagram of size bytes. False when it is no message of this protocol version, or
+ * when it is shorter than its header says.
+ */
+constexpr bool DecodeWireHeader(const uint8_t* data, size_t size, WireHeader& header) {
+    if (size < WIRE_HEADER_SIZE) {
+        return false;
+    }
+
+    uint16_t magic = LoadBigEndian<uint16_t>(data + WIRE_MAGIC_OFFSET);
+    uint32_t payloadLength = LoadBigEndian<uint32_t>(data + WIRE_PAYLOAD_LENGTH_OFFSET);
+    // One branch for all checks
+    bool valid = (magic == WIRE_MAGIC) & (data[WIRE_VERSION_OFFSET] == WIRE_VERSION) &
+                 (payloadLength <= size - WIRE_HEADER_SIZE);
+    if (!valid) {
+        return false;
+    }
+
+    header.type = static_cast<WireMessageType>(data[WIRE_TYPE_OFFSET]);
+    header.flowId = LoadBigEndian<uint32_t>(data + WIRE_FLOW_ID_OFFSET);
+    header.sequence = LoadBigEndian<uint64_t>(data + WIRE_SEQUENCE_OFFSET);
+    header.sendTimeNs = LoadBigEndian<uint64_t>(data + WIRE_SEND_TIME_OFFSET);
+    header.payloadLength = payloadLength;
+    return true;
+}
+
+/**
+ * Change the type of an encoded message in place, eg to turn a received Ping into its Pong
+ */
+constexpr void SetWireMessageType(uint8_t* data, WireMessageType type) {
+    data[WIRE_TYPE_OFFSET] = static_cast<uint8_t>(type);
+}
+
+// Compile time check of the codec
+constexpr bool WireHeaderRoundTrips() {
+    uint8_t buffer[WIRE_HEADER_SIZE + 8] = {};
+    WireHeader in;
+    in.type = WireMessageType::EPong;
+    in.flowId = 0x01020304;
+    in.sequence = 0x1122334455667788;
+    in.sendTimeNs = 0x8877665544332211;
+    in.payloadLength = 8;
+    if (EncodeWireMessage(buffer, sizeof(buffer), in) != sizeof(buffer) || buffer[0] != 0x48 || buffer[4] != 0x01) {
+        return false;
+    }
+
+    WireHeader out;
+    return DecodeWireHeader(buffer, sizeof(buffer), out) && out.type == in.type && out.flowId == in.flowId &&
+           out.sequence == in.sequence && out.sendTimeNs == in.sendTimeNs && out.payloadLength == in.payloadLength &&
+           !DecodeWireHeader(buffer, sizeof(buffer) - 1, out);
+}
+
+static_assert(WireHeaderRoundTrips(), "Wire header codec must round-trip in network byte order");
+
+} // namespace hek
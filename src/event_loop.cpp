@@ -0,0 +1,243 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "event_loop.hpp"
+#include "sl_log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+
+namespace hek {
+
+static constexpr int MAX_EVENTS_PER_WAIT = 64;
+static constexpr char DEFAULT_THREAD_NAME[] = "event-loop";
+
+// Set on the threads of every EventLoop, see Remove()
+static thread_local bool t_eventLoopWorker = false;
+
+EventLoop::EventLoop(size_t threadCount, const ThreadConfig& threadConfig)
+    : m_running(true) {
+    if (threadCount == 0) {
+        threadCount = 1;
+    }
+
+    for (size_t i = 0; i < threadCount; ++i) {
+        auto worker = std::make_unique<Worker>();
+
+        worker->epollFd = epoll_create1(EPOLL_CLOEXEC);
+        worker->wakeFd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        if (worker->epollFd == -1 || worker->wakeFd == -1) {
+            SLLog::LogError("EventLoop::EventLoop - Failed to create epoll/eventfd: " + std::string(strerror(errno)));
+        } else {
+            epoll_event event = {};
+            event.events = EPOLLIN;
+            event.data.ptr = nullptr; // nullptr marks the wakeup eventfd
+            if (epoll_ctl(worker->epollFd, EPOLL_CTL_ADD, worker->wakeFd, &event) == -1) {
+                SLLog::LogError("EventLoop::EventLoop - Failed to register eventfd: " + std::string(strerror(errno)));
+            }
+        }
+
+        m_workers.push_back(std::move(worker));
+    }
+
+    for (auto& worker : m_workers) {
+        worker->thread = std::thread(&EventLoop::RunWorker, this, std::ref(*worker));
+    }
+    SetThreadConfig(threadConfig);
+
+    SLLog::LogInfo("EventLoop::EventLoop - Started with " + std::to_string(threadCount) + " thread(s)");
+}
+
+EventLoop::~EventLoop() {
+    m_running.store(false);
+
+    for (auto& worker : m_workers) {
+        WakeWorker(*worker);
+    }
+
+    for (auto& worker : m_workers) {
+        if (worker->thread.joinable()) {
+            worker->thread.join();
+        }
+    }
+
+    for (auto& worker : m_workers) {
+        for (Registration* registration : worker->retired) {
+            delete registration;
+        }
+        if (worker->wakeFd != -1) {
+            close(worker->wakeFd);
+        }
+        if (worker->epollFd != -1) {
+            close(worker->epollFd);
+        }
+    }
+
+    for (auto& entry : m_registrations) {
+        delete entry.second;
+    }
+
+    SLLog::LogInfo("EventLoop::~EventLoop - EventLoop terminated gracefully");
+}
+
+int EventLoop::Add(int fd, IEventHandler* handler, uint32_t events) {
+    if (fd == -1 || handler == nullptr) {
+        return -1;
+    }
+
+    std::lock_guard<std::mutex> lock(m_registrationMutex);
+
+    if (m_registrations.count(fd) != 0) {
+        SLLog::LogError("EventLoop::Add - File descriptor " + std::to_string(fd) + " is already registered");
+        return -1;
+    }
+
+    size_t workerIndex = 0;
+    for (size_t i = 1; i < m_workers.size(); ++i) {
+        if (m_workers[i]->registrationCount < m_workers[workerIndex]->registrationCount) {
+            workerIndex = i;
+        }
+    }
+
+    auto* registration = new Registration();
+    registration->fd = fd;
+    registration->handler = handler;
+    registration->workerIndex = workerIndex;
+
+    epoll_event event = {};
+    event.events = events;
+    event.data.ptr = registration;
+    if (epoll_ctl(m_workers[workerIndex]->epollFd, EPOLL_CTL_ADD, fd, &event) == -1) {
+        SLLog::LogError("EventLoop::Add - epoll_ctl() failed: " + std::string(strerror(errno)));
+        delete registration;
+        return -1;
+    }
+
+    m_registrations[fd] = registration;
+    ++m_workers[workerIndex]->registrationCount;
+
+    return 0;
+}
+
+void EventLoop::Remove(int fd) {
+    Registration* registration = nullptr;
+
+    {
+        std::lock_guard<std::mutex> lock(m_registrationMutex);
+        auto it = m_registrations.find(fd);
+        if (it == m_registrations.end()) {
+            return;
+        }
+        registration = it->second;
+        m_registrations.erase(it);
+        --m_workers[registration->workerIndex]->registrationCount;
+    }
+
+    Worker& worker = *m_workers[registration->workerIndex];
+
+    if (epoll_ctl(worker.epollFd, EPOLL_CTL_DEL, fd, nullptr) == -1) {
+        SLLog::LogWarn("EventLoop::Remove - epoll_ctl() failed: " + std::string(strerror(errno)));
+    }
+
+    // An event batch may still reference this registration: the current one when called from a handler, or
+    // one epoll_wait() returned before the EPOLL_CTL_DEL above that is not dispatched yet. So only disable it
+    // here, and let the worker free it once that batch has been dispatched.
+    if (t_eventLoopWorker) {
+        // Called from a handler: never wait for another worker's dispatch mutex while this thread holds
+        // its own, two handlers removing each other's descriptors would deadlock
+        registration->handler.store(nullptr, std::memory_order_release);
+        RetireRegistration(worker, registration);
+    } else {
+        // Waiting for the dispatch mutex guarantees the handler is not running anymore
+        std::lock_guard<std::mutex> lock(worker.dispatchMutex);
+        registration->handler.store(nullptr, std::memory_order_release);
+        RetireRegistration(worker, registration);
+    }
+    if (std::this_thread::get_id() != worker.thread.get_id()) {
+        WakeWorker(worker);
+    }
+}
+
+void EventLoop::RetireRegistration(Worker& worker, Registration* registration) {
+    std::lock_guard<std::mutex> lock(worker.retireMutex);
+    worker.retired.push_back(registration);
+}
+
+size_t EventLoop::ThreadCount() const {
+    return m_workers.size();
+}
+
+void EventLoop::SetThreadConfig(const ThreadConfig& threadConfig) {
+    m_threadConfig = threadConfig;
+    if (m_threadConfig.name.empty()) {
+        m_threadConfig.name = DEFAULT_THREAD_NAME;
+    }
+
+    for (size_t i = 0; i < m_workers.size(); ++i) {
+        ApplyThreadConfig(m_workers[i]->thread.native_handle(),
+                          (m_workers.size() > 1) ? m_threadConfig.ForIndex(i) : m_threadConfig);
+    }
+}
+
+void EventLoop::WakeWorker(Worker& worker) {
+    if (worker.wakeFd == -1) {
+        return;
+    }
+
+    uint64_t value = 1;
+    if (write(worker.wakeFd, &value, sizeof(value)) < 0 && errno != EAGAIN) {
+        SLLog::LogError("EventLoop::WakeWorker - write() failed: " + std::string(strerror(errno)));
+    }
+}
+
+void EventLoop::RunWorker(Worker& worker) {
+    SLLog::LogInfo("EventLoop::RunWorker - Event loop thread started");
+    t_eventLoopWorker = true;
+
+    epoll_event events[MAX_EVENTS_PER_WAIT];
+
+    while (m_running.load()) {
+        int count = epoll_wait(worker.epollFd, events, MAX_EVENTS_PER_WAIT, -1);
+        if (count < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            SLLog::LogError("EventLoop::RunWorker - epoll_wait() failed: " + std::string(strerror(errno)));
+            break;
+        }
+
+        // Registrations retired since the previous batch are freed at the end of this one, which is the last
+        // batch that can reference them
+        std::lock_guard<std::mutex> lock(worker.dispatchMutex);
+
+        for (int i = 0; i < count; ++i) {
+            auto* registration = static_cast<Registration*>(events[i].data.ptr);
+            if (registration == nullptr) {
+                uint64_t value = 0;
+                while (read(worker.wakeFd, &value, sizeof(value)) > 0) {
+                }
+                continue;
+            }
+
+            IEventHandler* handler = registration->handler.load(std::memory_order_acquire);
+            if (handler) {
+                handler->HandleEvents(events[i].events);
+            }
+        }
+
+        std::lock_guard<std::mutex> retireLock(worker.retireMutex);
+        for (Registration* registration : worker.retired) {
+            delete registration;
+        }
+        worker.retired.clear();
+    }
+
+    SLLog::LogInfo("EventLoop::RunWorker - Event loop thread terminated gracefully");
+}
+
+} // namespace hek
@@ -0,0 +1,220 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "io_uring.hpp"
+#include <algorithm>
+#include <cerrno>
+#include <cstring>
+#include <memory>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+
+namespace hek {
+
+static int IoUringSetup(unsigned entries, io_uring_params* params) {
+    return static_cast<int>(syscall(__NR_io_uring_setup, entries, params));
+}
+
+static int IoUringEnter(int fd, unsigned toSubmit, unsigned minComplete, unsigned flags) {
+    return static_cast<int>(syscall(__NR_io_uring_enter, fd, toSubmit, minComplete, flags, nullptr, 0));
+}
+
+static int IoUringRegister(int fd, unsigned opcode, void* arg, unsigned argCount) {
+    return static_cast<int>(syscall(__NR_io_uring_register, fd, opcode, arg, argCount));
+}
+
+template <typename T>
+static T* RingField(void* ring, uint32_t offset) {
+    return reinterpret_cast<T*>(static_cast<uint8_t*>(ring) + offset);
+}
+
+IoUring::~IoUring() {
+    if (m_bufferRing) {
+        io_uring_buf_reg registration = {};
+        registration.bgid = m_bufferGroup;
+        IoUringRegister(m_ringFd, IORING_UNREGISTER_PBUF_RING, &registration, 1);
+        munmap(m_bufferRing, m_bufferRingBytes);
+    }
+    if (m_sqes) {
+        munmap(m_sqes, m_sqesBytes);
+    }
+    if (m_cqRing && m_cqRing != m_sqRing) {
+        munmap(m_cqRing, m_cqRingBytes);
+    }
+    if (m_sqRing) {
+        munmap(m_sqRing, m_sqRingBytes);
+    }
+    if (m_ringFd != -1) {
+        close(m_ringFd);
+    }
+}
+
+int IoUring::Init(unsigned entries, unsigned completionEntries) {
+    if (m_ringFd != -1) {
+        return -EALREADY;
+    }
+
+    io_uring_params params = {};
+    params.flags = IORING_SETUP_CQSIZE | IORING_SETUP_CLAMP | IORING_SETUP_SUBMIT_ALL | IORING_SETUP_COOP_TASKRUN |
+                   IORING_SETUP_TASKRUN_FLAG;
+    params.cq_entries = completionEntries;
+
+    int fd = IoUringSetup(entries, &params);
+    if (fd < 0) {
+        return -errno;
+    }
+    m_ringFd = fd;
+
+    m_sqRingBytes = params.sq_off.array + params.sq_entries * sizeof(unsigned);
+    m_cqRingBytes = params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+    bool singleMmap = (params.features & IORING_FEAT_SINGLE_MMAP) != 0;
+    if (singleMmap) {
+        m_sqRingBytes = m_cqRingBytes = std::max(m_sqRingBytes, m_cqRingBytes);
+    }
+
+    m_sqRing = mmap(nullptr, m_sqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQ_RING);
+    if (m_sqRing == MAP_FAILED) {
+        m_sqRing = nullptr;
+        return -errno;
+    }
+    m_cqRing = m_sqRing;
+    if (!singleMmap) {
+        m_cqRing = mmap(nullptr, m_cqRingBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_CQ_RING);
+        if (m_cqRing == MAP_FAILED) {
+            m_cqRing = nullptr;
+            return -errno;
+        }
+    }
+
+    m_sqesBytes = params.sq_entries * sizeof(io_uring_sqe);
+    void* sqes = mmap(nullptr, m_sqesBytes, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, fd, IORING_OFF_SQES);
+    if (sqes == MAP_FAILED) {
+        return -errno;
+    }
+    m_sqes = static_cast<io_uring_sqe*>(sqes);
+
+    m_sqHead = RingField<unsigned>(m_sqRing, params.sq_off.head);
+    m_sqTail = RingField<unsigned>(m_sqRing, params.sq_off.tail);
+    m_sqFlags = RingField<unsigned>(m_sqRing, params.sq_off.flags);
+    m_sqMask = *RingField<unsigned>(m_sqRing, params.sq_off.ring_mask);
+    m_sqEntries = params.sq_entries;
+    m_sqLocalTail = *m_sqTail;
+
+    // Submission queue entry i always sits in slot i
+    unsigned* sqArray = RingField<unsigned>(m_sqRing, params.sq_off.array);
+    for (unsigned i = 0; i < m_sqEntries; ++i) {
+        sqArray[i] = i;
+    }
+
+    m_cqHead = RingField<unsigned>(m_cqRing, params.cq_off.head);
+    m_cqTail = RingField<unsigned>(m_cqRing, params.cq_off.tail);
+    m_cqMask = *RingField<unsigned>(m_cqRing, params.cq_off.ring_mask);
+    m_cqes = RingField<io_uring_cqe>(m_cqRing, params.cq_off.cqes);
+
+    // Which opcodes this kernel knows
+    static constexpr size_t PROBE_OPS = 256;
+    size_t probeBytes = sizeof(io_uring_probe) + PROBE_OPS * sizeof(io_uring_probe_op);
+    std::unique_ptr<uint8_t[]> probeMemory(new uint8_t[probeBytes]());
+    auto* probe = reinterpret_cast<io_uring_probe*>(probeMemory.get());
+    if (IoUringRegister(fd, IORING_REGISTER_PROBE, probe, PROBE_OPS) == 0) {
+        for (unsigned i = 0; i < probe->ops_len && i < PROBE_OPS; ++i) {
+            m_supportedOps[probe->ops[i].op] = (probe->ops[i].flags & IO_URING_OP_SUPPORTED) != 0;
+        }
+    }
+
+    return 0;
+}
+
+io_uring_sqe* IoUring::GetSqe() {
+    unsigned head = __atomic_load_n(m_sqHead, __ATOMIC_ACQUIRE);
+    if (m_sqLocalTail - head >= m_sqEntries) {
+        return nullptr;
+    }
+
+    io_uring_sqe* sqe = &m_sqes[m_sqLocalTail & m_sqMask];
+    std::memset(sqe, 0, sizeof(*sqe));
+    ++m_sqLocalTail;
+    ++m_sqPending;
+    return sqe;
+}
+
+int IoUring::Submit(unsigned waitCompletions) {
+    __atomic_store_n(m_sqTail, m_sqLocalTail, __ATOMIC_RELEASE);
+
+    unsigned flags = 0;
+    if (waitCompletions > 0 || CompletionsOverflowed() || CompletionsPending()) {
+        flags |= IORING_ENTER_GETEVENTS;
+    }
+    if (m_sqPending == 0 && flags == 0) {
+        return 0;
+    }
+
+    for (;;) {
+        int submitted = IoUringEnter(m_ringFd, m_sqPending, waitCompletions, flags);
+        if (submitted < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            return -errno;
+        }
+        m_sqPending -= std::min(m_sqPending, static_cast<unsigned>(submitted));
+        return submitted;
+    }
+}
+
+int IoUring::RegisterBufferRing(uint16_t groupId, unsigned entries) {
+    if (m_bufferRing || entries == 0 || (entries & (entries - 1)) != 0 || entries > 32768) {
+        return -EINVAL;
+    }
+
+    m_bufferRingBytes = entries * sizeof(io_uring_buf);
+    void* ring = mmap(nullptr, m_bufferRingBytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (ring == MAP_FAILED) {
+        return -errno;
+    }
+
+    io_uring_buf_reg registration = {};
+    registration.ring_addr = reinterpret_cast<uint64_t>(ring);
+    registration.ring_entries = entries;
+    registration.bgid = groupId;
+    if (IoUringRegister(m_ringFd, IORING_REGISTER_PBUF_RING, &registration, 1) != 0) {
+        int error = errno;
+        munmap(ring, m_bufferRingBytes);
+        return -error;
+    }
+
+    m_bufferRing = static_cast<io_uring_buf_ring*>(ring);
+    m_bufferRingMask = entries - 1;
+    m_bufferRingTail = 0;
+    m_bufferRingStaged = 0;
+    m_bufferGroup = groupId;
+    return 0;
+}
+
+void IoUring::AddBuffer(void* address, unsigned length, uint16_t bufferId) {
+    // Not m_bufferRing->bufs: in C++ the uapi flexible array member may sit behind a (non-empty) empty struct
+    io_uring_buf* buffers = reinterpret_cast<io_uring_buf*>(m_bufferRing);
+    io_uring_buf& buffer = buffers[(m_bufferRingTail + m_bufferRingStaged) & m_bufferRingMask];
+    buffer.addr = reinterpret_cast<uint64_t>(address);
+    buffer.len = length;
+    buffer.bid = bufferId;
+    ++m_bufferRingStaged;
+}
+
+void IoUring::CommitBuffers() {
+    if (m_bufferRingStaged == 0) {
+        return;
+    }
+
+    // The tail shares its slot with the reserved field of the first buffer
+    m_bufferRingTail = static_cast<uint16_t>(m_bufferRingTail + m_bufferRingStaged);
+    m_bufferRingStaged = 0;
+    __atomic_store_n(&m_bufferRing->tail, m_bufferRingTail, __ATOMIC_RELEASE);
+}
+
+} // namespace hek
@@ -0,0 +1,130 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "latency_histogram.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <limits>
+
+namespace hek {
+
+LatencyHistogram::LatencyHistogram()
+    : m_totalCount(0), m_sum(0), m_min(std::numeric_limits<uint64_t>::max()), m_max(0) {
+    for (auto& count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+}
+
+uint64_t LatencyHistogram::HighestEquivalentValue(size_t index) {
+    if (index < 2 * SUB_BUCKET_COUNT) {
+        return index;
+    }
+    int shift = static_cast<int>(index / SUB_BUCKET_COUNT) - 1;
+    uint64_t subBucket = index % SUB_BUCKET_COUNT + SUB_BUCKET_COUNT;
+
+    // Wraps to the maximum value for the very last bucket
+    return ((subBucket + 1) << shift) - 1;
+}
+
+uint64_t LatencyHistogram::Min() const {
+    return (Count() == 0) ? 0 : m_min.load(std::memory_order_relaxed);
+}
+
+double LatencyHistogram::Mean() const {
+    uint64_t count = Count();
+    return (count == 0) ? 0.0 : static_cast<double>(m_sum.load(std::memory_order_relaxed)) / static_cast<double>(count);
+}
+
+uint64_t LatencyHistogram::ValueAtPercentile(double percentile) const {
+    // Sum the buckets rather than trusting m_totalCount, which may run ahead while recording goes on
+    uint64_t total = 0;
+    for (const auto& count : m_counts) {
+        total += count.load(std::memory_order_relaxed);
+    }
+    if (total == 0) {
+        return 0;
+    }
+
+    uint64_t rank = static_cast<uint64_t>(std::ceil(percentile / 100.0 * static_cast<double>(total)));
+    rank = std::max<uint64_t>(std::min(rank, total), 1);
+
+    uint64_t seen = 0;
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        seen += m_counts[i].load(std::memory_order_relaxed);
+        if (seen >= rank) {
+            // Never report more than the exact maximum
+            return std::min(HighestEquivalentValue(i), Max());
+        }
+    }
+    return Max();
+}
+
+void LatencyHistogram::DrainInto(LatencyHistogram& total) {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        uint64_t count = m_counts[i].exchange(0, std::memory_order_relaxed);
+        if (count > 0) {
+            total.m_counts[i].fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t totalCount = m_totalCount.exchange(0, std::memory_order_relaxed);
+    uint64_t sum = m_sum.exchange(0, std::memory_order_relaxed);
+    uint64_t min = m_min.exchange(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+    uint64_t max = m_max.exchange(0, std::memory_order_relaxed);
+    total.AddCounts(totalCount, sum, min, max);
+}
+
+void LatencyHistogram::Add(const LatencyHistogram& other) {
+    for (size_t i = 0; i < BUCKET_COUNT; ++i) {
+        uint64_t count = other.m_counts[i].load(std::memory_order_relaxed);
+        if (count > 0) {
+            m_counts[i].fetch_add(count, std::memory_order_relaxed);
+        }
+    }
+
+    AddCounts(other.m_totalCount.load(std::memory_order_relaxed), other.m_sum.load(std::memory_order_relaxed),
+              other.m_min.load(std::memory_order_relaxed), other.m_max.load(std::memory_order_relaxed));
+}
+
+void LatencyHistogram::AddCounts(uint64_t totalCount, uint64_t sum, uint64_t min, uint64_t max) {
+    m_totalCount.fetch_add(totalCount, std::memory_order_relaxed);
+    m_sum.fetch_add(sum, std::memory_order_relaxed);
+
+    uint64_t currentMin = m_min.load(std::memory_order_relaxed);
+    while (min < currentMin && !m_min.compare_exchange_weak(currentMin, min, std::memory_order_relaxed)) {
+    }
+    uint64_t currentMax = m_max.load(std::memory_order_relaxed);
+    while (max > currentMax && !m_max.compare_exchange_weak(currentMax, max, std::memory_order_relaxed)) {
+    }
+}
+
+void LatencyHistogram::Reset() {
+    for (auto& count : m_counts) {
+        count.store(0, std::memory_order_relaxed);
+    }
+    m_totalCount.store(0, std::memory_order_relaxed);
+    m_sum.store(0, std::memory_order_relaxed);
+    m_min.store(std::numeric_limits<uint64_t>::max(), std::memory_order_relaxed);
+    m_max.store(0, std::memory_order_relaxed);
+}
+
+std::string LatencyHistogram::Summary(double divider, const char* unit) const {
+    char summary[256];
+    std::snprintf(summary, sizeof(summary),
+                  "count %llu, min %.1f%s, p50 %.1f%s, p90 %.1f%s, p99 %.1f%s, p99.9 %.1f%s, max %.1f%s",
+                  static_cast<unsigned long long>(Count()),
+                  static_cast<double>(Min()) / divider, unit,
+                  static_cast<double>(ValueAtPercentile(50.0)) / divider, unit,
+                  static_cast<double>(ValueAtPercentile(90.0)) / divider, unit,
+                  static_cast<double>(ValueAtPercentile(99.0)) / divider, unit,
+                  static_cast<double>(ValueAtPercentile(99.9)) / divider, unit,
+                  static_cast<double>(Max()) / divider, unit);
+    return summary;
+}
+
+} // namespace hek
@@ -0,0 +1,226 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "metrics.hpp"
+#include "sl_log.hpp"
+#include <algorithm>
+#include <utility>
+
+
+namespace hek {
+
+/**
+ * Hands the counter slots of a thread back to the registry when the thread exits. Counting from later
+ * thread_local destructors goes to a block that is never reported.
+ */
+struct ThreadCountersHolder {
+    MetricsRegistry::ThreadCounters* counters = nullptr;
+
+    ~ThreadCountersHolder() {
+        MetricsRegistry& registry = MetricsRegistry::Default();
+        if (counters) {
+            registry.RetireThread(counters);
+        }
+        MetricsRegistry::t_counters = registry.m_exitedThreadCounters->values;
+    }
+};
+
+thread_local ThreadCountersHolder t_threadCountersHolder;
+
+Metric::Metric(Metric&& other) noexcept :
+    m_id(std::exchange(other.m_id, 0)),
+    m_slot(std::exchange(other.m_slot, 0))
+{
+}
+
+Metric& Metric::operator=(Metric&& other) noexcept {
+    if (&other != this) {
+        Reset();
+        m_id = std::exchange(other.m_id, 0);
+        m_slot = std::exchange(other.m_slot, 0);
+    }
+    return *this;
+}
+
+void Metric::Reset() {
+    if (m_id != 0) {
+        MetricsRegistry::Default().Remove(m_id);
+        m_id = 0;
+        m_slot = 0;
+    }
+}
+
+MetricsRegistry::MetricsRegistry() :
+    m_nextId(1),
+    m_retiredCounts(MAX_COUNTERS, 0),
+    m_exitedThreadCounters(new ThreadCounters())
+{
+    // Slot 0 is the discard slot; hand out the low slots first
+    m_freeSlots.reserve(MAX_COUNTERS - 1);
+    for (uint32_t slot = MAX_COUNTERS - 1; slot > 0; --slot) {
+        m_freeSlots.push_back(slot);
+    }
+}
+
+MetricsRegistry& MetricsRegistry::Default()
+{
+    // Never destroyed: sockets, handlers and threads may still count while static objects are destructed
+    static MetricsRegistry* registry = new MetricsRegistry();
+    return *registry;
+}
+
+Counter MetricsRegistry::AddCounter(const std::string& name, const std::string& help, const std::string& labels)
+{
+    Entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = MetricType::ECounter;
+    entry.labels = labels;
+
+    Counter counter;
+    {
+        std::lock_guard<std::mutex> lock(m_entryMutex);
+        if (m_freeSlots.empty()) {
+            SLLog::LogWarn("MetricsRegistry::AddCounter - Out of counter slots, " + name + " is not counted");
+            return counter;
+        }
+        entry.slot = m_freeSlots.back();
+        m_freeSlots.pop_back();
+        counter.m_slot = entry.slot;
+        counter.m_id = m_nextId++;
+        m_entries.emplace(counter.m_id, std::move(entry));
+    }
+    return counter;
+}
+
+Metric MetricsRegistry::AddCallback(const std::string& name, const std::string& help, MetricType type,
+                                    const std::string& labels, std::function<uint64_t()> read)
+{
+    Entry entry;
+    entry.name = name;
+    entry.help = help;
+    entry.type = type;
+    entry.labels = labels;
+    entry.read = std::move(read);
+
+    Metric metric;
+    {
+        std::lock_guard<std::mutex> lock(m_entryMutex);
+        metric.m_id = m_nextId++;
+        m_entries.emplace(metric.m_id, std::move(entry));
+    }
+    return metric;
+}
+
+void MetricsRegistry::Remove(uint64_t id)
+{
+    std::lock_guard<std::mutex> lock(m_entryMutex);
+    auto it = m_entries.find(id);
+    if (it == m_entries.end()) {
+        return;
+    }
+
+    uint32_t slot = it->second.slot;
+    m_entries.erase(it);
+    if (slot == 0) {
+        return;
+    }
+
+    // The owner of the counter is gone, so nobody counts in its slot anymore: clear it for the next owner
+    {
+        std::lock_guard<std::mutex> threadLock(m_threadMutex);
+        for (const auto& counters : m_threadCounters) {
+            counters->values[slot].store(0, std::memory_order_relaxed);
+        }
+        m_retiredCounts[slot] = 0;
+    }
+    m_freeSlots.push_back(slot);
+}
+
+std::atomic<uint64_t>* MetricsRegistry::RegisterThread()
+{
+    MetricsRegistry& registry = Default();
+    std::unique_ptr<ThreadCounters> counters(new ThreadCounters());
+
+    t_threadCountersHolder.counters = counters.get();
+    t_counters = counters->values;
+
+    std::lock_guard<std::mutex> lock(registry.m_threadMutex);
+    registry.m_threadCounters.push_back(std::move(counters));
+    return t_counters;
+}
+
+void MetricsRegistry::RetireThread(ThreadCounters* counters)
+{
+    std::lock_guard<std::mutex> lock(m_threadMutex);
+    for (size_t slot = 1; slot < MAX_COUNTERS; ++slot) {
+        m_retiredCounts[slot] += counters->values[slot].load(std::memory_order_relaxed);
+    }
+    m_threadCounters.erase(std::remove_if(m_threadCounters.begin(), m_threadCounters.end(),
+                                          [counters](const std::unique_ptr<ThreadCounters>& threadCounters) {
+                                              return threadCounters.get() == counters;
+                                          }),
+                           m_threadCounters.end());
+}
+
+uint64_t MetricsRegistry::SumLocked(uint32_t slot) const
+{
+    uint64_t sum = m_retiredCounts[slot];
+    for (const auto& counters : m_threadCounters) {
+        sum += counters->values[slot].load(std::memory_order_relaxed);
+    }
+    return sum;
+}
+
+std::string MetricsRegistry::FormatPrometheus()
+{
+    struct Sample {
+        const Entry* entry;
+        uint64_t value;
+    };
+
+    std::lock_guard<std::mutex> lock(m_entryMutex);
+
+    std::vector<Sample> samples;
+    samples.reserve(m_entries.size());
+    for (const auto& item : m_entries) {
+        const Entry& entry = item.second;
+        samples.push_back({ &entry, entry.read ? entry.read() : 0 });
+    }
+    {
+        std::lock_guard<std::mutex> threadLock(m_threadMutex);
+        for (Sample& sample : samples) {
+            if (!sample.entry->read) {
+                sample.value = SumLocked(sample.entry->slot);
+            }
+        }
+    }
+
+    // One family per name, its series in order of registration
+    std::stable_sort(samples.begin(), samples.end(), [](const Sample& a, const Sample& b) {
+        return a.entry->name < b.entry->name;
+    });
+
+    std::string out;
+    out.reserve(samples.size() * 96);
+    const std::string* family = nullptr;
+    for (const Sample& sample : samples) {
+        const Entry& entry = *sample.entry;
+        if (!family || *family != entry.name) {
+            family = &entry.name;
+            out += "# HELP " + entry.name + " " + entry.help + "\n";
+            out += "# TYPE " + entry.name + (entry.type == MetricType::ECounter ? " counter\n" : " gauge\n");
+        }
+        out += entry.name;
+        if (!entry.labels.empty()) {
+            out += "{" + entry.labels + "}";
+        }
+        out += " " + std::to_string(sample.value) + "\n";
+    }
+    return out;
+}
+
+} // namespace hek
@@ -0,0 +1,141 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "metrics_endpoint.hpp"
+#include "sl_log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+
+namespace hek {
+
+static ThreadConfig MakeThreadConfig() {
+    ThreadConfig config;
+    config.name = "metrics";
+    return config;
+}
+
+MetricsEndpoint::MetricsEndpoint(MetricsRegistry& registry)
+    : m_registry(registry), m_listenFd(-1), m_eventLoop(1, MakeThreadConfig()) {
+}
+
+MetricsEndpoint::~MetricsEndpoint() {
+    if (m_listenFd != -1) {
+        m_eventLoop.Remove(m_listenFd);
+        close(m_listenFd);
+        unlink(m_path.c_str());
+    }
+}
+
+int MetricsEndpoint::Init(const std::string& path) {
+    sockaddr_un address = {};
+    address.sun_family = AF_UNIX;
+    if (m_listenFd != -1 || path.empty() || path.size() >= sizeof(address.sun_path)) {
+        SLLog::LogError("MetricsEndpoint::Init - Invalid socket path: " + path);
+        return -1;
+    }
+    std::memcpy(address.sun_path, path.c_str(), path.size());
+
+    // Only ever remove a socket, never eg a regular file given by mistake
+    struct stat status;
+    if (lstat(path.c_str(), &status) == 0 && S_ISSOCK(status.st_mode)) {
+        unlink(path.c_str());
+    }
+
+    int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+    if (fd == -1) {
+        SLLog::LogError("MetricsEndpoint::Init - Failed to create socket: " + std::string(strerror(errno)));
+        return -1;
+    }
+    if (bind(fd, reinterpret_cast<sockaddr*>(&address), sizeof(address)) == -1 || listen(fd, 16) == -1) {
+        SLLog::LogError("MetricsEndpoint::Init - Failed to listen on " + path + ": " + std::string(strerror(errno)));
+        close(fd);
+        return -1;
+    }
+
+    m_path = path;
+    m_listenFd = fd;
+    if (m_eventLoop.Add(m_listenFd, this) != 0) {
+        SLLog::LogError("MetricsEndpoint::Init - Failed to register socket with the event loop");
+        close(m_listenFd);
+        unlink(m_path.c_str());
+        m_listenFd = -1;
+        return -1;
+    }
+
+    SLLog::LogInfo("MetricsEndpoint::Init - Serving metrics on " + path);
+    return 0;
+}
+
+void MetricsEndpoint::HandleEvents(uint32_t /*events*/) {
+    for (;;) {
+        int clientFd = accept4(m_listenFd, nullptr, nullptr, SOCK_CLOEXEC);
+        if (clientFd == -1) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno != EAGAIN && errno != EWOULDBLOCK) {
+                SLLog::LogWarn("MetricsEndpoint::HandleEvents - accept() failed: " + std::string(strerror(errno)));
+            }
+            return;
+        }
+
+        Serve(clientFd);
+        close(clientFd);
+    }
+}
+
+void MetricsEndpoint::Serve(int clientFd) {
+    // Read the request up to the end of its headers; which path it asks for does not matter
+    char request[1024];
+    size_t requestSize = 0;
+    while (requestSize < sizeof(request)) {
+        pollfd clientPoll = { clientFd, POLLIN, 0 };
+        if (poll(&clientPoll, 1, REQUEST_TIMEOUT_MS) <= 0) {
+            break;
+        }
+        ssize_t bytesRead = recv(clientFd, request + requestSize, sizeof(request) - requestSize, 0);
+        if (bytesRead <= 0) {
+            break;
+        }
+        requestSize += static_cast<size_t>(bytesRead);
+        if (memmem(request, requestSize, "\r\n\r\n", 4) != nullptr || memmem(request, requestSize, "\n\n", 2) != nullptr) {
+            break;
+        }
+    }
+
+    std::string body = m_registry.FormatPrometheus();
+    std::string response;
+    if (requestSize >= 4 && std::memcmp(request, "GET ", 4) == 0) {
+        response = "HTTP/1.0 200 OK\r\n"
+                   "Content-Type: text/plain; version=0.0.4\r\n"
+                   "Content-Length: " + std::to_string(body.size()) + "\r\n"
+                   "Connection: close\r\n\r\n";
+    }
+    response += body;
+
+    timeval sendTimeout = { SEND_TIMEOUT_MS / 1000, (SEND_TIMEOUT_MS % 1000) * 1000 };
+    setsockopt(clientFd, SOL_SOCKET, SO_SNDTIMEO, &sendTimeout, sizeof(sendTimeout));
+
+    size_t sent = 0;
+    while (sent < response.size()) {
+        ssize_t bytesSent = send(clientFd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if (bytesSent < 0 && errno == EINTR) {
+            continue;
+        }
+        if (bytesSent <= 0) {
+            break;
+        }
+        sent += static_cast<size_t>(bytesSent);
+    }
+}
+
+} // namespace hek
@@ -0,0 +1,246 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "packet_pool.hpp"
+#include "sl_log.hpp"
+#include <cerrno>
+#include <cstring>
+#include <thread>
+#include <sys/mman.h>
+
+
+namespace hek {
+
+static constexpr size_t BUFFER_ALIGNMENT = 64;
+static constexpr size_t HUGE_PAGE_SIZE = 2 * 1024 * 1024;
+
+PacketPool::PacketPool(const PacketPoolOptions& options)
+    : m_options(options), m_centralHead(nullptr), m_centralCount(0), m_totalBuffers(0), m_buffersInUse(0),
+      m_highWaterMark(0), m_exhaustions(0), m_slabAllocations(0) {
+    // Keep every buffer cache line aligned
+    m_options.bufferSize = (m_options.bufferSize + BUFFER_ALIGNMENT - 1) & ~(BUFFER_ALIGNMENT - 1);
+    if (m_options.buffersPerSlab == 0) {
+        m_options.buffersPerSlab = 1;
+    }
+    if (m_options.maxBuffers < m_options.buffersPerSlab) {
+        m_options.maxBuffers = m_options.buffersPerSlab;
+    }
+
+    std::lock_guard<std::mutex> lock(m_centralMutex);
+    AddSlabLocked();
+}
+
+PacketPool::~PacketPool() {
+    if (m_buffersInUse.load() != 0) {
+        SLLog::LogError("PacketPool::~PacketPool - ERROR! " + std::to_string(m_buffersInUse.load()) +
+                        " buffer(s) still in use");
+    }
+
+    for (Slab& slab : m_slabs) {
+        if (slab.mapped) {
+            munmap(slab.memory, slab.bytes);
+        }
+    }
+}
+
+size_t PacketPool::BufferSize() const {
+    return m_options.bufferSize;
+}
+
+PacketPoolStats PacketPool::GetStats() const {
+    PacketPoolStats stats;
+    stats.totalBuffers = m_totalBuffers.load(std::memory_order_relaxed);
+    stats.buffersInUse = m_buffersInUse.load(std::memory_order_relaxed);
+    stats.highWaterMark = m_highWaterMark.load(std::memory_order_relaxed);
+    stats.exhaustions = m_exhaustions.load(std::memory_order_relaxed);
+    stats.slabAllocations = m_slabAllocations.load(std::memory_order_relaxed);
+    return stats;
+}
+
+PacketBuffer* PacketPool::Allocate() {
+    PacketBuffer* buffer = nullptr;
+    return (Allocate(&buffer, 1) == 1) ? buffer : nullptr;
+}
+
+size_t PacketPool::Allocate(PacketBuffer** buffers, size_t count) {
+    CacheShard& shard = m_shards[ThreadShardIndex()];
+    size_t allocated = 0;
+
+    Lock(shard);
+    while (allocated < count && shard.head) {
+        buffers[allocated++] = shard.head;
+        shard.head = shard.head->next;
+        --shard.count;
+    }
+    Unlock(shard);
+
+    while (allocated < count) {
+        PacketBuffer* buffer = RefillAndAllocate(shard);
+        if (!buffer) {
+            m_exhaustions.fetch_add(1, std::memory_order_relaxed);
+            break;
+        }
+        buffers[allocated++] = buffer;
+    }
+
+    for (size_t i = 0; i < allocated; ++i) {
+        buffers[i]->next = nullptr;
+        buffers[i]->refCount.store(1, std::memory_order_relaxed);
+    }
+
+    OnAllocated(allocated);
+    return allocated;
+}
+
+void PacketPool::OnAllocated(size_t count) {
+    if (count == 0) {
+        return;
+    }
+
+    uint64_t inUse = m_buffersInUse.fetch_add(count, std::memory_order_relaxed) + count;
+    uint64_t highWaterMark = m_highWaterMark.load(std::memory_order_relaxed);
+    while (inUse > highWaterMark &&
+           !m_highWaterMark.compare_exchange_weak(highWaterMark, inUse, std::memory_order_relaxed)) {
+    }
+}
+
+void PacketPool::Free(PacketBuffer* buffer) {
+    m_buffersInUse.fetch_sub(1, std::memory_order_relaxed);
+
+    CacheShard& shard = m_shards[ThreadShardIndex()];
+    PacketBuffer* spillHead = nullptr;
+    PacketBuffer* spillTail = nullptr;
+
+    Lock(shard);
+    buffer->next = shard.head;
+    shard.head = buffer;
+    ++shard.count;
+
+    // Keep the per-thread cache small: hand a batch back to the central list when it grows too large
+    if (shard.count > 2 * CACHE_TRANSFER_COUNT) {
+        spillHead = shard.head;
+        spillTail = shard.head;
+        for (size_t i = 1; i < CACHE_TRANSFER_COUNT; ++i) {
+            spillTail = spillTail->next;
+        }
+        shard.head = spillTail->next;
+        shard.count -= CACHE_TRANSFER_COUNT;
+    }
+    Unlock(shard);
+
+    if (spillHead) {
+        std::lock_guard<std::mutex> lock(m_centralMutex);
+        spillTail->next = m_centralHead;
+        m_centralHead = spillHead;
+        m_centralCount += CACHE_TRANSFER_COUNT;
+    }
+}
+
+PacketBuffer* PacketPool::RefillAndAllocate(CacheShard& shard) {
+    PacketBuffer* head = nullptr;
+    PacketBuffer* tail = nullptr;
+    size_t taken = 0;
+
+    {
+        std::lock_guard<std::mutex> lock(m_centralMutex);
+        if (!m_centralHead && !AddSlabLocked()) {
+            return nullptr;
+        }
+
+        head = m_centralHead;
+        tail = head;
+        taken = 1;
+        while (taken < CACHE_TRANSFER_COUNT && tail->next) {
+            tail = tail->next;
+            ++taken;
+        }
+        m_centralHead = tail->next;
+        m_centralCount -= taken;
+        tail->next = nullptr;
+    }
+
+    // Keep the first buffer, move the rest into the thread's cache
+    PacketBuffer* buffer = head;
+    if (taken > 1) {
+        Lock(shard);
+        tail->next = shard.head;
+        shard.head = head->next;
+        shard.count += taken - 1;
+        Unlock(shard);
+    }
+
+    return buffer;
+}
+
+bool PacketPool::AddSlabLocked() {
+    size_t total = m_totalBuffers.load(std::memory_order_relaxed);
+    if (total >= m_options.maxBuffers) {
+        return false;
+    }
+
+    size_t count = std::min(m_options.buffersPerSlab, m_options.maxBuffers - total);
+    size_t bytes = count * m_options.bufferSize;
+
+    Slab slab;
+    if (m_options.useHugePages) {
+        size_t hugeBytes = (bytes + HUGE_PAGE_SIZE - 1) & ~(HUGE_PAGE_SIZE - 1);
+        void* memory = mmap(nullptr, hugeBytes, PROT_READ | PROT_WRITE,
+                            MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB, -1, 0);
+        if (memory != MAP_FAILED) {
+            slab.memory = static_cast<uint8_t*>(memory);
+            slab.bytes = hugeBytes;
+        }
+    }
+
+    if (!slab.memory) {
+        void* memory = mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (memory == MAP_FAILED) {
+            SLLog::LogError("PacketPool::AddSlab - mmap() failed: " + std::string(strerror(errno)));
+            return false;
+        }
+        slab.memory = static_cast<uint8_t*>(memory);
+        slab.bytes = bytes;
+        if (m_options.useHugePages) {
+            madvise(memory, bytes, MADV_HUGEPAGE);
+        }
+    }
+    slab.mapped = true;
+    slab.headers.reset(new PacketBuffer[count]);
+
+    for (size_t i = 0; i < count; ++i) {
+        PacketBuffer& buffer = slab.headers[i];
+        buffer.data = slab.memory + i * m_options.bufferSize;
+        buffer.capacity = static_cast<uint32_t>(m_options.bufferSize);
+        buffer.pool = this;
+        buffer.next = m_centralHead;
+        m_centralHead = &buffer;
+    }
+    m_centralCount += count;
+
+    m_slabs.push_back(std::move(slab));
+    m_totalBuffers.fetch_add(count, std::memory_order_relaxed);
+    m_slabAllocations.fetch_add(1, std::memory_order_relaxed);
+
+    return true;
+}
+
+size_t PacketPool::ThreadShardIndex() {
+    static std::atomic<size_t> nextIndex{0};
+    thread_local size_t index = nextIndex.fetch_add(1, std::memory_order_relaxed) % CACHE_SHARD_COUNT;
+    return index;
+}
+
+void PacketPool::Lock(CacheShard& shard) {
+    while (shard.lock.test_and_set(std::memory_order_acquire)) {
+        std::this_thread::yield();
+    }
+}
+
+void PacketPool::Unlock(CacheShard& shard) {
+    shard.lock.clear(std::memory_order_release);
+}
+
+} // namespace hek
@@ -0,0 +1,143 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "sequence_tracker.hpp"
+
+#include <cstdio>
+
+namespace hek {
+
+SequenceStats& SequenceStats::operator+=(const SequenceStats& other) {
+    received += other.received;
+    lost += other.lost;
+    reordered += other.reordered;
+    duplicates += other.duplicates;
+    late += other.late;
+    return *this;
+}
+
+std::string SequenceStats::Summary() const {
+    uint64_t expected = received + lost;
+    double lossPercentage = (expected > 0) ? 100.0 * static_cast<double>(lost) / static_cast<double>(expected) : 0.0;
+
+    char summary[192];
+    std::snprintf(summary, sizeof(summary), "received %llu, lost %llu (%.3f%%), reordered %llu, duplicates %llu, late %llu",
+                  static_cast<unsigned long long>(received), static_cast<unsigned long long>(lost), lossPercentage,
+                  static_cast<unsigned long long>(reordered), static_cast<unsigned long long>(duplicates),
+                  static_cast<unsigned long long>(late));
+    return summary;
+}
+
+SequenceTracker::SequenceTracker()
+    : m_started(false), m_first(0), m_highest(0), m_missing(0), m_window{} {
+}
+
+bool SequenceTracker::TestAndSet(uint64_t sequence) {
+    uint64_t& word = m_window[(sequence % WINDOW_SIZE) / WORD_BITS];
+    uint64_t bit = uint64_t(1) << (sequence % WORD_BITS);
+    bool wasSet = (word & bit) != 0;
+    word |= bit;
+    return wasSet;
+}
+
+void SequenceTracker::Advance(uint64_t sequence) {
+    uint64_t gap = sequence - m_highest;
+
+    if (gap >= WINDOW_SIZE) {
+        // The whole window slides out: everything still missing is lost, and so is everything skipped
+        // beyond the new window. All of the new window except sequence itself is missing.
+        m_stats.lost += m_missing + (gap - WINDOW_SIZE);
+        m_missing = WINDOW_SIZE - 1;
+        m_window.fill(0);
+        m_highest = sequence;
+        return;
+    }
+
+    for (uint64_t next = m_highest + 1; next <= sequence; ++next) {
+        // The slot of next was held by (next - WINDOW_SIZE); count it as lost if it never arrived
+        uint64_t& word = m_window[(next % WINDOW_SIZE) / WORD_BITS];
+        uint64_t bit = uint64_t(1) << (next % WORD_BITS);
+        if (next >= m_first + WINDOW_SIZE && (word & bit) == 0) {
+            ++m_stats.lost;
+            --m_missing;
+        }
+        word &= ~bit;
+
+        if (next != sequence) {
+            ++m_missing;
+        }
+    }
+    m_highest = sequence;
+}
+
+void SequenceTracker::Track(uint64_t sequence) {
+    if (!m_started) {
+        m_started = true;
+        m_first = sequence;
+        m_highest = sequence;
+        TestAndSet(sequence);
+        ++m_stats.received;
+        return;
+    }
+
+    if (sequence > m_highest) {
+        Advance(sequence);
+        TestAndSet(sequence);
+        ++m_stats.received;
+        return;
+    }
+
+    if (m_highest - sequence >= WINDOW_SIZE) {
+        // Behind the window: it was counted as lost (or is a duplicate) already
+        ++m_stats.late;
+        return;
+    }
+
+    if (TestAndSet(sequence)) {
+        ++m_stats.duplicates;
+        return;
+    }
+
+    ++m_stats.received;
+    ++m_stats.reordered;
+    if (sequence >= m_first) {
+        --m_missing;
+    }
+}
+
+SequenceStats SequenceTracker::GetStats() const {
+    SequenceStats stats = m_stats;
+    stats.lost += m_missing;
+    return stats;
+}
+
+void FlowSequenceTrackers::Track(uint64_t flowKey, uint64_t sequence) {
+    Stripe& stripe = m_stripes[std::hash<uint64_t>{}(flowKey) % STRIPE_COUNT];
+    std::lock_guard<std::mutex> lock(stripe.mutex);
+    stripe.flows[flowKey].Track(sequence);
+}
+
+SequenceStats FlowSequenceTrackers::GetTotals() const {
+    SequenceStats totals;
+    for (const Stripe& stripe : m_stripes) {
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        for (const auto& flow : stripe.flows) {
+            totals += flow.second.GetStats();
+        }
+    }
+    return totals;
+}
+
+size_t FlowSequenceTrackers::FlowCount() const {
+    size_t count = 0;
+    for (const Stripe& stripe : m_stripes) {
+        std::lock_guard<std::mutex> lock(stripe.mutex);
+        count += stripe.flows.size();
+    }
+    return count;
+}
+
+} // namespace hek
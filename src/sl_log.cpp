@@ -0,0 +1,378 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "sl_log.hpp"
+#include "spsc_ring.hpp"
+
+#include <algorithm>
+#include <chrono>
+#include <condition_variable>
+#include <cstdarg>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace hek {
+
+namespace {
+
+constexpr size_t RECORD_SIZE = 256;
+constexpr size_t RING_CAPACITY = 1024;
+constexpr auto BACKEND_IDLE_WAIT = std::chrono::milliseconds(10);
+
+struct LogRecord {
+    int64_t timeNs = 0;   // system_clock, since the epoch
+    uint16_t length = 0;
+    LogLevel level = LogLevel::EInfo;
+    char text[RECORD_SIZE - sizeof(int64_t) - sizeof(uint16_t) - sizeof(LogLevel)];
+};
+
+static_assert(sizeof(LogRecord) <= RECORD_SIZE, "LogRecord must fit in one record");
+
+struct TimeStampCache {
+    int64_t second = -1;
+    char text[32] = {};
+};
+
+struct ThreadBuffer {
+    SpscRing<LogRecord, RING_CAPACITY> ring;
+    std::atomic<uint64_t> dropped{0};
+    std::atomic<bool> retired{false};
+};
+
+/**
+ * The process-wide backend. Never destroyed: objects with static storage may still log while they are
+ * being destructed, so at exit the backend is stopped (see Shutdown()) and logging becomes synchronous.
+ */
+class LogBackend {
+public:
+    static LogBackend& Instance() {
+        static LogBackend* backend = new LogBackend();
+        return *backend;
+    }
+
+    void Push(LogRecord& record);
+    void WriteSynchronous(const LogRecord& record);
+    void Flush();
+    bool IsStopped() const { return m_stopped.load(std::memory_order_acquire); }
+
+private:
+    LogBackend();
+
+    static void Shutdown();
+
+    ThreadBuffer* RegisterThread();
+    void Run();
+    void DrainAll(std::vector<LogRecord>& batch, uint64_t& dropped);
+    static void Format(const LogRecord& record, TimeStampCache& cache, std::string& out);
+
+private:
+    std::mutex m_registryMutex;
+    std::vector<std::shared_ptr<ThreadBuffer>> m_threadBuffers;
+
+    std::mutex m_wakeMutex;
+    std::condition_variable m_wakeCondition;
+    std::condition_variable m_flushCondition;
+    uint64_t m_flushRequested;
+    uint64_t m_flushCompleted;
+    bool m_running;
+    std::atomic<bool> m_stopped;
+
+    std::mutex m_syncWriteMutex;
+    TimeStampCache m_syncTimeStamp;
+
+    std::thread m_thread;
+};
+
+thread_local ThreadBuffer* t_threadBuffer = nullptr;
+thread_local bool t_threadExiting = false;
+
+/**
+ * Per-thread ring, registered on the first log of a thread. The holder marks the ring retired when the
+ * thread exits; the backend drains and releases it.
+ */
+struct ThreadBufferHolder {
+    std::shared_ptr<ThreadBuffer> buffer;
+
+    ~ThreadBufferHolder() {
+        if (buffer) {
+            buffer->retired.store(true, std::memory_order_release);
+        }
+        // Logging from later thread_local destructors bypasses the ring
+        t_threadBuffer = nullptr;
+        t_threadExiting = true;
+    }
+};
+
+LogBackend::LogBackend() :
+    m_flushRequested(0),
+    m_flushCompleted(0),
+    m_running(true),
+    m_stopped(false)
+{
+    m_thread = std::thread(&LogBackend::Run, this);
+    std::atexit(&LogBackend::Shutdown);
+}
+
+void LogBackend::Shutdown()
+{
+    LogBackend& backend = Instance();
+
+    {
+        std::lock_guard<std::mutex> lock(backend.m_wakeMutex);
+        backend.m_running = false;
+    }
+    backend.m_wakeCondition.notify_all();
+
+    if (backend.m_thread.joinable()) {
+        backend.m_thread.join();
+    }
+}
+
+ThreadBuffer* LogBackend::RegisterThread()
+{
+    thread_local ThreadBufferHolder holder;
+
+    holder.buffer = std::make_shared<ThreadBuffer>();
+
+    std::lock_guard<std::mutex> lock(m_registryMutex);
+    m_threadBuffers.push_back(holder.buffer);
+    return holder.buffer.get();
+}
+
+void LogBackend::Push(LogRecord& record)
+{
+    if (!t_threadBuffer) {
+        t_threadBuffer = RegisterThread();
+    }
+
+    LogLevel level = record.level;
+    if (!t_threadBuffer->ring.TryPush(std::move(record))) {
+        t_threadBuffer->dropped.fetch_add(1, std::memory_order_relaxed);
+        return;
+    }
+
+    // Warnings and errors are written right away, info waits for the backend's next pass unless
+    // the ring is filling up
+    if (level != LogLevel::EInfo || t_threadBuffer->ring.Size() == static_cast<int>(RING_CAPACITY / 2)) {
+        m_wakeCondition.notify_one();
+    }
+}
+
+void LogBackend::WriteSynchronous(const LogRecord& record)
+{
+    std::string line;
+    std::lock_guard<std::mutex> lock(m_syncWriteMutex);
+    Format(record, m_syncTimeStamp, line);
+    std::fwrite(line.data(), 1, line.size(), record.level == LogLevel::EInfo ? stdout : stderr);
+    std::fflush(record.level == LogLevel::EInfo ? stdout : stderr);
+}
+
+void LogBackend::Flush()
+{
+    if (IsStopped()) {
+        return;
+    }
+
+    std::unique_lock<std::mutex> lock(m_wakeMutex);
+    uint64_t request = ++m_flushRequested;
+    m_wakeCondition.notify_all();
+    m_flushCondition.wait(lock, [this, request] { return m_flushCompleted >= request || !m_running; });
+}
+
+void LogBackend::DrainAll(std::vector<LogRecord>& batch, uint64_t& dropped)
+{
+    std::lock_guard<std::mutex> lock(m_registryMutex);
+
+    for (auto it = m_threadBuffers.begin(); it != m_threadBuffers.end();) {
+        ThreadBuffer& buffer = **it;
+
+        // Read retired before draining, so nothing pushed before the thread exited is lost
+        bool retired = buffer.retired.load(std::memory_order_acquire);
+
+        LogRecord record;
+        while (buffer.ring.Pop(record)) {
+            batch.push_back(record);
+        }
+        dropped += buffer.dropped.exchange(0, std::memory_order_relaxed);
+
+        if (retired) {
+            it = m_threadBuffers.erase(it);
+        } else {
+            ++it;
+        }
+    }
+}
+
+void LogBackend::Format(const LogRecord& record, TimeStampCache& cache, std::string& out)
+{
+    static constexpr const char* LEVEL_PREFIX[] = {
+        "\033[1;32m",  // Green color
+        "\033[1;33m",  // Yellow (close to orange)
+        "\033[1;31m"   // Red color
+    };
+    static constexpr const char* LEVEL_NAME[] = { " INFO - ", " WARNING - ", " ERROR - " };
+
+    int64_t second = record.timeNs / 1000000000;
+    if (second != cache.second) {
+        std::time_t now = static_cast<std::time_t>(second);
+        std::tm localTime;
+        localtime_r(&now, &localTime);
+        std::strftime(cache.text, sizeof(cache.text), "%Y-%m-%d %H:%M:%S", &localTime);
+        cache.second = second;
+    }
+
+    char msec[8];
+    std::snprintf(msec, sizeof(msec), ":%03d", static_cast<int>((record.timeNs / 1000000) % 1000));
+
+    size_t level = std::min<size_t>(static_cast<size_t>(record.level), 2);
+    out += LEVEL_PREFIX[level];
+    out += cache.text;
+    out += msec;
+    out += LEVEL_NAME[level];
+    out.append(record.text, record.length);
+    out += "\033[0m\n"; // Reset color
+}
+
+void LogBackend::Run()
+{
+    std::vector<LogRecord> batch;
+    TimeStampCache timeStamp;
+    std::string infoOut;
+    std::string errorOut;
+    bool idle = true;
+
+    while (true) {
+        uint64_t flushRequest;
+        bool running;
+        {
+            std::unique_lock<std::mutex> lock(m_wakeMutex);
+            if (idle) {
+                m_wakeCondition.wait_for(lock, BACKEND_IDLE_WAIT);
+            }
+            flushRequest = m_flushRequested;
+            running = m_running;
+        }
+
+        uint64_t dropped = 0;
+        DrainAll(batch, dropped);
+
+        // Keep draining without waiting while the producers keep up the pace
+        idle = batch.empty();
+
+        // Records of different threads are merged in time order
+        std::stable_sort(batch.begin(), batch.end(),
+                         [](const LogRecord& a, const LogRecord& b) { return a.timeNs < b.timeNs; });
+
+        for (const LogRecord& record : batch) {
+            Format(record, timeStamp, record.level == LogLevel::EInfo ? infoOut : errorOut);
+        }
+
+        if (dropped > 0) {
+            LogRecord record;
+            record.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                                std::chrono::system_clock::now().time_since_epoch()).count();
+            record.level = LogLevel::EWarn;
+            record.length = static_cast<uint16_t>(std::snprintf(record.text, sizeof(record.text),
+                "SLLog - %llu log record(s) dropped, ring full", static_cast<unsigned long long>(dropped)));
+            Format(record, timeStamp, errorOut);
+        }
+
+        if (!infoOut.empty()) {
+            std::fwrite(infoOut.data(), 1, infoOut.size(), stdout);
+            std::fflush(stdout);
+            infoOut.clear();
+        }
+        if (!errorOut.empty()) {
+            std::fwrite(errorOut.data(), 1, errorOut.size(), stderr);
+            std::fflush(stderr);
+            errorOut.clear();
+        }
+        batch.clear();
+
+        {
+            std::lock_guard<std::mutex> lock(m_wakeMutex);
+            m_flushCompleted = flushRequest;
+            if (!running) {
+                // Everything pushed so far is written; from now on producers write synchronously
+                m_stopped.store(true, std::memory_order_release);
+            }
+        }
+        m_flushCondition.notify_all();
+
+        if (!running) {
+            break;
+        }
+    }
+}
+
+void FillRecord(LogRecord& record, LogLevel inLevel)
+{
+    record.timeNs = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                        std::chrono::system_clock::now().time_since_epoch()).count();
+    record.level = inLevel;
+}
+
+void Submit(LogRecord& record)
+{
+    LogBackend& backend = LogBackend::Instance();
+    if (backend.IsStopped() || t_threadExiting) {
+        backend.WriteSynchronous(record);
+    } else {
+        backend.Push(record);
+    }
+}
+
+} // namespace
+
+void SLLog::Log(LogLevel inLevel, const char* inMsg, size_t inLength)
+{
+    LogRecord record;
+    FillRecord(record, inLevel);
+    record.length = static_cast<uint16_t>(std::min(inLength, sizeof(record.text)));
+    std::memcpy(record.text, inMsg, record.length);
+    Submit(record);
+}
+
+void SLLog::Logf(LogLevel inLevel, const char* inFormat, ...)
+{
+    LogRecord record;
+    FillRecord(record, inLevel);
+
+    va_list args;
+    va_start(args, inFormat);
+    int length = std::vsnprintf(record.text, sizeof(record.text), inFormat, args);
+    va_end(args);
+
+    // vsnprintf reserves one byte for the terminator, the record needs none
+    record.length = static_cast<uint16_t>(std::clamp<int>(length, 0, sizeof(record.text) - 1));
+    Submit(record);
+}
+
+void SLLog::Flush()
+{
+    LogBackend::Instance().Flush();
+}
+
+LogLevel SLLog::LevelFromEnvironment()
+{
+    const char* level = std::getenv("SLLOG_LEVEL");
+    if (!level) {
+        return LogLevel::EInfo;
+    }
+
+    if (std::strcmp(level, "warn") == 0) return LogLevel::EWarn;
+    if (std::strcmp(level, "error") == 0) return LogLevel::EError;
+    if (std::strcmp(level, "off") == 0) return LogLevel::EOff;
+    return LogLevel::EInfo;
+}
+
+} // namespace hek
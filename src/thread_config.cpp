@@ -0,0 +1,174 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "thread_config.hpp"
+#include "sl_log.hpp"
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <limits>
+#include <pthread.h>
+
+namespace hek {
+
+static constexpr size_t MAX_THREAD_NAME_LENGTH = 15;
+static constexpr int MAX_CACHE_INDEX = 8;
+
+ThreadConfig ThreadConfig::ForIndex(size_t index) const {
+    ThreadConfig config = *this;
+    if (!config.name.empty()) {
+        config.name += "-" + std::to_string(index);
+    }
+    if (!cpus.empty()) {
+        config.cpus = { cpus[index % cpus.size()] };
+    }
+    return config;
+}
+
+int ApplyThreadConfig(std::thread::native_handle_type thread, const ThreadConfig& config) {
+    int result = 0;
+
+    if (!config.name.empty()) {
+        std::string name = config.name.substr(0, MAX_THREAD_NAME_LENGTH);
+        int error = pthread_setname_np(thread, name.c_str());
+        if (error != 0) {
+            SLLog::LogWarn("ApplyThreadConfig - Failed to name thread " + name + ": " + std::string(strerror(error)));
+            result = -1;
+        }
+    }
+
+    if (!config.cpus.empty()) {
+        cpu_set_t cpuSet;
+        CPU_ZERO(&cpuSet);
+        for (int cpu : config.cpus) {
+            if (cpu >= 0 && cpu < CPU_SETSIZE) {
+                CPU_SET(cpu, &cpuSet);
+            }
+        }
+        int error = pthread_setaffinity_np(thread, sizeof(cpuSet), &cpuSet);
+        if (error != 0) {
+            SLLog::LogWarn("ApplyThreadConfig - Failed to set the CPU affinity of thread " + config.name + ": " +
+                           std::string(strerror(error)));
+            result = -1;
+        }
+    }
+
+    if (config.schedPolicy != SCHED_OTHER) {
+        sched_param param = {};
+        param.sched_priority = config.schedPriority;
+        int error = pthread_setschedparam(thread, config.schedPolicy, &param);
+        if (error != 0) {
+            SLLog::LogWarn("ApplyThreadConfig - Failed to set the scheduling policy of thread " + config.name + ": " +
+                           std::string(strerror(error)));
+            result = -1;
+        }
+    }
+
+    return result;
+}
+
+bool ParseCpuList(const std::string& text, std::vector<int>& cpus) {
+    std::vector<int> parsed;
+    const char* pos = text.c_str();
+
+    while (*pos != '\0' && *pos != '\n') {
+        char* end;
+        long first = std::strtol(pos, &end, 10);
+        if (end == pos || first < 0 || first >= CPU_SETSIZE) {
+            return false;
+        }
+        long last = first;
+        if (*end == '-') {
+            pos = end + 1;
+            last = std::strtol(pos, &end, 10);
+            if (end == pos || last < first || last >= CPU_SETSIZE) {
+                return false;
+            }
+        }
+        for (long cpu = first; cpu <= last; ++cpu) {
+            parsed.push_back(static_cast<int>(cpu));
+        }
+
+        if (*end == ',') {
+            ++end;
+        } else if (*end != '\0' && *end != '\n') {
+            return false;
+        }
+        pos = end;
+    }
+
+    if (parsed.empty()) {
+        return false;
+    }
+    cpus = std::move(parsed);
+    return true;
+}
+
+bool ParseByteSize(const std::string& text, int& bytes) {
+    const char* pos = text.c_str();
+    char* end;
+    errno = 0;
+    long long value = std::strtoll(pos, &end, 10);
+    if (end == pos || errno == ERANGE || value <= 0) {
+        return false;
+    }
+
+    long long multiplier = 1;
+    if (*end == 'k') {
+        multiplier = 1024;
+        ++end;
+    } else if (*end == 'M') {
+        multiplier = 1024 * 1024;
+        ++end;
+    }
+
+    // Range checked before multiplying, so the multiplication cannot overflow
+    if (*end != '\0' || value > std::numeric_limits<int>::max() / 2 / multiplier) {
+        return false;
+    }
+    bytes = static_cast<int>(value * multiplier);
+    return true;
+}
+
+int FindCacheSiblingCpu(int cpu) {
+    // The cache indexes run from L1 up to the last level cache, so the first other CPU found shares the smallest cache
+    const std::string cacheDir = "/sys/devices/system/cpu/cpu" + std::to_string(cpu) + "/cache/index";
+
+    for (int index = 0; index < MAX_CACHE_INDEX; ++index) {
+        std::ifstream file(cacheDir + std::to_string(index) + "/shared_cpu_list");
+        std::string line;
+        if (!file || !std::getline(file, line)) {
+            break;
+        }
+
+        std::vector<int> sharedCpus;
+        if (!ParseCpuList(line, sharedCpus)) {
+            continue;
+        }
+        for (int sharedCpu : sharedCpus) {
+            if (sharedCpu != cpu) {
+                return sharedCpu;
+            }
+        }
+    }
+
+    return -1;
+}
+
+ThreadConfig PinToCacheSibling(const ThreadConfig& config, const ThreadConfig& neighbour) {
+    ThreadConfig pinned = config;
+    int sibling = neighbour.cpus.empty() ? -1 : FindCacheSiblingCpu(neighbour.cpus.front());
+    if (sibling < 0) {
+        SLLog::LogWarn("PinToCacheSibling - No cache sibling found for thread " + neighbour.name + ", not pinning " + config.name);
+        return pinned;
+    }
+
+    pinned.cpus = { sibling };
+    return pinned;
+}
+
+} // namespace hek
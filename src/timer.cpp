@@ -8,56 +8,51 @@
 #include "timer.hpp"
 #include "sl_log.hpp"
 
+#include <utility>
+
 namespace hek {
 
-Timer::Timer()
+Timer::Timer(TimerWheel& wheel) :
+    m_Wheel(wheel),
+    m_TimerId(TimerWheel::INVALID_TIMER_ID)
 {
-    m_HandlerRunning.store(true);
-    m_HandlerThread = std::thread(&Timer::Handler, this);
 }
 
 Timer::~Timer()
 {
-    {
-        std::lock_guard<std::mutex> lock(m_Mutex);
-        m_HandlerRunning.store(false);
-    }
-
-    m_TimerCondition.notify_all();
-
-    if (m_HandlerThread.joinable()) m_HandlerThread.join();
+    ReqTimerStop();
 
     SLLog::LogInfo("Timer::~Timer - Timer terminated gracefully...");
 }
 
 void Timer::ReqTimerStart(uint32_t inTimeoutMs, bool inRepeat)
 {
-    TimerParams_t tp;
-    tp.timeoutMs = inTimeoutMs;
-    tp.repeat = inRepeat;
-    tp.enabled = true;
+    ReqTimerStop();
+
+    std::chrono::milliseconds timeout(inTimeoutMs);
+    TimerWheel::TimerId timerId = m_Wheel.Schedule(timeout, [this] { Handler(); },
+                                                   inRepeat ? timeout : std::chrono::milliseconds(0));
 
     {
         std::lock_guard<std::mutex> lock(m_Mutex);
-        m_TimerQueue.Clear();
-        m_TimerQueue.Push(tp);
+        std::swap(timerId, m_TimerId);
     }
 
-    m_TimerCondition.notify_all();
+    // Only set when another thread started this timer concurrently
+    m_Wheel.Cancel(timerId);
 }
 
 void Timer::ReqTimerStop()
 {
-    TimerParams_t tp;
-    tp.enabled = false;
+    TimerWheel::TimerId timerId = TimerWheel::INVALID_TIMER_ID;
 
     {
         std::lock_guard<std::mutex> lock(m_Mutex);
-        m_TimerQueue.Clear();
-        m_TimerQueue.Push(tp);
+        std::swap(timerId, m_TimerId);
     }
 
-    m_TimerCondition.notify_all();
+    // Cancel outside m_Mutex: it waits for a running Handler(), which may itself start or stop this timer
+    m_Wheel.Cancel(timerId);
 }
 
 void Timer::SetTimerCallback(TimeoutCallback_t inCallback)
@@ -74,53 +69,10 @@ void Timer::UnsetTimerCallback()
 
 void Timer::Handler()
 {
-    std::chrono::steady_clock::time_point tpBegin = std::chrono::steady_clock::now();
-    TimerParams_t tp;
-    tp.enabled = false;
-
-    while (m_HandlerRunning.load()) {
-        std::unique_lock<std::mutex> lock(m_Mutex);
-
-        if (!tp.enabled) {
-            m_TimerCondition.wait(lock, [this] { return (!m_HandlerRunning.load() || !m_TimerQueue.Empty()); });
-        } else {
-            auto elapsedMs = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - tpBegin).count();
-            uint32_t overtimeMs = (tp.timeoutMs > 0) ? (elapsedMs % tp.timeoutMs) : 0;
-            uint32_t adjustedTimeoutMs = (overtimeMs > 0) ? (tp.timeoutMs - overtimeMs) : tp.timeoutMs;
-
-            if (!m_TimerCondition.wait_for(lock, std::chrono::milliseconds(adjustedTimeoutMs),
-                                           [this] { return (!m_HandlerRunning.load() || !m_TimerQueue.Empty()); })) {
-                lock.unlock();
-                {
-                    std::lock_guard<std::mutex> lock(m_TimeoutCallbackMutex);
-                    if (m_pTimeoutCallback) {
-                        m_pTimeoutCallback();
-                    }
-                }
-                lock.lock();
-
-                if (!tp.repeat) {
-                    tp.enabled = false;
-                }
-            }
-        }
-
-        if (!m_HandlerRunning.load()) {
-            break;
-        }
-
-        if (m_TimerQueue.Empty()) {
-            continue;
-        }
-
-        TimerParams_t tpNew;
-        if (m_TimerQueue.Pop(tpNew)) {
-            tp = tpNew;
-            tpBegin = std::chrono::steady_clock::now();
-        }
+    std::lock_guard<std::mutex> lock(m_TimeoutCallbackMutex);
+    if (m_pTimeoutCallback) {
+        m_pTimeoutCallback();
     }
-
-    SLLog::LogInfo("Timer::Handler - Thread terminated gracefully...");
 }
 
 }  // namespace hek
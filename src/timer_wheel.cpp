@@ -0,0 +1,387 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+
+#include "timer_wheel.hpp"
+#include "sl_log.hpp"
+
+namespace hek {
+
+TimerWheel::TimerWheel(std::chrono::microseconds tickDuration)
+    : m_tickDuration(std::chrono::duration_cast<std::chrono::steady_clock::duration>(tickDuration)),
+      m_startTime(std::chrono::steady_clock::now()),
+      m_running(true),
+      m_currentTick(0),
+      m_nextWakeTick(UINT64_MAX),
+      m_activeTimers(0),
+      m_overruns(0)
+{
+    for (auto& level : m_slots) {
+        level.fill(NIL);
+    }
+
+    m_thread = std::thread(&TimerWheel::Run, this);
+    SetThreadConfig(ThreadConfig());
+
+    static std::atomic<uint32_t> wheelCount{0};
+    std::string labels = "wheel=\"" + std::to_string(wheelCount.fetch_add(1)) + "\"";
+    MetricsRegistry& registry = MetricsRegistry::Default();
+    m_metrics.push_back(registry.AddCallback("timer_wheel_overruns_total", "Periods of periodic timers that were missed",
+                                             MetricType::ECounter, labels, [this] { return Overruns(); }));
+    m_metrics.push_back(registry.AddCallback("timer_wheel_active_timers", "Timers scheduled", MetricType::EGauge, labels,
+                                             [this] { return static_cast<uint64_t>(ActiveTimers()); }));
+}
+
+TimerWheel::~TimerWheel()
+{
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+        m_running = false;
+    }
+
+    m_wakeCondition.notify_all();
+
+    if (m_thread.joinable()) m_thread.join();
+
+    SLLog::LogInfo("TimerWheel::~TimerWheel - TimerWheel terminated gracefully...");
+}
+
+TimerWheel& TimerWheel::Default()
+{
+    static TimerWheel wheel;
+    return wheel;
+}
+
+TimerWheel::TimerId TimerWheel::Schedule(std::chrono::nanoseconds delay, TimeoutCallback_t callback,
+                                         std::chrono::nanoseconds period)
+{
+    bool wake = false;
+    TimerId timerId = INVALID_TIMER_ID;
+
+    {
+        std::lock_guard<std::mutex> lock(m_mutex);
+
+        // The wheel is empty, so it can skip the ticks it has been idle for right away, rather than
+        // have Run() advance through them one at a time
+        if (m_activeTimers == 0) {
+            m_currentTick = std::max(m_currentTick, TickNow());
+        }
+
+        int32_t index = AllocateNodeLocked();
+        TimerNode& node = m_nodes[index];
+        node.callback = std::move(callback);
+        node.periodTicks = (period.count() > 0) ? ToTicks(period) : 0;
+        node.cancelled = false;
+
+        // Expire on the first tick boundary at or after now + delay
+        node.expiryTick = std::max(TickNow(), m_currentTick) + ToTicks(delay);
+        node.state = TimerState::EPending;
+        LinkLocked(index);
+        ++m_activeTimers;
+
+        if (node.expiryTick < m_nextWakeTick) {
+            m_nextWakeTick = node.expiryTick;
+            wake = true;
+        }
+
+        timerId = (static_cast<TimerId>(node.generation) << 32) | static_cast<TimerId>(index + 1);
+    }
+
+    if (wake) {
+        m_wakeCondition.notify_all();
+    }
+
+    return timerId;
+}
+
+bool TimerWheel::Cancel(TimerId timerId)
+{
+    if (timerId == INVALID_TIMER_ID) {
+        return false;
+    }
+
+    int32_t index = static_cast<int32_t>((timerId & 0xFFFFFFFFu) - 1);
+    uint32_t generation = static_cast<uint32_t>(timerId >> 32);
+
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    if (index < 0 || static_cast<size_t>(index) >= m_nodes.size()) {
+        return false;
+    }
+
+    TimerNode& node = m_nodes[index];
+    if (node.generation != generation || node.state == TimerState::EFree || node.cancelled) {
+        return false;
+    }
+
+    if (node.state == TimerState::EPending) {
+        UnlinkLocked(index);
+        FreeNodeLocked(index);
+        return true;
+    }
+
+    // EFiring: the callback is part of the batch being dispatched right now. The dispatcher frees the node.
+    node.cancelled = true;
+    if (std::this_thread::get_id() != m_thread.get_id()) {
+        m_dispatchDoneCondition.wait(lock, [this, index, generation] {
+            return m_nodes[index].generation != generation || m_nodes[index].state != TimerState::EFiring;
+        });
+    }
+
+    return true;
+}
+
+size_t TimerWheel::ActiveTimers() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_activeTimers;
+}
+
+uint64_t TimerWheel::Overruns() const
+{
+    std::lock_guard<std::mutex> lock(m_mutex);
+    return m_overruns;
+}
+
+void TimerWheel::SetThreadConfig(const ThreadConfig& threadConfig)
+{
+    ThreadConfig config = threadConfig;
+    if (config.name.empty()) {
+        config.name = "timer-wheel";
+    }
+    ApplyThreadConfig(m_thread.native_handle(), config);
+}
+
+uint64_t TimerWheel::TickNow() const
+{
+    return static_cast<uint64_t>((std::chrono::steady_clock::now() - m_startTime) / m_tickDuration);
+}
+
+uint64_t TimerWheel::ToTicks(std::chrono::nanoseconds duration) const
+{
+    auto tickNs = std::chrono::duration_cast<std::chrono::nanoseconds>(m_tickDuration).count();
+    uint64_t ticks = static_cast<uint64_t>((duration.count() + tickNs - 1) / tickNs);
+    return std::max<uint64_t>(ticks, 1);
+}
+
+std::chrono::steady_clock::time_point TimerWheel::TickTime(uint64_t tick) const
+{
+    return m_startTime + m_tickDuration * static_cast<int64_t>(tick);
+}
+
+int32_t TimerWheel::AllocateNodeLocked()
+{
+    if (!m_freeNodes.empty()) {
+        int32_t index = m_freeNodes.back();
+        m_freeNodes.pop_back();
+        return index;
+    }
+
+    m_nodes.emplace_back();
+    return static_cast<int32_t>(m_nodes.size() - 1);
+}
+
+void TimerWheel::FreeNodeLocked(int32_t index)
+{
+    TimerNode& node = m_nodes[index];
+    node.callback = nullptr;
+    node.state = TimerState::EFree;
+    node.cancelled = false;
+    ++node.generation;
+    m_freeNodes.push_back(index);
+    --m_activeTimers;
+}
+
+void TimerWheel::LinkLocked(int32_t index)
+{
+    TimerNode& node = m_nodes[index];
+    uint64_t delta = (node.expiryTick > m_currentTick) ? node.expiryTick - m_currentTick : 0;
+
+    int level = 0;
+    while (level < LEVEL_COUNT - 1 && delta >= (uint64_t(1) << (SLOT_BITS * (level + 1)))) {
+        ++level;
+    }
+
+    uint64_t expiryTick = node.expiryTick;
+    if (delta == 0) {
+        // Already due: the current tick's slot has been processed, so file it in the next one (a cascade
+        // files due timers itself, see CascadeLocked())
+        expiryTick = m_currentTick + 1;
+    } else if (level == LEVEL_COUNT - 1 && delta >= (uint64_t(1) << (SLOT_BITS * LEVEL_COUNT))) {
+        // Beyond the wheel's range: park it in the farthest slot, it cascades again from there
+        expiryTick = m_currentTick + (uint64_t(1) << (SLOT_BITS * LEVEL_COUNT)) - 1;
+    }
+
+    uint32_t slot = static_cast<uint32_t>(expiryTick >> (SLOT_BITS * level)) & SLOT_MASK;
+    PushLocked(index, m_slots[level][slot]);
+}
+
+void TimerWheel::PushLocked(int32_t index, int32_t& head)
+{
+    TimerNode& node = m_nodes[index];
+    node.prev = NIL;
+    node.next = head;
+    if (head != NIL) {
+        m_nodes[head].prev = index;
+    }
+    head = index;
+    node.listHead = &head;
+}
+
+void TimerWheel::UnlinkLocked(int32_t index)
+{
+    TimerNode& node = m_nodes[index];
+
+    if (node.prev != NIL) {
+        m_nodes[node.prev].next = node.next;
+    } else if (node.listHead) {
+        *node.listHead = node.next;
+    }
+
+    if (node.next != NIL) {
+        m_nodes[node.next].prev = node.prev;
+    }
+
+    node.prev = NIL;
+    node.next = NIL;
+    node.listHead = nullptr;
+}
+
+void TimerWheel::CascadeLocked(int level, uint32_t slot)
+{
+    int32_t index = m_slots[level][slot];
+    m_slots[level][slot] = NIL;
+
+    while (index != NIL) {
+        int32_t next = m_nodes[index].next;
+        m_nodes[index].listHead = nullptr;
+        if (m_nodes[index].expiryTick <= m_currentTick) {
+            // Due now: the current level 0 slot is processed right after the cascade
+            PushLocked(index, m_slots[0][static_cast<uint32_t>(m_currentTick) & SLOT_MASK]);
+        } else {
+            LinkLocked(index);
+        }
+        index = next;
+    }
+}
+
+void TimerWheel::AdvanceLocked(std::vector<int32_t>& expired)
+{
+    ++m_currentTick;
+
+    // Cascade the higher levels whose slot boundary has been reached
+    for (int level = 1; level < LEVEL_COUNT; ++level) {
+        if ((m_currentTick & ((uint64_t(1) << (SLOT_BITS * level)) - 1)) != 0) {
+            break;
+        }
+        CascadeLocked(level, static_cast<uint32_t>(m_currentTick >> (SLOT_BITS * level)) & SLOT_MASK);
+    }
+
+    uint32_t slot = static_cast<uint32_t>(m_currentTick) & SLOT_MASK;
+    int32_t index = m_slots[0][slot];
+    m_slots[0][slot] = NIL;
+
+    while (index != NIL) {
+        TimerNode& node = m_nodes[index];
+        int32_t next = node.next;
+        node.prev = NIL;
+        node.next = NIL;
+        node.listHead = nullptr;
+
+        if (node.expiryTick <= m_currentTick) {
+            node.state = TimerState::EFiring;
+            expired.push_back(index);
+        } else {
+            // Parked beyond the wheel's range
+            LinkLocked(index);
+        }
+        index = next;
+    }
+}
+
+uint64_t TimerWheel::NextWakeTickLocked() const
+{
+    if (m_activeTimers == 0) {
+        return UINT64_MAX;
+    }
+
+    // First occupied level 0 slot, or else the next level 1 cascade
+    for (uint64_t tick = m_currentTick + 1; ; ++tick) {
+        if (m_slots[0][static_cast<uint32_t>(tick) & SLOT_MASK] != NIL) {
+            return tick;
+        }
+        if ((tick & SLOT_MASK) == 0) {
+            return tick;
+        }
+    }
+}
+
+void TimerWheel::Run()
+{
+    std::vector<int32_t> expired;
+    std::vector<TimerNode*> firing;
+    std::unique_lock<std::mutex> lock(m_mutex);
+
+    while (m_running) {
+        uint64_t nowTick = TickNow();
+
+        if (m_activeTimers == 0) {
+            m_currentTick = std::max(m_currentTick, nowTick);
+        }
+
+        while (m_currentTick < nowTick) {
+            AdvanceLocked(expired);
+        }
+
+        if (!expired.empty()) {
+            // Dispatch the batch outside the lock. Nodes in EFiring state are neither freed nor reused
+            // until the batch is done, and m_nodes is a deque, so their addresses stay valid.
+            for (int32_t index : expired) {
+                firing.push_back(&m_nodes[index]);
+            }
+
+            lock.unlock();
+            for (TimerNode* node : firing) {
+                if (node->callback && !node->cancelled.load()) {
+                    node->callback();
+                }
+            }
+            firing.clear();
+            lock.lock();
+
+            for (int32_t index : expired) {
+                TimerNode& node = m_nodes[index];
+                if (node.cancelled || node.periodTicks == 0) {
+                    FreeNodeLocked(index);
+                    continue;
+                }
+
+                node.expiryTick += node.periodTicks;
+                if (node.expiryTick <= m_currentTick) {
+                    uint64_t missed = (m_currentTick - node.expiryTick) / node.periodTicks + 1;
+                    m_overruns += missed;
+                    node.expiryTick += missed * node.periodTicks;
+                }
+                node.state = TimerState::EPending;
+                LinkLocked(index);
+            }
+            expired.clear();
+
+            m_dispatchDoneCondition.notify_all();
+            continue;
+        }
+
+        m_nextWakeTick = NextWakeTickLocked();
+        if (m_nextWakeTick == UINT64_MAX) {
+            m_wakeCondition.wait(lock);
+        } else {
+            m_wakeCondition.wait_until(lock, TickTime(m_nextWakeTick));
+        }
+    }
+
+    SLLog::LogInfo("TimerWheel::Run - Thread terminated gracefully...");
+}
+
+}  // namespace hek
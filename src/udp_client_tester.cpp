@@ -4,51 +4,83 @@
 *
 *****************************************************************************/
 #include "udp_client_tester.hpp"
+#include "latency_probe.hpp"
+#include "wire_protocol.hpp"
 #include "sl_log.hpp"
 #include <arpa/inet.h>
 
 namespace hek {
 
 static constexpr uint32_t TIMEOUT_MS = 1024;
+static constexpr uint32_t REPORT_INTERVAL_MS = 10240;
+static constexpr size_t RECEIVE_BUFFER_SIZE = 2048;
+static constexpr size_t BATCH_SIZE = 32;
+
+static UdpSocketOptions MakeSocketOptions(const UdpClientTesterOptions& testerOptions) {
+    UdpSocketOptions options;
+    options.bufferSize = RECEIVE_BUFFER_SIZE;
+    options.batchSize = BATCH_SIZE;
+    options.busyPollBudget = testerOptions.busyPollBudget;
+    options.receiverThread = testerOptions.receiverThread;
+    options.ioEngine = testerOptions.ioEngine;
+    options.socketBuffers = testerOptions.socketBuffers;
+    return options;
+}
 
-UdpClientTester::UdpClientTester(uint16_t port, const std::string& ipAddress) {
+UdpClientTester::UdpClientTester(uint16_t port, const std::string& ipAddress, const UdpClientTesterOptions& options)
+    : m_Socket(MakeSocketOptions(options)), m_pingSequence(0) {
     hek::SLLog::LogInfo( "UdpClientTester::UdpClientTester - Enter constructor" );
 
+    if (options.busyPollBudget.count() > 0) {
+        SetDispatchMode(DispatchMode::EInline);
+    }
+    SetHandleThreadConfig(options.handlerOnCacheSibling ? PinToCacheSibling(options.handlerThread, options.receiverThread)
+                                                        : options.handlerThread);
+
     if (m_Socket.Init(port, ipAddress) != 0) {
         hek::SLLog::LogError("UdpClientTester::UdpClientTester - ERROR! Failed to initialize client socket for port " + std::to_string(port));
         return;
     } else {
         hek::SLLog::LogInfo("UdpClientTester::UdpClientTester - Successfully initialized client socket for port " + std::to_string(port));
 
+        ExportQueueMetrics(m_Socket.GetMetricLabels());
         m_Socket.RegisterObserver(this);
         m_Socket.StartReading();
 
         m_timer.SetTimerCallback(std::bind(&UdpClientTester::TimerCallback, this));
         m_timer.ReqTimerStart(TIMEOUT_MS, true);
+
+        m_reportTimer.SetTimerCallback(std::bind(&UdpClientTester::ReportTimerCallback, this));
+        m_reportTimer.ReqTimerStart(REPORT_INTERVAL_MS, true);
     }
 }
 
 UdpClientTester::~UdpClientTester() {
     SLLog::LogInfo( "UdpClientTester::~UdpClientTester - Enter destructor");
 
-    // First stop the Parent
-    hek::AsyncHandler< struct CallbackAction >::Stop();
-
+    // First stop receiving, so no more Pongs are handed to the handler, then stop the Parent
     m_Socket.StopReading();
+    hek::AsyncHandler< struct CallbackAction >::Stop();
 
-    // Stop the timer
+    // Stop the timers
     m_timer.ReqTimerStop();
     m_timer.UnsetTimerCallback();
+    m_reportTimer.ReqTimerStop();
+    m_reportTimer.UnsetTimerCallback();
+
+    // The handle thread is gone: report what is left of the last interval and the totals
+    ReportStatistics();
+    SLLog::LogInfo("UdpClientTester::~UdpClientTester - RTT overall: " + m_totalLatency.Summary());
 }
 
 
-void UdpClientTester::NewUdpDataCallback(const std::string& data, const sockaddr_in& senderAddr) {
-    // Trigger this action to be handled on a different thread, so this callback can return immediately
+void UdpClientTester::NewUdpPacketCallback(PacketView&& packet) {
+    // Trigger this action to be handled on a different thread, so this callback can return immediately.
+    // The packet buffer is handed over as is, without copying the payload.
     CallbackAction action;
     action.type = CallbackType::EUdpDataAvailable;
-    action.data = data;
-    action.senderAddr = senderAddr;
-    TriggerHandlerThread( action );
+    action.packet = std::move(packet);
+    TriggerHandlerThread( std::move(action) );
 }
 
 void UdpClientTester::TimerCallback()
@@ -56,19 +88,30 @@ void UdpClientTester::TimerCallback()
     // Trigger this action to be handled on a different thread, so this callback can return immediately
     CallbackAction action;
     action.type = CallbackType::ETimeoutCallback;
-    TriggerHandlerThread(action);
+    TriggerHandlerThread(std::move(action));
+}
+
+void UdpClientTester::ReportTimerCallback()
+{
+    CallbackAction action;
+    action.type = CallbackType::EReportCallback;
+    TriggerHandlerThread(std::move(action));
 }
 
 void UdpClientTester::HandleTriggerAction( struct CallbackAction &action ) {
     switch ( action.type ) {
     case CallbackType::EUdpDataAvailable: {
-        HandleUdpData(action.data, action.senderAddr);
+        HandleUdpData(action.packet);
         break;
     }
     case CallbackType::ETimeoutCallback: {
         //! Enable for debugging purposes
         //!SLLog::LogInfo( "UdpClientTester::HandleTriggerAction - Send messsage");
-        m_Socket.WriteData("Ping!");
+        SendPing();
+        break;
+    }
+    case CallbackType::EReportCallback: {
+        ReportStatistics();
         break;
     }
     default:
@@ -76,10 +119,62 @@ void UdpClientTester::HandleTriggerAction( struct CallbackAction &action ) {
     }
 }
 
-void UdpClientTester::HandleUdpData(const std::string& data, const sockaddr_in& senderAddr) {
-    std::cout << "================================================================================" << std::endl;
-    std::cout << "Received " << data.size() << " bytes from "
-              << inet_ntoa(senderAddr.sin_addr) << ":" << ntohs(senderAddr.sin_port) << ": " << data << std::endl;
+void UdpClientTester::HandleTriggerActionsDone() {
+    // Send all Pings queued while handling this burst with a single sendmmsg()
+    m_Socket.FlushData();
+}
+
+void UdpClientTester::SendPing() {
+    // A bare wire header, encoded straight into a pool buffer
+    WireHeader header;
+    header.type = WireMessageType::EPing;
+    header.sequence = m_pingSequence++;
+    header.sendTimeNs = MonotonicNowNs();
+
+    PacketView packet = PacketView::Allocate(m_Socket.GetPacketPool());
+    size_t size = packet.Empty() ? 0 : EncodeWireMessage(packet.MutableData(), packet.Capacity(), header);
+    if (size == 0) {
+        std::string ping(WIRE_HEADER_SIZE, '\0');
+        EncodeWireHeader(reinterpret_cast<uint8_t*>(&ping[0]), header);
+        m_Socket.QueueData(ping);
+        return;
+    }
+
+    packet.SetSize(size);
+    m_Socket.QueueData(packet);
+}
+
+void UdpClientTester::ReportStatistics() {
+    if (m_intervalLatency.Count() > 0) {
+        SLLog::LogInfo("UdpClientTester::ReportStatistics - RTT: " + m_intervalLatency.Summary());
+        SLLog::LogInfo("UdpClientTester::ReportStatistics - Pings sent: " + std::to_string(m_pingSequence) +
+                       ", Pongs " + m_pongSequences.GetStats().Summary());
+    }
+    m_intervalLatency.DrainInto(m_totalLatency);
+}
+
+void UdpClientTester::HandleUdpData(const PacketView& packet) {
+    WireHeader header;
+    uint64_t rttNs = 0;
+    bool isPong = DecodeWireHeader(packet.Data(), packet.Size(), header) && header.type == WireMessageType::EPong;
+    if (isPong) {
+        // A send time in the future (another host's clock, or a forged Pong) gives no round-trip time
+        uint64_t nowNs = MonotonicNowNs();
+        if (nowNs >= header.sendTimeNs) {
+            rttNs = nowNs - header.sendTimeNs;
+            m_intervalLatency.Record(rttNs);
+        }
+        m_pongSequences.Track(header.sequence);
+    }
+
+    const sockaddr_in& senderAddr = packet.SenderAddr();
+    if (SLLog::IsEnabled(LogLevel::EInfo)) {
+        char senderIp[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &senderAddr.sin_addr, senderIp, sizeof(senderIp));
+        SLLOG_INFO("Received %zu bytes from %s:%u: %s seq=%llu (rtt %.1f us)", packet.Size(), senderIp, ntohs(senderAddr.sin_port),
+                   isPong ? "Pong" : "unknown", static_cast<unsigned long long>(header.sequence),
+                   static_cast<double>(rttNs) / 1000.0);
+    }
 }
 
 
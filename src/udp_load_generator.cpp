@@ -0,0 +1,367 @@
+/*****************************************************************************
+*
+* Copyright 2025 Dirk van Hek
+*
+*****************************************************************************/
+#include "udp_load_generator.hpp"
+#include "latency_probe.hpp"
+#include "wire_protocol.hpp"
+#include "sl_log.hpp"
+
+#include <algorithm>
+#include <cstring>
+#include <random>
+#include <thread>
+
+namespace hek {
+
+static constexpr size_t PAYLOAD_SIZE_TABLE_SIZE = 4096;
+static constexpr size_t MAX_PAYLOAD_SIZE = 65507;
+static constexpr size_t RECEIVE_BUFFER_SIZE = 2048;
+static constexpr auto MAX_PACING_SLEEP = std::chrono::milliseconds(1);
+static constexpr auto MIN_PACING_SLEEP = std::chrono::microseconds(50);
+static const char PAYLOAD_PATTERN[] = "Ping!";
+
+static ThreadConfig ReceiverThreadConfig(const UdpLoadGeneratorOptions& options) {
+    ThreadConfig config = options.receiverThread;
+    if (config.name.empty()) {
+        config.name = "udp-load-rx";
+    }
+    return config;
+}
+
+UdpLoadGenerator::UdpLoadGenerator(uint16_t port, const std::string& ipAddress, const UdpLoadGeneratorOptions& options)
+    : m_options(options), m_packetsPerSecond(0), m_eventLoop(1, ReceiverThreadConfig(options)), m_initialized(false), m_nextPayloadSize(0),
+      m_nextFlow(0), m_packetsSent(0), m_bytesSent(0), m_intervalPacketsSent(0), m_incompleteBursts(0),
+      m_packetsReceived(0), m_bytesReceived(0), m_intervalPacketsReceived(0) {
+    m_options.flowCount = std::max<size_t>(m_options.flowCount, 1);
+    m_options.batchSize = std::max<size_t>(m_options.batchSize, 1);
+    m_options.maxPayloadSize = std::min(std::max(m_options.maxPayloadSize, m_options.minPayloadSize), MAX_PAYLOAD_SIZE);
+    m_options.minPayloadSize = std::min(m_options.minPayloadSize, m_options.maxPayloadSize);
+
+    BuildPayloadSizes();
+    m_flowSequences.resize(m_options.flowCount, 0);
+
+    m_packetsPerSecond = m_options.packetsPerSecond;
+    if (m_packetsPerSecond <= 0 && m_options.bitsPerSecond > 0) {
+        m_packetsPerSecond = m_options.bitsPerSecond / (AveragePayloadSize() * 8.0);
+    }
+
+    if (m_options.gsoSegments > 1 && m_options.sizeMode != PayloadSizeMode::EFixed) {
+        SLLog::LogWarn("UdpLoadGenerator::UdpLoadGenerator - GSO needs a fixed payload size, sending without it");
+        m_options.gsoSegments = 0;
+    }
+    if (m_options.gsoSegments > 1) {
+        m_options.gsoSegments = std::min({ m_options.gsoSegments, UdpSocket::MAX_GSO_SEGMENTS,
+                                           UdpSocket::MAX_GSO_SIZE / std::max<size_t>(m_options.minPayloadSize, 1) });
+        m_gsoBuffer.resize(m_options.gsoSegments * m_options.minPayloadSize);
+    }
+
+    m_payloadPattern.resize(m_options.maxPayloadSize);
+    for (size_t i = 0; i < m_payloadPattern.size(); ++i) {
+        m_payloadPattern[i] = static_cast<uint8_t>(PAYLOAD_PATTERN[i % (sizeof(PAYLOAD_PATTERN) - 1)]);
+    }
+
+    UdpSocketOptions socketOptions;
+    socketOptions.bufferSize = std::max(m_options.maxPayloadSize, RECEIVE_BUFFER_SIZE);
+    socketOptions.batchSize = m_options.batchSize;
+    socketOptions.ioEngine = m_options.ioEngine;
+    socketOptions.socketBuffers = m_options.socketBuffers;
+
+    for (size_t i = 0; i < m_options.flowCount; ++i) {
+        auto socket = std::make_unique<UdpSocket>(socketOptions);
+        if (socket->Init(port, ipAddress) != 0) {
+            SLLog::LogError("UdpLoadGenerator::UdpLoadGenerator - ERROR! Failed to initialize socket of flow " +
+                            std::to_string(i));
+            return;
+        }
+        m_flows.push_back(std::move(socket));
+    }
+
+    m_initialized = (m_packetsPerSecond > 0);
+    if (!m_initialized) {
+        SLLog::LogError("UdpLoadGenerator::UdpLoadGenerator - ERROR! No target rate");
+    }
+}
+
+UdpLoadGenerator::~UdpLoadGenerator() {
+    for (auto& flow : m_flows) {
+        flow->StopReading();
+        flow->UnregisterObserver(this);
+    }
+}
+
+bool UdpLoadGenerator::IsInitialized() const {
+    return m_initialized;
+}
+
+void UdpLoadGenerator::BuildPayloadSizes() {
+    static constexpr size_t IMIX_SIZES[] = { 64, 576, 1472 };
+    static constexpr size_t IMIX_WEIGHTS[] = { 7, 4, 1 };
+
+    std::mt19937 random(0x5eed);
+    std::uniform_int_distribution<size_t> uniform(m_options.minPayloadSize, m_options.maxPayloadSize);
+
+    m_payloadSizes.resize(PAYLOAD_SIZE_TABLE_SIZE);
+    for (size_t i = 0; i < m_payloadSizes.size(); ++i) {
+        size_t size = m_options.minPayloadSize;
+        switch (m_options.sizeMode) {
+        case PayloadSizeMode::EUniform:
+            size = uniform(random);
+            break;
+        case PayloadSizeMode::EImix: {
+            size_t slot = i % 12;
+            size_t index = (slot < IMIX_WEIGHTS[0]) ? 0 : (slot < IMIX_WEIGHTS[0] + IMIX_WEIGHTS[1]) ? 1 : 2;
+            size = std::min(IMIX_SIZES[index], m_options.maxPayloadSize);
+            break;
+        }
+        case PayloadSizeMode::EFixed:
+        default:
+            break;
+        }
+        m_payloadSizes[i] = static_cast<uint16_t>(size);
+    }
+
+    if (m_options.sizeMode == PayloadSizeMode::EImix) {
+        std::shuffle(m_payloadSizes.begin(), m_payloadSizes.end(), random);
+    }
+}
+
+double UdpLoadGenerator::AveragePayloadSize() const {
+    double total = 0;
+    for (uint16_t size : m_payloadSizes) {
+        total += size;
+    }
+    return std::max(total / static_cast<double>(m_payloadSizes.size()), 1.0);
+}
+
+size_t UdpLoadGenerator::SendBurst(size_t count) {
+    if (m_options.gsoSegments > 1) {
+        return SendSegmentedBurst(count);
+    }
+
+    // Fill one batch per flow, round-robin, then flush every flow with a single sendmmsg()
+    uint64_t sendTimeNs = MonotonicNowNs();
+    size_t queued = 0;
+    while (queued < count) {
+        size_t flowIndex = m_nextFlow;
+        UdpSocket& flow = *m_flows[flowIndex];
+        m_nextFlow = (m_nextFlow + 1) % m_flows.size();
+
+        size_t size = m_payloadSizes[m_nextPayloadSize];
+        m_nextPayloadSize = (m_nextPayloadSize + 1) % m_payloadSizes.size();
+
+        PacketView packet = PacketView::Allocate(flow.GetPacketPool(), size);
+        if (packet.Empty()) {
+            break;
+        }
+        std::memcpy(packet.MutableData(), m_payloadPattern.data(), size);
+        EncodePing(packet.MutableData(), size, flowIndex, m_flowSequences[flowIndex], sendTimeNs);
+
+        if (flow.QueueData(packet) < 0) {
+            break;
+        }
+        ++m_flowSequences[flowIndex];
+        m_bytesSent += size;
+        ++queued;
+    }
+
+    for (auto& flow : m_flows) {
+        flow->FlushData();
+    }
+
+    m_packetsSent += queued;
+    m_intervalPacketsSent += queued;
+    return queued;
+}
+
+void UdpLoadGenerator::EncodePing(uint8_t* datagram, size_t size, size_t flowIndex, uint64_t sequence,
+                                  uint64_t sendTimeNs) {
+    if (size < WIRE_HEADER_SIZE) {
+        return;
+    }
+
+    WireHeader header;
+    header.type = WireMessageType::EPing;
+    header.flowId = static_cast<uint32_t>(flowIndex);
+    header.sequence = sequence;
+    header.sendTimeNs = sendTimeNs;
+    header.payloadLength = static_cast<uint32_t>(size - WIRE_HEADER_SIZE);
+    EncodeWireHeader(datagram, header);
+}
+
+size_t UdpLoadGenerator::SendSegmentedBurst(size_t count) {
+    // One GSO send of up to gsoSegments equally sized datagrams per flow, round-robin
+    uint64_t sendTimeNs = MonotonicNowNs();
+    const size_t size = m_options.minPayloadSize;
+    size_t sent = 0;
+    while (sent < count) {
+        size_t flowIndex = m_nextFlow;
+        UdpSocket& flow = *m_flows[flowIndex];
+        m_nextFlow = (m_nextFlow + 1) % m_flows.size();
+
+        size_t segments = std::min(count - sent, m_options.gsoSegments);
+        for (size_t i = 0; i < segments; ++i) {
+            uint8_t* segment = m_gsoBuffer.data() + i * size;
+            std::memcpy(segment, m_payloadPattern.data(), size);
+            EncodePing(segment, size, flowIndex, m_flowSequences[flowIndex] + i, sendTimeNs);
+        }
+
+        // Datagrams dropped on a full send buffer are counted by the socket, like with FlushData()
+        if (flow.WriteSegmented(m_gsoBuffer.data(), segments * size, size) < 0) {
+            break;
+        }
+        m_flowSequences[flowIndex] += segments;
+        m_bytesSent += segments * size;
+        sent += segments;
+    }
+
+    m_packetsSent += sent;
+    m_intervalPacketsSent += sent;
+    return sent;
+}
+
+UdpLoadGeneratorReport UdpLoadGenerator::Run(const volatile bool& keepRunning) {
+    UdpLoadGeneratorReport report;
+    if (!m_initialized) {
+        return report;
+    }
+
+    for (auto& flow : m_flows) {
+        flow->RegisterObserver(this);
+        flow->StartReading(m_eventLoop);
+    }
+
+    SLLog::LogInfo("UdpLoadGenerator::Run - Sending " + std::to_string(static_cast<uint64_t>(m_packetsPerSecond)) +
+                   " datagrams/s over " + std::to_string(m_flows.size()) + " flow(s) for " +
+                   std::to_string(m_options.duration.count()) + " ms");
+
+    // Burst at most one batch per flow at a time, also when catching up after falling behind
+    const size_t maxBurst = m_options.batchSize * m_flows.size();
+    const auto start = std::chrono::steady_clock::now();
+    const auto end = start + m_options.duration;
+    auto lastReport = start;
+    uint64_t scheduled = 0;
+
+    while (keepRunning) {
+        auto now = std::chrono::steady_clock::now();
+        if (now >= end) {
+            break;
+        }
+
+        if (m_options.reportInterval.count() > 0 && now - lastReport >= m_options.reportInterval) {
+            ReportInterval(std::chrono::duration<double>(now - lastReport).count());
+            lastReport = now;
+        }
+
+        // Number of datagrams that should have been sent by now
+        double elapsed = std::chrono::duration<double>(now - start).count();
+        uint64_t due = static_cast<uint64_t>(elapsed * m_packetsPerSecond) + 1;
+
+        if (due > scheduled) {
+            size_t burst = static_cast<size_t>(std::min<uint64_t>(due - scheduled, maxBurst));
+            size_t sent = SendBurst(burst);
+            // Only what was sent is on schedule; the rest stays due and is retried
+            scheduled += sent;
+            if (sent < burst) {
+                ++m_incompleteBursts;
+                std::this_thread::yield();
+            }
+            continue;
+        }
+
+        // Ahead of schedule: sleep until the next datagram is due, spin for short waits
+        auto nextDue = start + std::chrono::duration_cast<std::chrono::steady_clock::duration>(
+                                   std::chrono::duration<double>(static_cast<double>(scheduled) / m_packetsPerSecond));
+        auto wait = nextDue - now;
+        if (wait > MIN_PACING_SLEEP) {
+            std::this_thread::sleep_for(std::min<std::chrono::steady_clock::duration>(wait, MAX_PACING_SLEEP));
+        } else {
+            std::this_thread::yield();
+        }
+    }
+
+    auto elapsed = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    uint64_t dueAtEnd = static_cast<uint64_t>(std::min(elapsed, std::chrono::duration<double>(m_options.duration).count()) *
+                                              m_packetsPerSecond);
+    report.unsentDatagrams = (dueAtEnd > scheduled) ? dueAtEnd - scheduled : 0;
+    report.incompleteBursts = m_incompleteBursts;
+
+    // Give late replies a moment to arrive before reading stops
+    std::this_thread::sleep_for(std::chrono::milliseconds(100));
+    for (auto& flow : m_flows) {
+        flow->StopReading();
+        report.sendDrops += flow->GetSendDrops();
+    }
+
+    report.elapsedSeconds = elapsed;
+    report.targetPacketsPerSecond = m_packetsPerSecond;
+    report.targetBitsPerSecond = m_packetsPerSecond * AveragePayloadSize() * 8.0;
+    // Datagrams dropped on a full send buffer never left this host
+    double averageSize = (m_packetsSent > 0) ? static_cast<double>(m_bytesSent) / static_cast<double>(m_packetsSent) : 0;
+    report.packetsSent = m_packetsSent - std::min(m_packetsSent, report.sendDrops);
+    report.bytesSent = static_cast<uint64_t>(static_cast<double>(report.packetsSent) * averageSize);
+    report.achievedPacketsPerSecond = (elapsed > 0) ? static_cast<double>(report.packetsSent) / elapsed : 0;
+    report.achievedBitsPerSecond = (elapsed > 0) ? static_cast<double>(report.bytesSent) * 8.0 / elapsed : 0;
+    m_intervalLatency.DrainInto(m_totalLatency);
+    report.packetsReceived = m_packetsReceived.load();
+    report.bytesReceived = m_bytesReceived.load();
+    report.replySequences = m_replySequences.GetTotals();
+
+    return report;
+}
+
+void UdpLoadGenerator::ReportInterval(double intervalSeconds) {
+    uint64_t received = m_intervalPacketsReceived.exchange(0, std::memory_order_relaxed);
+    SLLOG_INFO("UdpLoadGenerator - Sent %.0f pps, received %.0f pps, RTT: %s",
+               static_cast<double>(m_intervalPacketsSent) / intervalSeconds, static_cast<double>(received) / intervalSeconds,
+               m_intervalLatency.Summary().c_str());
+    SLLOG_INFO("UdpLoadGenerator - Replies: %s", m_replySequences.GetTotals().Summary().c_str());
+    m_intervalPacketsSent = 0;
+    m_intervalLatency.DrainInto(m_totalLatency);
+}
+
+const LatencyHistogram& UdpLoadGenerator::GetLatency() const {
+    return m_totalLatency;
+}
+
+void UdpLoadGenerator::NewUdpPacketBatchCallback(std::vector<PacketView>& batch) {
+    uint64_t bytes = 0;
+    uint64_t nowNs = MonotonicNowNs();
+    for (const PacketView& packet : batch) {
+        bytes += packet.Size();
+
+        WireHeader header;
+        if (DecodeWireHeader(packet.Data(), packet.Size(), header) && header.type == WireMessageType::EPong) {
+            // A send time in the future (another host's clock, or a forged Pong) gives no round-trip time
+            if (nowNs >= header.sendTimeNs) {
+                m_intervalLatency.Record(nowNs - header.sendTimeNs);
+            }
+            m_replySequences.Track(header.flowId, header.sequence);
+        }
+    }
+    m_packetsReceived.fetch_add(batch.size(), std::memory_order_relaxed);
+    m_intervalPacketsReceived.fetch_add(batch.size(), std::memory_order_relaxed);
+    m_bytesReceived.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void UdpLoadGenerator::LogReport(const UdpLoadGeneratorReport& report) const {
+    auto percentage = [](double achieved, double target) { return (target > 0) ? 100.0 * achieved / target : 0.0; };
+
+    SLLOG_INFO("UdpLoadGenerator - Duration:  %.3f s", report.elapsedSeconds);
+    SLLOG_INFO("UdpLoadGenerator - Target:    %.0f pps, %.3f Mbit/s",
+               report.targetPacketsPerSecond, report.targetBitsPerSecond / 1e6);
+    SLLOG_INFO("UdpLoadGenerator - Achieved:  %.0f pps (%.1f%%), %.3f Mbit/s (%.1f%%)",
+               report.achievedPacketsPerSecond, percentage(report.achievedPacketsPerSecond, report.targetPacketsPerSecond),
+               report.achievedBitsPerSecond / 1e6, percentage(report.achievedBitsPerSecond, report.targetBitsPerSecond));
+    SLLOG_INFO("UdpLoadGenerator - Sent:      %llu datagrams, %llu dropped on send",
+               static_cast<unsigned long long>(report.packetsSent), static_cast<unsigned long long>(report.sendDrops));
+    SLLOG_INFO("UdpLoadGenerator - Unsent:    %llu datagrams due but not sent, %llu burst(s) cut short",
+               static_cast<unsigned long long>(report.unsentDatagrams), static_cast<unsigned long long>(report.incompleteBursts));
+    SLLOG_INFO("UdpLoadGenerator - Received:  %llu datagrams, %llu bytes",
+               static_cast<unsigned long long>(report.packetsReceived), static_cast<unsigned long long>(report.bytesReceived));
+    SLLOG_INFO("UdpLoadGenerator - Replies:   %s", report.replySequences.Summary().c_str());
+    SLLOG_INFO("UdpLoadGenerator - RTT:       %s", m_totalLatency.Summary().c_str());
+}
+
+} // namespace hek
@@ -4,20 +4,86 @@
 *
 *****************************************************************************/
 #include "udp_server_tester.hpp"
+#include "latency_probe.hpp"
+#include "wire_protocol.hpp"
 #include "sl_log.hpp"
 #include <arpa/inet.h>
+#include <cstring>
+#include <string>
 
 namespace hek {
 
-UdpServerTester::UdpServerTester(uint16_t port, const std::string& ipAddress) {
+static constexpr size_t RECEIVE_BUFFER_SIZE = 2048;
+static constexpr size_t RECEIVE_BATCH_SIZE = 32;
+
+static uint64_t SenderKey(const sockaddr_in& senderAddr) {
+    return (static_cast<uint64_t>(senderAddr.sin_addr.s_addr) << 16) | senderAddr.sin_port;
+}
+
+UdpServerWorkerPool::UdpServerWorkerPool(UdpServerTester& server, size_t workerCount)
+    : AsyncHandlerPool(workerCount), m_server(server) {
+}
+
+UdpServerWorkerPool::~UdpServerWorkerPool() {
+    // Stop the workers before this child is destructed, see AsyncHandler::HandleTriggerAction()
+    Stop();
+}
+
+void UdpServerWorkerPool::Trigger(struct CallbackAction&& action, uint64_t orderingKey) {
+    TriggerHandlerThread(std::move(action), orderingKey);
+}
+
+void UdpServerWorkerPool::HandleTriggerAction( struct CallbackAction &action ) {
+    m_server.HandleTriggerAction(action);
+}
+
+void UdpServerWorkerPool::HandleTriggerActionsDone() {
+    m_server.HandleTriggerActionsDone();
+}
+
+UdpServerTesterOptions UdpServerTester::DefaultOptions() {
+    UdpServerTesterOptions options;
+    options.socketOptions.bufferSize = RECEIVE_BUFFER_SIZE;
+    options.socketOptions.batchSize = RECEIVE_BATCH_SIZE;
+    return options;
+}
+
+UdpServerTester::UdpServerTester(uint16_t port, const std::string& ipAddress)
+    : UdpServerTester(port, DefaultOptions(), ipAddress) {
+}
+
+UdpServerTester::UdpServerTester(uint16_t port, const UdpServerTesterOptions& options, const std::string& ipAddress)
+    : m_Socket(options.socketOptions), m_sequenceTrackers(options.sequenceTrackers),
+      m_latencyStages(options.latencyStages), m_handledCount(0) {
     hek::SLLog::LogInfo( "UdpServerTester::UdpServerTester - Enter constructor" );
 
+    SetQueueCapacity(options.handlerQueueCapacity, options.overflowPolicy);
+    SetDispatchMode(options.dispatchMode);
+
+    ThreadConfig handlerThread = options.handlerThread;
+    if (options.handlerOnCacheSibling) {
+        handlerThread = PinToCacheSibling(handlerThread, options.socketOptions.receiverThread);
+    }
+    SetHandleThreadConfig(handlerThread);
+
+    if (options.handlerWorkers > 1 && options.dispatchMode == DispatchMode::EHandleThread) {
+        m_workerPool = std::make_unique<UdpServerWorkerPool>(*this, options.handlerWorkers);
+        m_workerPool->SetQueueCapacity(options.handlerQueueCapacity, options.overflowPolicy);
+        m_workerPool->SetWorkerThreadConfig(handlerThread);
+    }
+
     if (m_Socket.Init(port, ipAddress) != 0) {
         hek::SLLog::LogError("UdpServerTester::UdpServerTester - ERROR! Failed to initialize server socket for port " + std::to_string(port));
         return;
     } else {
         hek::SLLog::LogInfo("UdpServerTester::UdpServerTester - Successfully initialized server socket for port " + std::to_string(port));
 
+        // The Pings are queued either for the handle thread or for the worker pool
+        if (m_workerPool) {
+            m_workerPool->ExportQueueMetrics(m_Socket.GetMetricLabels());
+        } else {
+            ExportQueueMetrics(m_Socket.GetMetricLabels());
+        }
         m_Socket.RegisterObserver(this);
         m_Socket.StartReading();
     }
@@ -26,26 +92,55 @@ UdpServerTester::UdpServerTester(uint16_t port, const std::string& ipAddress) {
 UdpServerTester::~UdpServerTester() {
     SLLog::LogInfo( "UdpServerTester::~UdpServerTester - Enter destructor");
 
-    // First stop the Parent
-    hek::AsyncHandler< struct CallbackAction >::Stop();
-
+    // First stop receiving, so no more Pings are handed to the handler or the worker pool (and no packet
+    // outlives the socket's packet pool in their queues)
     m_Socket.StopReading();
+
+    // Then stop the Parent and the worker pool
+    hek::AsyncHandler< struct CallbackAction, SpscRing< struct CallbackAction > >::Stop();
+    AsyncHandlerStats stats = m_workerPool ? m_workerPool->GetQueueStats() : GetQueueStats();
+    m_workerPool.reset();
+
+    SLLog::LogInfo("UdpServerTester::~UdpServerTester - Handler queue high-water mark: " +
+                   std::to_string(stats.queueDepthHighWaterMark) + ", dropped Pings: " + std::to_string(stats.droppedActions));
 }
 
 
-void UdpServerTester::NewUdpDataCallback(const std::string& data, const sockaddr_in& senderAddr) {
-    // Trigger this action to be handled on a different thread, so this callback can return immediately
+void UdpServerTester::NewUdpPacketCallback(PacketView&& packet) {
+    // Trigger this action to be handled on a different thread, so this callback can return immediately.
+    // The packet buffer is handed over as is, without copying the payload.
     CallbackAction action;
     action.type = CallbackType::EUdpDataAvailable;
-    action.data = data;
-    action.senderAddr = senderAddr;
-    TriggerHandlerThread( action );
+    action.packet = std::move(packet);
+
+    if (m_workerPool) {
+        // Keep the Pings of one sender in order, spread different senders over the workers
+        uint64_t orderingKey = SenderKey(action.packet.SenderAddr());
+        m_workerPool->Trigger(std::move(action), orderingKey);
+    } else {
+        TriggerHandlerThread( std::move(action) );
+    }
+}
+
+void UdpServerTester::NewUdpPacketBatchCallback(std::vector<PacketView>& batch) {
+    if (GetDispatchMode() != DispatchMode::EInline) {
+        for (PacketView& packet : batch) {
+            NewUdpPacketCallback(std::move(packet));
+        }
+        return;
+    }
+
+    // Run to completion on the receiver thread: answer the whole batch, then send its Pongs with one sendmmsg()
+    for (PacketView& packet : batch) {
+        HandleUdpData(packet);
+    }
+    m_Socket.FlushData();
 }
 
 void UdpServerTester::HandleTriggerAction( struct CallbackAction &action ) {
     switch ( action.type ) {
     case CallbackType::EUdpDataAvailable: {
-        HandleUdpData(action.data, action.senderAddr);
+        HandleUdpData(action.packet);
         break;
     }
     default:
@@ -53,12 +148,76 @@ void UdpServerTester::HandleTriggerAction( struct CallbackAction &action ) {
     }
 }
 
-void UdpServerTester::HandleUdpData(const std::string& data, const sockaddr_in& senderAddr) {
-    std::cout << "================================================================================" << std::endl;
-    std::cout << "Received " << data.size() << " bytes from "
-              << inet_ntoa(senderAddr.sin_addr) << ":" << ntohs(senderAddr.sin_port) << ": " << data << std::endl;
+void UdpServerTester::HandleTriggerActionsDone() {
+    // Send all Pongs queued while handling this burst with a single sendmmsg()
+    m_Socket.FlushData();
+}
+
+uint64_t UdpServerTester::GetHandledCount() const {
+    return m_handledCount.load(std::memory_order_relaxed);
+}
 
-    m_Socket.WriteData("Pong!", senderAddr);
+const LatencyHistogram& UdpServerTester::GetTxLatency() const {
+    return m_Socket.GetTxLatency();
+}
+
+void UdpServerTester::HandleUdpData(PacketView& packet) {
+    const sockaddr_in& senderAddr = packet.SenderAddr();
+    m_handledCount.fetch_add(1, std::memory_order_relaxed);
+
+    // All receive timestamps are CLOCK_REALTIME based; a clock step may make a stage "negative"
+    uint64_t handleTimeNs = 0;
+    bool timed = m_latencyStages && packet.KernelRxTimeNs() != 0;
+    if (timed) {
+        handleTimeNs = RealtimeNowNs();
+        if (packet.ReadTimeNs() >= packet.KernelRxTimeNs() && handleTimeNs >= packet.ReadTimeNs()) {
+            m_latencyStages->socketQueue.Record(packet.ReadTimeNs() - packet.KernelRxTimeNs());
+            m_latencyStages->handlerQueue.Record(handleTimeNs - packet.ReadTimeNs());
+        } else {
+            timed = false;
+        }
+    }
+
+    WireHeader header;
+    bool isPing = DecodeWireHeader(packet.Data(), packet.Size(), header) && header.type == WireMessageType::EPing;
+    if (isPing && m_sequenceTrackers) {
+        m_sequenceTrackers->Track(SenderKey(senderAddr), header.sequence);
+    }
+
+    if (SLLog::IsEnabled(LogLevel::EInfo)) {
+        char senderIp[INET_ADDRSTRLEN];
+        inet_ntop(AF_INET, &senderAddr.sin_addr, senderIp, sizeof(senderIp));
+        SLLOG_INFO("Received %zu bytes from %s:%u: %s flow=%u seq=%llu", packet.Size(), senderIp, ntohs(senderAddr.sin_port),
+                   isPing ? "Ping" : "unknown", header.flowId, static_cast<unsigned long long>(header.sequence));
+    }
+
+    if (isPing && packet.IsUnique()) {
+        // Echo in place: the Ping becomes its own Pong and goes back out of the receive buffer, without a copy
+        SetWireMessageType(packet.MutableData(), WireMessageType::EPong);
+        m_Socket.QueueData(packet, senderAddr);
+    } else if (isPing) {
+        // The buffer is shared, eg with another observer of the socket or with the other GRO segments: never
+        // write into it, answer from a copy instead
+        PacketView pong = PacketView::Allocate(m_Socket.GetPacketPool(), packet.Size());
+        if (!pong.Empty() && pong.Capacity() >= packet.Size()) {
+            std::memcpy(pong.MutableData(), packet.Data(), packet.Size());
+            SetWireMessageType(pong.MutableData(), WireMessageType::EPong);
+            m_Socket.QueueData(pong, senderAddr);
+        } else {
+            // Pool exhausted: off the hot path, through a heap copy
+            std::string pongData(packet.AsStringView());
+            SetWireMessageType(reinterpret_cast<uint8_t*>(pongData.data()), WireMessageType::EPong);
+            m_Socket.QueueData(pongData, senderAddr);
+        }
+    } else {
+        // Not our protocol (eg netcat): a plain answer, off the hot path
+        m_Socket.QueueData("Pong!", senderAddr);
+    }
+
+    uint64_t doneTimeNs = timed ? RealtimeNowNs() : 0;
+    if (doneTimeNs >= handleTimeNs && timed) {
+        m_latencyStages->processing.Record(doneTimeNs - handleTimeNs);
+    }
 }
 
 
@@ -5,22 +5,114 @@
 *****************************************************************************/
 
 #include "udp_socket.hpp"
+#include "io_uring.hpp"
 #include "sl_log.hpp"
+#include "latency_probe.hpp"
+#include "spsc_ring.hpp"
 #include <arpa/inet.h>
+#include <algorithm>
 #include <functional>
 #include <fcntl.h>
 #include <ifaddrs.h>
+#include <linux/errqueue.h>
+#include <linux/filter.h>
+#include <linux/net_tstamp.h>
+#include <linux/sock_diag.h>
+#include <netinet/udp.h>
+#include <poll.h>
 
 
 namespace hek {
 
-UdpSocket::UdpSocket(size_t bufferSize)
-    : m_running(false), m_socketFd(-1), m_receiveBuffer(bufferSize, 0), m_bufferSize(bufferSize) {
-    SLLog::LogInfo("UdpSocket::UdpSocket - Constructed");
+// io_uring engine: submission/completion queue sizes, and the number of sends that may be in flight
+static constexpr unsigned RING_ENTRIES = 256;
+static constexpr unsigned RING_COMPLETION_ENTRIES = 4096;
+static constexpr size_t RING_SEND_SLOTS = 1024;
+static constexpr size_t RING_SEND_BATCH = 64;
+static constexpr size_t MAX_RING_BUFFERS = 4096;
+static constexpr size_t RING_REFILL_BATCH = 64;
+static constexpr uint16_t RING_BUFFER_GROUP = 0;
+static constexpr int RING_SHUTDOWN_POLLS = 100;
+static constexpr int RING_SHUTDOWN_POLL_MS = 10;
+
+// The top byte of a request's user_data tells what it is; sends carry their slot in the low bits
+static constexpr uint64_t RING_TAG_MASK = 0xffULL << 56;
+static constexpr uint64_t RING_RECEIVE = 1ULL << 56;
+static constexpr uint64_t RING_SEND = 2ULL << 56;
+static constexpr uint64_t RING_WAKE = 3ULL << 56;
+static constexpr uint64_t RING_POLL = 4ULL << 56;
+static constexpr uint64_t RING_CANCEL = 5ULL << 56;
+
+// Adaptive receive buffer: look at the receive queue every this many datagrams
+static constexpr uint64_t RECEIVE_BUFFER_CHECK_INTERVAL = 1024;
+
+// The kernel puts a header, the sender address and the control messages in front of every payload
+static constexpr size_t RING_RECEIVE_HEADER_SIZE = sizeof(io_uring_recvmsg_out) + sizeof(sockaddr_in);
+
+static UdpSocketOptions MakeOptions(size_t bufferSize, size_t batchSize) {
+    UdpSocketOptions options;
+    options.bufferSize = bufferSize;
+    options.batchSize = batchSize;
+    return options;
+}
+
+UdpSocket::UdpSocket(size_t bufferSize, size_t batchSize)
+    : UdpSocket(MakeOptions(bufferSize, batchSize)) {
+}
+
+UdpSocket::UdpSocket(const UdpSocketOptions& options)
+    : m_eventLoop(nullptr), m_running(false), m_options(options), m_socketFd(-1), m_bufferSize(options.bufferSize),
+      m_receiveDrops(0), m_sendDrops(0), m_kernelDrops(0), m_truncatedDatagrams(0),
+      m_receiveBufferBytes(0), m_adaptKernelDrops(0), m_adaptReceivedPackets(0), m_batchSize(std::max<size_t>(options.batchSize, 1)), m_receivedPackets(0),
+      m_rxTimestamps(false), m_gro(false), m_gsoSupported(true),
+      m_txTimestamps(false), m_txNextId(0), m_ringReading(false), m_ringReceiveActive(false), m_ringPollActive(false),
+      m_ringReceiveHeader{}, m_ringBufferSize(0), m_sendBatchSize(m_batchSize), m_sendQueued(0) {
+    if (m_options.gro) {
+        m_bufferSize = std::max(m_bufferSize, MAX_GRO_BUFFER_SIZE);
+    }
+
+    // io_uring receives into whole pool buffers, behind the header the kernel writes in front of the payload
+    size_t poolBufferSize = m_bufferSize;
+    if (m_options.ioEngine == IoEngine::EIoUring) {
+        m_ringBufferSize = m_bufferSize + RING_RECEIVE_HEADER_SIZE + sizeof(ControlBuffer);
+        poolBufferSize = m_ringBufferSize;
+    }
+
+    m_packetPool = m_options.packetPool;
+    if (m_packetPool && m_packetPool->BufferSize() < poolBufferSize) {
+        SLLog::LogWarn("UdpSocket::UdpSocket - Shared packet pool buffers are too small, using a private pool");
+        m_packetPool.reset();
+    }
+    if (!m_packetPool) {
+        PacketPoolOptions poolOptions;
+        poolOptions.bufferSize = poolBufferSize;
+        poolOptions.buffersPerSlab = std::max(m_options.receiveBufferCount, m_batchSize);
+        poolOptions.maxBuffers = std::max(m_options.maxReceiveBufferCount, poolOptions.buffersPerSlab);
+        poolOptions.useHugePages = m_options.useHugePages;
+        m_packetPool = std::make_shared<PacketPool>(poolOptions);
+    }
+    m_dropBuffer.resize(m_bufferSize, 0);
+
+    m_batchHeaders.resize(m_batchSize);
+    m_batchIovecs.resize(m_batchSize);
+    m_batchAddrs.resize(m_batchSize);
+    m_batchBuffers.resize(m_batchSize);
+    m_packets.reserve(m_batchSize);
+    m_clonedPackets.reserve(m_batchSize);
+
+    if (m_batchSize > 1) {
+        m_sendPackets.resize(m_batchSize);
+        m_sendAddrs.resize(m_batchSize);
+        m_sendHeaders.resize(m_batchSize);
+        m_sendIovecs.resize(m_batchSize);
+    }
+
+    SLLog::LogInfo("UdpSocket::UdpSocket - Constructed (batch size: " + std::to_string(m_batchSize) + ")");
 }
 
 UdpSocket::~UdpSocket() {
     StopReading();
+    ShutdownIoUring();
     if (m_socketFd != -1) {
         close(m_socketFd);
     }
@@ -48,15 +140,65 @@ int UdpSocket::Init(uint16_t port, const std::string& ipAddress) {
 
     m_socketAddress.sin_port = htons(port);
 
+    // The socket is driven by an (edge-agnostic) event loop and drained until EAGAIN
+    int flags = fcntl(m_socketFd, F_GETFL, 0);
+    if (flags == -1 || fcntl(m_socketFd, F_SETFL, flags | O_NONBLOCK) == -1) {
+        SLLog::LogError("Failed to make UDP socket non-blocking: " + std::string(strerror(errno)));
+        close(m_socketFd);
+        m_socketFd = -1;
+        return -1;
+    }
+
+    if (m_options.rxTimestamps || m_options.txTimestamps) {
+        // Not fatal: packets simply carry no kernel timestamps
+        EnableTimestamps();
+    }
+
+    if (m_options.gro) {
+        // Not fatal: the kernel then simply delivers the datagrams one by one
+        EnableGro();
+    }
+
+    if (m_options.busyPollBudget.count() > 0) {
+        // Not fatal either: the receiver thread still spins, only the device queue is not polled
+        EnableBusyPoll();
+    }
+
+    // Not fatal: the system defaults (or limits) apply
+    ConfigureSocketBuffers();
+
+    // Not fatal: the kernel drop count just stays zero
+    EnableKernelDropCount();
+
+    if (m_options.ioEngine == IoEngine::EIoUring) {
+        // Not fatal: falls back to the epoll engine
+        InitIoUring();
+    }
+
     // "bind" is only required for SERVER Sockets
     if (ipAddress.empty()) {
         // SERVER Socket
+        if (m_options.reusePort) {
+            int enable = 1;
+            if (setsockopt(m_socketFd, SOL_SOCKET, SO_REUSEPORT, &enable, sizeof(enable)) == -1) {
+                SLLog::LogError("Failed to set SO_REUSEPORT: " + std::string(strerror(errno)));
+                close(m_socketFd);
+                m_socketFd = -1;
+                return -1;
+            }
+        }
+
         if (bind(m_socketFd, reinterpret_cast<struct sockaddr*>(&m_socketAddress), sizeof(m_socketAddress)) == -1) {
             SLLog::LogError("Failed to bind UDP socket: " + std::string(strerror(errno)));
             close(m_socketFd);
             m_socketFd = -1;
             return -1;
         }
+        if (m_options.reusePort && m_options.reusePortSteeringGroupSize > 0) {
+            // Not fatal: without the program the kernel falls back to its 4-tuple hash
+            AttachReusePortSteering();
+        }
+
         SLLog::LogInfo("UdpSocket::Init - Successfully initialized SERVER Socket - bound to IP: " +
                        (ipAddress.empty() ? "INADDR_ANY" : ipAddress) + " and port: " + std::to_string(port));
     } else {
@@ -64,9 +206,667 @@ int UdpSocket::Init(uint16_t port, const std::string& ipAddress) {
         SLLog::LogInfo("UdpSocket::Init - Successfully initialized CLIENT Socket - port: " + std::to_string(port));
     }
 
+    RegisterMetrics();
+    return 0;
+}
+
+void UdpSocket::RegisterMetrics() {
+    char address[INET_ADDRSTRLEN] = {};
+    inet_ntop(AF_INET, &m_socketAddress.sin_addr, address, sizeof(address));
+    bool server = (m_socketAddress.sin_addr.s_addr == INADDR_ANY);
+    m_metricLabels = "fd=\"" + std::to_string(m_socketFd) + "\",role=\"" + (server ? "server" : "client") +
+                     "\",address=\"" + address + ":" + std::to_string(ntohs(m_socketAddress.sin_port)) + "\"";
+
+    MetricsRegistry& registry = MetricsRegistry::Default();
+    m_metrics.receivedDatagrams = registry.AddCounter("udp_socket_received_datagrams_total", "Datagrams received", m_metricLabels);
+    m_metrics.receivedBytes = registry.AddCounter("udp_socket_received_bytes_total", "Payload bytes received", m_metricLabels);
+    m_metrics.receiveErrors = registry.AddCounter("udp_socket_receive_errors_total", "Failed receive calls", m_metricLabels);
+    m_metrics.sentDatagrams = registry.AddCounter("udp_socket_sent_datagrams_total", "Datagrams sent", m_metricLabels);
+    m_metrics.sentBytes = registry.AddCounter("udp_socket_sent_bytes_total", "Payload bytes sent", m_metricLabels);
+    m_metrics.sendErrors = registry.AddCounter("udp_socket_send_errors_total",
+                                               "Failed send calls, other than a full send buffer", m_metricLabels);
+
+    m_metrics.callbacks.push_back(registry.AddCallback(
+        "udp_socket_send_drops_total", "Datagrams dropped because the send buffer was full", MetricType::ECounter,
+        m_metricLabels, [this] { return GetSendDrops(); }));
+    m_metrics.callbacks.push_back(registry.AddCallback(
+        "udp_socket_pool_drops_total", "Datagrams dropped because the packet pool was exhausted", MetricType::ECounter,
+        m_metricLabels, [this] { return m_receiveDrops.load(std::memory_order_relaxed); }));
+    m_metrics.callbacks.push_back(registry.AddCallback(
+        "udp_socket_kernel_drops_total", "Datagrams dropped by the kernel on a full receive buffer (SO_RXQ_OVFL)",
+        MetricType::ECounter, m_metricLabels, [this] { return GetKernelDrops(); }));
+    m_metrics.callbacks.push_back(registry.AddCallback(
+        "udp_socket_truncated_datagrams_total", "Datagrams dropped because they were larger than the receive buffer",
+        MetricType::ECounter, m_metricLabels, [this] { return GetTruncatedDatagrams(); }));
+    m_metrics.callbacks.push_back(registry.AddCallback(
+        "udp_socket_receive_buffer_bytes", "Size of the kernel receive buffer (SO_RCVBUF)", MetricType::EGauge,
+        m_metricLabels, [this] { return static_cast<uint64_t>(std::max(GetReceiveBufferSize(), 0)); }));
+    m_metrics.callbacks.push_back(registry.AddCallback(
+        "packet_pool_buffers_in_use", "Packet pool buffers referenced by a packet", MetricType::EGauge,
+        m_metricLabels, [this] { return m_packetPool->GetStats().buffersInUse; }));
+    m_metrics.callbacks.push_back(registry.AddCallback(
+        "packet_pool_exhaustions_total", "Packet pool allocations that failed", MetricType::ECounter,
+        m_metricLabels, [this] { return m_packetPool->GetStats().exhaustions; }));
+}
+
+int UdpSocket::AttachReusePortSteering() {
+    // return (CPU id % group size): the index of the socket in the reuseport group, in bind() order
+    struct sock_filter code[] = {
+        { BPF_LD | BPF_W | BPF_ABS, 0, 0, static_cast<uint32_t>(SKF_AD_OFF + SKF_AD_CPU) },
+        { BPF_ALU | BPF_MOD | BPF_K, 0, 0, m_options.reusePortSteeringGroupSize },
+        { BPF_RET | BPF_A, 0, 0, 0 },
+    };
+    struct sock_fprog program = {};
+    program.len = sizeof(code) / sizeof(code[0]);
+    program.filter = code;
+
+    if (setsockopt(m_socketFd, SOL_SOCKET, SO_ATTACH_REUSEPORT_CBPF, &program, sizeof(program)) == -1) {
+        SLLog::LogWarn("UdpSocket::AttachReusePortSteering - SO_ATTACH_REUSEPORT_CBPF failed: " +
+                       std::string(strerror(errno)));
+        return -1;
+    }
+
     return 0;
 }
 
+void UdpSocket::EnableTimestamps() {
+    int flags = SOF_TIMESTAMPING_SOFTWARE;
+    if (m_options.rxTimestamps) {
+        flags |= SOF_TIMESTAMPING_RX_SOFTWARE;
+    }
+    if (m_options.txTimestamps) {
+        // Number the datagrams, and loop back only the timestamp rather than a copy of every datagram
+        flags |= SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_OPT_ID | SOF_TIMESTAMPING_OPT_TSONLY;
+    }
+
+    if (setsockopt(m_socketFd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) == 0) {
+        m_rxTimestamps = m_options.rxTimestamps;
+        m_txTimestamps = m_options.txTimestamps;
+    } else {
+        SLLog::LogWarn("UdpSocket::EnableTimestamps - SO_TIMESTAMPING failed: " + std::string(strerror(errno)));
+
+        // Receive timestamps only
+        int enable = 1;
+        if (m_options.rxTimestamps) {
+            if (setsockopt(m_socketFd, SOL_SOCKET, SO_TIMESTAMPNS, &enable, sizeof(enable)) == 0) {
+                m_rxTimestamps = true;
+            } else {
+                SLLog::LogWarn("UdpSocket::EnableTimestamps - SO_TIMESTAMPNS failed: " + std::string(strerror(errno)));
+            }
+        }
+    }
+
+    if (m_rxTimestamps && m_batchControl.empty()) {
+        m_batchControl.resize(m_batchSize);
+    }
+    if (m_txTimestamps) {
+        m_txSendTimes.reset(new std::atomic<uint64_t>[TX_TIMESTAMP_SLOTS]());
+    }
+}
+
+void UdpSocket::EnableBusyPoll() {
+    // Raising SO_BUSY_POLL above net.core.busy_read needs CAP_NET_ADMIN
+    int busyPollMicros = static_cast<int>(m_options.busyPollBudget.count());
+    if (setsockopt(m_socketFd, SOL_SOCKET, SO_BUSY_POLL, &busyPollMicros, sizeof(busyPollMicros)) == -1) {
+        SLLog::LogWarn("UdpSocket::EnableBusyPoll - SO_BUSY_POLL failed: " + std::string(strerror(errno)));
+    }
+
+    int enable = 1;
+    if (setsockopt(m_socketFd, SOL_SOCKET, SO_PREFER_BUSY_POLL, &enable, sizeof(enable)) == -1) {
+        SLLog::LogWarn("UdpSocket::EnableBusyPoll - SO_PREFER_BUSY_POLL failed: " + std::string(strerror(errno)));
+    }
+}
+
+void UdpSocket::EnableGro() {
+    int enable = 1;
+    if (setsockopt(m_socketFd, SOL_UDP, UDP_GRO, &enable, sizeof(enable)) == -1) {
+        SLLog::LogWarn("UdpSocket::EnableGro - UDP_GRO failed: " + std::string(strerror(errno)));
+        return;
+    }
+
+    m_gro = true;
+    if (m_batchControl.empty()) {
+        m_batchControl.resize(m_batchSize);
+    }
+}
+
+void UdpSocket::ConfigureSocketBuffers() {
+    const SocketBufferSizes& sizes = m_options.socketBuffers;
+    if (sizes.receiveBytes > 0) {
+        int bytes = SetSocketBufferSize(SO_RCVBUF, SO_RCVBUFFORCE, sizes.receiveBytes);
+        if (bytes < sizes.receiveBytes) {
+            SLLog::LogWarn("UdpSocket::ConfigureSocketBuffers - Receive buffer is " + std::to_string(bytes) + " instead of " +
+                           std::to_string(sizes.receiveBytes) + " bytes; raise net.core.rmem_max or run with CAP_NET_ADMIN");
+        }
+    }
+    if (sizes.sendBytes > 0) {
+        int bytes = SetSocketBufferSize(SO_SNDBUF, SO_SNDBUFFORCE, sizes.sendBytes);
+        if (bytes < sizes.sendBytes) {
+            SLLog::LogWarn("UdpSocket::ConfigureSocketBuffers - Send buffer is " + std::to_string(bytes) + " instead of " +
+                           std::to_string(sizes.sendBytes) + " bytes; raise net.core.wmem_max or run with CAP_NET_ADMIN");
+        }
+    }
+
+    // The adaptive receive buffer starts from whatever the kernel gave us
+    m_receiveBufferBytes = GetReceiveBufferSize() / 2;
+}
+
+int UdpSocket::SetSocketBufferSize(int option, int forceOption, int bytes) {
+    // The FORCE variant is not capped by net.core.rmem_max/wmem_max, but needs CAP_NET_ADMIN
+    if (setsockopt(m_socketFd, SOL_SOCKET, forceOption, &bytes, sizeof(bytes)) == -1 &&
+        setsockopt(m_socketFd, SOL_SOCKET, option, &bytes, sizeof(bytes)) == -1) {
+        return -1;
+    }
+
+    // The kernel doubles the size, to leave room for its bookkeeping overhead
+    int actual = 0;
+    socklen_t length = sizeof(actual);
+    if (getsockopt(m_socketFd, SOL_SOCKET, option, &actual, &length) == -1) {
+        return -1;
+    }
+    return actual / 2;
+}
+
+void UdpSocket::AdaptReceiveBuffer() {
+    int maxBytes = m_options.socketBuffers.maxReceiveBytes;
+    if (m_receiveBufferBytes >= maxBytes) {
+        return;
+    }
+
+    // Grow on new kernel drops right away, otherwise look at the receive queue every so many datagrams
+    uint64_t kernelDrops = m_kernelDrops.load(std::memory_order_relaxed);
+    bool dropped = (kernelDrops != m_adaptKernelDrops);
+    if (!dropped && m_receivedPackets - m_adaptReceivedPackets < RECEIVE_BUFFER_CHECK_INTERVAL) {
+        return;
+    }
+    m_adaptKernelDrops = kernelDrops;
+    m_adaptReceivedPackets = m_receivedPackets;
+
+    if (!dropped) {
+        // Memory of the datagrams waiting in the receive queue against its limit, both including the overhead.
+        // Called before the socket is drained, so this is the backlog that built up since the last read.
+        uint32_t memInfo[SK_MEMINFO_VARS] = {};
+        socklen_t length = sizeof(memInfo);
+        if (getsockopt(m_socketFd, SOL_SOCKET, SO_MEMINFO, memInfo, &length) == -1 ||
+            memInfo[SK_MEMINFO_RMEM_ALLOC] * 2 <= memInfo[SK_MEMINFO_RCVBUF]) {
+            return;
+        }
+    }
+
+    int wanted = static_cast<int>(std::min<int64_t>(static_cast<int64_t>(m_receiveBufferBytes) * 2, maxBytes));
+    int bytes = SetSocketBufferSize(SO_RCVBUF, SO_RCVBUFFORCE, wanted);
+    if (bytes <= m_receiveBufferBytes) {
+        SLLog::LogWarn("UdpSocket::AdaptReceiveBuffer - Cannot grow the receive buffer beyond " +
+                       std::to_string(m_receiveBufferBytes) + " bytes; raise net.core.rmem_max or run with CAP_NET_ADMIN");
+        m_receiveBufferBytes = maxBytes;
+        return;
+    }
+
+    SLLog::LogWarn("UdpSocket::AdaptReceiveBuffer - " +
+                   std::string(dropped ? "Kernel dropped datagrams" : "Receive queue more than half full") +
+                   ", grew the receive buffer from " + std::to_string(m_receiveBufferBytes) + " to " +
+                   std::to_string(bytes) + " bytes");
+    m_receiveBufferBytes = bytes;
+}
+
+void UdpSocket::CountTruncatedDatagram(size_t datagramSize) {
+    uint64_t truncated = ++m_truncatedDatagrams;
+
+    // Log each time the total reaches a power of two
+    if ((truncated & (truncated - 1)) == 0) {
+        SLLog::LogWarn("UdpSocket::CountTruncatedDatagram - Dropped " + std::to_string(truncated) +
+                       " datagram(s) larger than the receive buffer of " + std::to_string(m_bufferSize) +
+                       " bytes so far, the last one of " + std::to_string(datagramSize) + " bytes");
+    }
+}
+
+void UdpSocket::EnableKernelDropCount() {
+    int enable = 1;
+    if (setsockopt(m_socketFd, SOL_SOCKET, SO_RXQ_OVFL, &enable, sizeof(enable)) == -1) {
+        SLLog::LogWarn("UdpSocket::EnableKernelDropCount - SO_RXQ_OVFL failed: " + std::string(strerror(errno)));
+        return;
+    }
+
+    // The kernel only adds the control message once it has dropped something
+    if (m_batchControl.empty()) {
+        m_batchControl.resize(m_batchSize);
+    }
+}
+
+void UdpSocket::ParseReceiveControl(msghdr& hdr, uint64_t& kernelRxTimeNs, size_t& groSegmentSize, uint32_t& kernelDrops) {
+    kernelRxTimeNs = 0;
+    groSegmentSize = 0;
+    kernelDrops = 0;
+
+    for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+        // SCM_TIMESTAMPING carries the software timestamp in the first of its three timespecs
+        if (cmsg->cmsg_level == SOL_SOCKET && (cmsg->cmsg_type == SCM_TIMESTAMPING || cmsg->cmsg_type == SCM_TIMESTAMPNS)) {
+            timespec timestamp;
+            std::memcpy(&timestamp, CMSG_DATA(cmsg), sizeof(timestamp));
+            kernelRxTimeNs = static_cast<uint64_t>(timestamp.tv_sec) * 1000000000ULL + static_cast<uint64_t>(timestamp.tv_nsec);
+        } else if (cmsg->cmsg_level == SOL_UDP && cmsg->cmsg_type == UDP_GRO) {
+            int segmentSize = 0;
+            std::memcpy(&segmentSize, CMSG_DATA(cmsg), sizeof(segmentSize));
+            groSegmentSize = (segmentSize > 0) ? static_cast<size_t>(segmentSize) : 0;
+        } else if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SO_RXQ_OVFL) {
+            // Drops of the socket so far, when this datagram was queued
+            std::memcpy(&kernelDrops, CMSG_DATA(cmsg), sizeof(kernelDrops));
+        }
+    }
+}
+
+void UdpSocket::AddReceivedPacket(PacketView&& packet, msghdr& hdr, uint64_t readTimeNs) {
+    uint64_t kernelRxTimeNs = 0;
+    size_t groSegmentSize = 0;
+    uint32_t kernelDrops = 0;
+    if (hdr.msg_control != nullptr) {
+        ParseReceiveControl(hdr, kernelRxTimeNs, groSegmentSize, kernelDrops);
+        if (kernelDrops != 0) {
+            m_kernelDrops.store(kernelDrops, std::memory_order_relaxed);
+        }
+    }
+    if (m_rxTimestamps) {
+        packet.SetReceiveTimes(kernelRxTimeNs, readTimeNs);
+    }
+    m_metrics.receivedBytes.Add(packet.Size());
+
+    if (groSegmentSize == 0 || packet.Size() <= groSegmentSize) {
+        ++m_receivedPackets;
+        m_metrics.receivedDatagrams.Add();
+        m_packets.push_back(std::move(packet));
+        return;
+    }
+
+    // Coalesced by GRO: every segment but the last one is exactly groSegmentSize bytes
+    size_t segments = 0;
+    for (size_t offset = 0; offset < packet.Size(); offset += groSegmentSize, ++segments) {
+        ++m_receivedPackets;
+        m_packets.push_back(packet.Slice(offset, std::min(groSegmentSize, packet.Size() - offset)));
+    }
+    m_metrics.receivedDatagrams.Add(segments);
+}
+
+void UdpSocket::StampTxSendTimes(size_t count) {
+    // Stamped before the send call: the transmit timestamp may be read before the call returns
+    uint64_t sendTimeNs = RealtimeNowNs();
+    uint32_t id = m_txNextId.load(std::memory_order_relaxed);
+    for (size_t i = 0; i < count; ++i) {
+        m_txSendTimes[(id + i) % TX_TIMESTAMP_SLOTS].store(sendTimeNs, std::memory_order_relaxed);
+    }
+}
+
+void UdpSocket::ReadErrorQueue() {
+    // Drain it completely: a non-empty error queue keeps the socket signalled with EPOLLERR
+    for (;;) {
+        alignas(cmsghdr) char control[256];
+        msghdr hdr = {};
+        hdr.msg_control = control;
+        hdr.msg_controllen = sizeof(control);
+
+        if (recvmsg(m_socketFd, &hdr, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            break;
+        }
+
+        uint64_t txTimeNs = 0;
+        bool haveId = false;
+        uint32_t id = 0;
+        for (cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr); cmsg != nullptr; cmsg = CMSG_NXTHDR(&hdr, cmsg)) {
+            if (cmsg->cmsg_level == SOL_SOCKET && cmsg->cmsg_type == SCM_TIMESTAMPING) {
+                scm_timestamping timestamps;
+                std::memcpy(&timestamps, CMSG_DATA(cmsg), sizeof(timestamps));
+                txTimeNs = static_cast<uint64_t>(timestamps.ts[0].tv_sec) * 1000000000ULL +
+                           static_cast<uint64_t>(timestamps.ts[0].tv_nsec);
+            } else if (cmsg->cmsg_level == SOL_IP && cmsg->cmsg_type == IP_RECVERR) {
+                sock_extended_err error;
+                std::memcpy(&error, CMSG_DATA(cmsg), sizeof(error));
+                if (error.ee_errno == ENOMSG && error.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+                    id = error.ee_data;
+                    haveId = true;
+                }
+            }
+        }
+
+        if (haveId && txTimeNs != 0) {
+            uint64_t sendTimeNs = m_txSendTimes[id % TX_TIMESTAMP_SLOTS].exchange(0, std::memory_order_relaxed);
+            if (sendTimeNs != 0 && txTimeNs >= sendTimeNs) {
+                m_txLatency.Record(txTimeNs - sendTimeNs);
+            }
+        }
+    }
+}
+
+void UdpSocket::InitIoUring() {
+    // Provided buffer rings hold a power of two of buffers
+    size_t bufferCount = 1;
+    while (bufferCount * 2 <= std::min(std::max(m_options.receiveBufferCount, m_batchSize), MAX_RING_BUFFERS)) {
+        bufferCount *= 2;
+    }
+
+    auto ring = std::make_unique<IoUring>();
+    int result = ring->Init(RING_ENTRIES, RING_COMPLETION_ENTRIES);
+    if (result == 0 && !ring->IsOpcodeSupported(IORING_OP_SEND_ZC)) {
+        // Multishot recvmsg has no opcode of its own; it arrived in 6.0, together with SEND_ZC
+        result = -EOPNOTSUPP;
+    }
+    if (result == 0) {
+        result = ring->RegisterBufferRing(RING_BUFFER_GROUP, static_cast<unsigned>(bufferCount));
+    }
+    if (result != 0) {
+        SLLog::LogWarn("UdpSocket::InitIoUring - io_uring not available (" + std::string(strerror(-result)) +
+                       "), falling back to epoll");
+        return;
+    }
+    if (m_options.busyPollBudget.count() > 0) {
+        SLLog::LogWarn("UdpSocket::InitIoUring - Busy polling does not apply to io_uring, ignoring it");
+    }
+
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    m_ioUring = std::move(ring);
+
+    m_ringReceiveHeader = {};
+    m_ringReceiveHeader.msg_namelen = sizeof(sockaddr_in);
+    m_ringReceiveHeader.msg_controllen = m_batchControl.empty() ? 0 : sizeof(ControlBuffer);
+
+    m_ringBuffers.assign(bufferCount, nullptr);
+    m_ringEmptyBuffers.clear();
+    for (size_t id = bufferCount; id > 0; --id) {
+        m_ringEmptyBuffers.push_back(static_cast<uint16_t>(id - 1));
+    }
+    RefillBufferRingLocked();
+
+    m_ringSends.resize(RING_SEND_SLOTS);
+    m_ringFreeSends.clear();
+    for (size_t slot = RING_SEND_SLOTS; slot > 0; --slot) {
+        m_ringFreeSends.push_back(static_cast<uint32_t>(slot - 1));
+    }
+
+    // Queued datagrams wait for FlushData(), whatever the batch size
+    m_sendBatchSize = std::max(m_batchSize, RING_SEND_BATCH);
+    m_sendPackets.resize(m_sendBatchSize);
+    m_sendAddrs.resize(m_sendBatchSize);
+
+    SLLog::LogInfo("UdpSocket::InitIoUring - Using io_uring with " + std::to_string(bufferCount) + " receive buffers");
+}
+
+void UdpSocket::ShutdownIoUring() {
+    if (!m_ioUring) {
+        return;
+    }
+
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    CancelRingRequestsLocked();
+
+    // Wait until the kernel lets go of the provided buffers and of the payloads of the sends in flight
+    for (int i = 0; i < RING_SHUTDOWN_POLLS; ++i) {
+        ReapRingCompletionsLocked(false);
+        if (!m_ringReceiveActive && !m_ringPollActive && m_ringFreeSends.size() == m_ringSends.size()) {
+            break;
+        }
+        pollfd ringPoll = { m_ioUring->Fd(), POLLIN, 0 };
+        poll(&ringPoll, 1, RING_SHUTDOWN_POLL_MS);
+    }
+
+    bool receiveDone = !m_ringReceiveActive;
+    m_ioUring.reset();
+    if (!receiveDone) {
+        // Rather leak the buffers than have the kernel write into buffers that are in use again
+        SLLog::LogWarn("UdpSocket::ShutdownIoUring - Receive not cancelled in time, leaking its buffers");
+        return;
+    }
+    for (PacketBuffer*& buffer : m_ringBuffers) {
+        if (buffer) {
+            PacketPool::Release(buffer);
+            buffer = nullptr;
+        }
+    }
+    m_ringSends.clear();
+}
+
+void UdpSocket::HandleRingEvents() {
+    {
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        ReapRingCompletionsLocked(true);
+        RefillBufferRingLocked();
+        if (m_ringReading && !m_ringReceiveActive && !m_ringPollActive) {
+            ArmRingReceiveLocked();
+        }
+    }
+
+    if (!m_packets.empty()) {
+        NotifyObservers(m_packets);
+        m_packets.clear();
+    }
+
+    // Replies queued by observers while handling these completions go out with one submission
+    FlushData();
+
+    if (m_txTimestamps) {
+        ReadErrorQueue();
+    }
+}
+
+void UdpSocket::ReapRingCompletionsLocked(bool deliver) {
+    uint64_t readTimeNs = (deliver && m_rxTimestamps) ? RealtimeNowNs() : 0;
+
+    // Post the completions still waiting for this thread, so they are handled in this same batch
+    if (m_ioUring->CompletionsPending()) {
+        m_ioUring->Submit();
+    }
+
+    for (;;) {
+        m_ioUring->ReapCompletions([&](const io_uring_cqe& cqe) {
+            uint64_t tag = cqe.user_data & RING_TAG_MASK;
+            if (tag == RING_RECEIVE) {
+                HandleRingReceive(cqe, deliver, readTimeNs);
+            } else if (tag == RING_SEND) {
+                uint32_t slot = static_cast<uint32_t>(cqe.user_data & ~RING_TAG_MASK);
+                m_ringSends[slot].packet.Release();
+                m_ringFreeSends.push_back(slot);
+                if (cqe.res >= 0) {
+                    m_metrics.sentDatagrams.Add();
+                    m_metrics.sentBytes.Add(static_cast<uint64_t>(cqe.res));
+                } else if (cqe.res == -EAGAIN || cqe.res == -ENOBUFS) {
+                    CountSendDrops(1);
+                } else {
+                    m_metrics.sendErrors.Add();
+                    SLLog::LogError("UdpSocket::FlushData - sendmsg() failed: " + std::string(strerror(-cqe.res)));
+                }
+            } else if (tag == RING_POLL) {
+                m_ringPollActive = false;
+            }
+            // RING_WAKE and RING_CANCEL completions only wake up the loop
+        });
+
+        if (!m_ioUring->CompletionsOverflowed()) {
+            break;
+        }
+        // Let the kernel move the completions it held back into the (now empty) queue
+        m_ioUring->Submit();
+    }
+}
+
+void UdpSocket::HandleRingReceive(const io_uring_cqe& cqe, bool deliver, uint64_t readTimeNs) {
+    if ((cqe.flags & IORING_CQE_F_MORE) == 0) {
+        m_ringReceiveActive = false;
+    }
+    if ((cqe.flags & IORING_CQE_F_BUFFER) == 0) {
+        // Terminated without data: out of buffers (-ENOBUFS) or cancelled. HandleRingEvents() re-arms it.
+        if (cqe.res < 0 && cqe.res != -ENOBUFS && cqe.res != -ECANCELED) {
+            m_metrics.receiveErrors.Add();
+            SLLog::LogError("UdpSocket::HandleRingReceive - recvmsg() failed: " + std::string(strerror(-cqe.res)));
+        }
+        return;
+    }
+
+    uint16_t id = static_cast<uint16_t>(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+    PacketBuffer* buffer = std::exchange(m_ringBuffers[id], nullptr);
+    m_ringEmptyBuffers.push_back(id);
+    if (!buffer) {
+        return;
+    }
+
+    // Buffer layout: io_uring_recvmsg_out, sender address, control messages, payload
+    size_t headerSize = sizeof(io_uring_recvmsg_out) + m_ringReceiveHeader.msg_namelen + m_ringReceiveHeader.msg_controllen;
+    if (!deliver || cqe.res < static_cast<int>(headerSize)) {
+        PacketPool::Release(buffer);
+        return;
+    }
+
+    io_uring_recvmsg_out out;
+    std::memcpy(&out, buffer->data, sizeof(out));
+    sockaddr_in senderAddr = {};
+    std::memcpy(&senderAddr, buffer->data + sizeof(out), std::min<size_t>(out.namelen, sizeof(senderAddr)));
+
+    msghdr hdr = {};
+    if (out.controllen > 0) {
+        hdr.msg_control = buffer->data + sizeof(out) + m_ringReceiveHeader.msg_namelen;
+        hdr.msg_controllen = out.controllen;
+    }
+
+    if (out.flags & MSG_TRUNC) {
+        // payloadlen is the datagram's full length
+        PacketPool::Release(buffer);
+        CountTruncatedDatagram(out.payloadlen);
+        return;
+    }
+
+    size_t payloadSize = std::min<size_t>(out.payloadlen, static_cast<size_t>(cqe.res) - headerSize);
+    PacketView packet(buffer, headerSize + payloadSize, senderAddr);
+    packet.Advance(headerSize);
+    AddReceivedPacket(std::move(packet), hdr, readTimeNs);
+}
+
+void UdpSocket::RefillBufferRingLocked() {
+    PacketBuffer* buffers[RING_REFILL_BATCH];
+
+    while (!m_ringEmptyBuffers.empty()) {
+        size_t wanted = std::min(m_ringEmptyBuffers.size(), RING_REFILL_BATCH);
+        size_t count = m_packetPool->Allocate(buffers, wanted);
+        for (size_t i = 0; i < count; ++i) {
+            uint16_t id = m_ringEmptyBuffers.back();
+            m_ringEmptyBuffers.pop_back();
+            m_ringBuffers[id] = buffers[i];
+            m_ioUring->AddBuffer(buffers[i]->data, buffers[i]->capacity, id);
+        }
+        if (count < wanted) {
+            break;
+        }
+    }
+
+    m_ioUring->CommitBuffers();
+}
+
+void UdpSocket::ArmRingReceiveLocked() {
+    io_uring_sqe* sqe = m_ioUring->GetSqe();
+    if (!sqe) {
+        // Retried at the next completion
+        return;
+    }
+
+    if (m_ringEmptyBuffers.size() == m_ringBuffers.size()) {
+        // All receive buffers are held by observers: drop what is waiting, like the epoll engine does, and
+        // try again when the socket has more
+        static constexpr int MAX_DROPS_PER_POLL = 64;
+        for (int i = 0; i < MAX_DROPS_PER_POLL && DropDatagram(); ++i) {
+        }
+
+        sqe->opcode = IORING_OP_POLL_ADD;
+        sqe->fd = m_socketFd;
+        sqe->poll32_events = POLLIN;
+        sqe->user_data = RING_POLL;
+        m_ringPollActive = true;
+    } else {
+        // One request keeps delivering datagrams, one completion each, until it runs out of buffers
+        sqe->opcode = IORING_OP_RECVMSG;
+        sqe->fd = m_socketFd;
+        sqe->addr = reinterpret_cast<uint64_t>(&m_ringReceiveHeader);
+        sqe->flags = IOSQE_BUFFER_SELECT;
+        sqe->buf_group = RING_BUFFER_GROUP;
+        sqe->ioprio = IORING_RECV_MULTISHOT;
+        sqe->user_data = RING_RECEIVE;
+        m_ringReceiveActive = true;
+    }
+
+    int result = m_ioUring->Submit();
+    if (result < 0) {
+        SLLog::LogError("UdpSocket::ArmRingReceiveLocked - io_uring_enter() failed: " + std::string(strerror(-result)));
+    }
+}
+
+void UdpSocket::CancelRingRequestsLocked() {
+    for (uint64_t request : { RING_RECEIVE, RING_POLL }) {
+        bool active = (request == RING_RECEIVE) ? m_ringReceiveActive : m_ringPollActive;
+        io_uring_sqe* sqe = active ? m_ioUring->GetSqe() : nullptr;
+        if (sqe) {
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->addr = request;
+            sqe->user_data = RING_CANCEL;
+        }
+    }
+    m_ioUring->Submit();
+}
+
+int UdpSocket::FlushRingSendQueue() {
+    std::lock_guard<std::mutex> lock(m_ringMutex);
+    if (!m_ringReading) {
+        // Nobody else reaps the completions that free the send slots
+        ReapRingCompletionsLocked(false);
+    }
+
+    size_t submitted = 0;
+    for (; submitted < m_sendQueued && !m_ringFreeSends.empty(); ++submitted) {
+        io_uring_sqe* sqe = m_ioUring->GetSqe();
+        if (!sqe) {
+            break;
+        }
+        uint32_t slot = m_ringFreeSends.back();
+        m_ringFreeSends.pop_back();
+
+        RingSend& send = m_ringSends[slot];
+        send.packet = std::move(m_sendPackets[submitted]);
+        send.destination = m_sendAddrs[submitted];
+        send.iov = { send.packet.MutableData(), send.packet.Size() };
+        send.hdr = {};
+        send.hdr.msg_name = &send.destination;
+        send.hdr.msg_namelen = sizeof(sockaddr_in);
+        send.hdr.msg_iov = &send.iov;
+        send.hdr.msg_iovlen = 1;
+
+        // Fail rather than wait on a full send buffer, so a full buffer drops like with sendmmsg()
+        sqe->opcode = IORING_OP_SENDMSG;
+        sqe->fd = m_socketFd;
+        sqe->addr = reinterpret_cast<uint64_t>(&send.hdr);
+        sqe->msg_flags = MSG_DONTWAIT;
+        sqe->user_data = RING_SEND | slot;
+    }
+
+    // No room for the rest of the queue
+    if (submitted < m_sendQueued) {
+        CountSendDrops(m_sendQueued - submitted);
+        for (size_t i = submitted; i < m_sendQueued; ++i) {
+            m_sendPackets[i].Release();
+        }
+    }
+    m_sendQueued = 0;
+
+    if (m_txTimestamps) {
+        StampTxSendTimes(submitted);
+    }
+    int result = m_ioUring->Submit();
+    if (result < 0) {
+        SLLog::LogError("UdpSocket::FlushData - io_uring_enter() failed: " + std::string(strerror(-result)));
+        return -1;
+    }
+    if (m_txTimestamps) {
+        m_txNextId.fetch_add(static_cast<uint32_t>(submitted), std::memory_order_relaxed);
+    }
+
+    return static_cast<int>(submitted);
+}
+
 bool UdpSocket::IsInitialized() const {
     return m_socketFd != -1;
 }
@@ -76,8 +876,42 @@ void UdpSocket::StartReading() {
         return;
     }
 
+    ThreadConfig receiverThread = m_options.receiverThread;
+    if (receiverThread.name.empty()) {
+        receiverThread.name = "udp-rx";
+    }
+    m_ownEventLoop = std::make_unique<EventLoop>(1, receiverThread);
+    StartReading(*m_ownEventLoop);
+}
+
+void UdpSocket::StartReading(EventLoop& eventLoop) {
+    if (m_running.load()) {
+        return;
+    }
+
+    // With io_uring the loop waits for completions on the ring instead of for readiness of the socket
     m_running.store(true);
-    m_receiverThread = std::thread(&UdpSocket::ReceiverThreadFunc, this);
+    m_eventLoop = &eventLoop;
+    if (m_eventLoop->Add(m_ioUring ? m_ioUring->Fd() : m_socketFd, this, EPOLLIN) != 0) {
+        SLLog::LogError("UdpSocket::StartReading - Failed to register socket with the event loop");
+        m_running.store(false);
+        m_eventLoop = nullptr;
+        m_ownEventLoop.reset();
+        return;
+    }
+
+    if (m_ioUring) {
+        // Arm the receive from the loop thread, as the kernel completes a request on the thread that submitted
+        // it: a no-op completion wakes the loop, which then submits the multishot recvmsg itself
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        m_ringReading = true;
+        io_uring_sqe* sqe = m_ioUring->GetSqe();
+        if (sqe) {
+            sqe->opcode = IORING_OP_NOP;
+            sqe->user_data = RING_WAKE;
+        }
+        m_ioUring->Submit();
+    }
 }
 
 void UdpSocket::StopReading() {
@@ -86,21 +920,34 @@ void UdpSocket::StopReading() {
     }
 
     m_running.store(false);
-    if (m_receiverThread.joinable()) {
-        m_receiverThread.join();
+    if (m_eventLoop) {
+        m_eventLoop->Remove(m_ioUring ? m_ioUring->Fd() : m_socketFd);
+        m_eventLoop = nullptr;
+    }
+    m_ownEventLoop.reset();
+
+    if (m_ioUring) {
+        std::lock_guard<std::mutex> lock(m_ringMutex);
+        m_ringReading = false;
+        CancelRingRequestsLocked();
     }
 }
 
 void UdpSocket::RegisterObserver(IUdpObserver* observer) {
-    std::lock_guard<std::mutex> lock(m_observerMutex);
-    if (observer && std::find(m_observers.begin(), m_observers.end(), observer) == m_observers.end()) {
-        m_observers.push_back(observer);
+    if (!observer) {
+        return;
     }
+    m_observers.Update([observer](std::vector<IUdpObserver*>& observers) {
+        if (std::find(observers.begin(), observers.end(), observer) == observers.end()) {
+            observers.push_back(observer);
+        }
+    });
 }
 
 void UdpSocket::UnregisterObserver(IUdpObserver* observer) {
-    std::lock_guard<std::mutex> lock(m_observerMutex);
-    m_observers.erase(std::remove(m_observers.begin(), m_observers.end(), observer), m_observers.end());
+    m_observers.Update([observer](std::vector<IUdpObserver*>& observers) {
+        observers.erase(std::remove(observers.begin(), observers.end(), observer), observers.end());
+    });
 }
 
 int UdpSocket::WriteData(const std::string& data, const sockaddr_in& destination) {
@@ -108,13 +955,26 @@ int UdpSocket::WriteData(const std::string& data, const sockaddr_in& destination
         return -1;
     }
 
+    if (m_txTimestamps) {
+        StampTxSendTimes(1);
+    }
     ssize_t bytesSent = sendto(m_socketFd, data.data(), data.size(), 0,
                                reinterpret_cast<const struct sockaddr*>(&destination),
                                sizeof(destination));
     if (bytesSent < 0) {
-        SLLog::LogError("UdpSocket::WriteData - sendto() failed: " + std::string(strerror(errno)));
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+            CountSendDrops(1);
+        } else {
+            m_metrics.sendErrors.Add();
+            SLLog::LogError("UdpSocket::WriteData - sendto() failed: " + std::string(strerror(errno)));
+        }
         return -1;
     }
+    if (m_txTimestamps) {
+        m_txNextId.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_metrics.sentDatagrams.Add();
+    m_metrics.sentBytes.Add(static_cast<uint64_t>(bytesSent));
 
     return static_cast<int>(bytesSent);
 }
@@ -123,44 +983,519 @@ int UdpSocket::WriteData(const std::string& data) {
     return WriteData(data, m_socketAddress);
 }
 
-void UdpSocket::ReceiverThreadFunc() {
-    fd_set readfds;
-    sockaddr_in senderAddr = {};
-    socklen_t senderAddrLen = sizeof(senderAddr);
-
-    while (m_running.load()) {
-        FD_ZERO(&readfds);
-        FD_SET(m_socketFd, &readfds);
-
-        struct timeval timeout = {1, 0}; // 1-second timeout
-
-        int retval = select(m_socketFd + 1, &readfds, nullptr, nullptr, &timeout);
-        if (retval > 0) {
-            ssize_t bytesReceived = recvfrom(m_socketFd, m_receiveBuffer.data(), m_bufferSize, 0,
-                                             reinterpret_cast<struct sockaddr*>(&senderAddr),
-                                             &senderAddrLen);
-            if (bytesReceived > 0) {
-                std::string data(m_receiveBuffer.begin(), m_receiveBuffer.begin() + bytesReceived);
-                //! Enable for debugging purposes
-                //! SLLog::LogWarn("Received Data: " + data);
-                NotifyObservers(data, senderAddr);
-            } else if (bytesReceived < 0) {
-                SLLog::LogError("recvfrom() failed: " + std::string(strerror(errno)));
-            }
-        } else if (retval == 0) {
-            //! Enable for debugging pusposes
-            //! SLLog::LogInfo("Timeout: No data received.");
+int UdpSocket::WriteData(const PacketView& packet, const sockaddr_in& destination) {
+    if (m_socketFd == -1) {
+        return -1;
+    }
+
+    if (m_txTimestamps) {
+        StampTxSendTimes(1);
+    }
+    ssize_t bytesSent = sendto(m_socketFd, packet.Data(), packet.Size(), 0,
+                               reinterpret_cast<const struct sockaddr*>(&destination),
+                               sizeof(destination));
+    if (bytesSent < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+            CountSendDrops(1);
         } else {
-            SLLog::LogError("select() error: " + std::string(strerror(errno)));
+            m_metrics.sendErrors.Add();
+            SLLog::LogError("UdpSocket::WriteData - sendto() failed: " + std::string(strerror(errno)));
+        }
+        return -1;
+    }
+    if (m_txTimestamps) {
+        m_txNextId.fetch_add(1, std::memory_order_relaxed);
+    }
+    m_metrics.sentDatagrams.Add();
+    m_metrics.sentBytes.Add(static_cast<uint64_t>(bytesSent));
+
+    return static_cast<int>(bytesSent);
+}
+
+int UdpSocket::QueueData(const std::string& data, const sockaddr_in& destination) {
+    if (m_socketFd == -1) {
+        return -1;
+    }
+
+    if (m_sendBatchSize == 1) {
+        return WriteData(data, destination);
+    }
+
+    PacketView packet;
+    if (data.size() <= m_packetPool->BufferSize()) {
+        packet = PacketView::Allocate(*m_packetPool, data.size());
+    }
+
+    if (packet.Empty()) {
+        // Too large for a pool buffer, or the pool is exhausted: send right away, behind what is queued
+        std::lock_guard<std::mutex> lock(m_sendMutex);
+        FlushDataLocked();
+        return WriteData(data, destination);
+    }
+
+    std::memcpy(packet.MutableData(), data.data(), data.size());
+    return QueueData(packet, destination);
+}
+
+int UdpSocket::QueueData(const std::string& data) {
+    return QueueData(data, m_socketAddress);
+}
+
+int UdpSocket::QueueData(const PacketView& packet, const sockaddr_in& destination) {
+    if (m_socketFd == -1 || packet.Empty()) {
+        return -1;
+    }
+
+    if (m_sendBatchSize == 1) {
+        return WriteData(packet, destination);
+    }
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+
+    m_sendPackets[m_sendQueued] = packet;
+    m_sendAddrs[m_sendQueued] = destination;
+    ++m_sendQueued;
+
+    if (m_sendQueued == m_sendBatchSize) {
+        return (FlushDataLocked() < 0) ? -1 : 0;
+    }
+
+    return 0;
+}
+
+int UdpSocket::QueueData(const PacketView& packet) {
+    return QueueData(packet, m_socketAddress);
+}
+
+int UdpSocket::WriteSegmented(const uint8_t* data, size_t size, size_t segmentSize, const sockaddr_in& destination) {
+    if (m_socketFd == -1 || size == 0 || segmentSize == 0 || size > MAX_GSO_SIZE ||
+        (size + segmentSize - 1) / segmentSize > MAX_GSO_SEGMENTS) {
+        return -1;
+    }
+
+    size_t segments = (size + segmentSize - 1) / segmentSize;
+    if (segments == 1 || !m_gsoSupported.load(std::memory_order_relaxed)) {
+        return WriteSegments(data, size, segmentSize, destination);
+    }
+
+    iovec iov = { const_cast<uint8_t*>(data), size };
+    alignas(cmsghdr) char control[CMSG_SPACE(sizeof(uint16_t))] = {};
+
+    msghdr hdr = {};
+    hdr.msg_name = const_cast<sockaddr_in*>(&destination);
+    hdr.msg_namelen = sizeof(destination);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    hdr.msg_control = control;
+    hdr.msg_controllen = sizeof(control);
+
+    cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+    cmsg->cmsg_level = SOL_UDP;
+    cmsg->cmsg_type = UDP_SEGMENT;
+    cmsg->cmsg_len = CMSG_LEN(sizeof(uint16_t));
+    uint16_t gsoSize = static_cast<uint16_t>(segmentSize);
+    std::memcpy(CMSG_DATA(cmsg), &gsoSize, sizeof(gsoSize));
+
+    if (m_txTimestamps) {
+        // The kernel numbers a GSO send as one datagram
+        StampTxSendTimes(1);
+    }
+    if (sendmsg(m_socketFd, &hdr, 0) < 0) {
+        if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+            CountSendDrops(segments);
+            return 0;
+        }
+        if (errno == EIO || errno == EINVAL || errno == ENOPROTOOPT || errno == EOPNOTSUPP) {
+            // No GSO support in this kernel, or no checksum offload on the device
+            if (m_gsoSupported.exchange(false)) {
+                SLLog::LogWarn("UdpSocket::WriteSegmented - UDP_SEGMENT not supported (" + std::string(strerror(errno)) +
+                               "), falling back to sendmmsg()");
+            }
+            return WriteSegments(data, size, segmentSize, destination);
         }
+        m_metrics.sendErrors.Add();
+        SLLog::LogError("UdpSocket::WriteSegmented - sendmsg() failed: " + std::string(strerror(errno)));
+        return -1;
+    }
+    if (m_txTimestamps) {
+        m_txNextId.fetch_add(1, std::memory_order_relaxed);
     }
+    m_metrics.sentDatagrams.Add(segments);
+    m_metrics.sentBytes.Add(size);
+
+    return static_cast<int>(segments);
 }
 
-void UdpSocket::NotifyObservers(const std::string& data, const sockaddr_in& senderAddr) {
-    std::lock_guard<std::mutex> lock(m_observerMutex);
-    for (IUdpObserver* observer : m_observers) {
-        if (observer) {
-            observer->NewUdpDataCallback(data, senderAddr);
+int UdpSocket::WriteSegmented(const uint8_t* data, size_t size, size_t segmentSize) {
+    return WriteSegmented(data, size, segmentSize, m_socketAddress);
+}
+
+int UdpSocket::WriteSegments(const uint8_t* data, size_t size, size_t segmentSize, const sockaddr_in& destination) {
+    mmsghdr headers[MAX_GSO_SEGMENTS];
+    iovec iovecs[MAX_GSO_SEGMENTS];
+
+    size_t segments = 0;
+    for (size_t offset = 0; offset < size; offset += segmentSize, ++segments) {
+        iovecs[segments].iov_base = const_cast<uint8_t*>(data + offset);
+        iovecs[segments].iov_len = std::min(segmentSize, size - offset);
+
+        msghdr& hdr = headers[segments].msg_hdr;
+        hdr = {};
+        hdr.msg_name = const_cast<sockaddr_in*>(&destination);
+        hdr.msg_namelen = sizeof(destination);
+        hdr.msg_iov = &iovecs[segments];
+        hdr.msg_iovlen = 1;
+        headers[segments].msg_len = 0;
+    }
+
+    size_t sent = 0;
+    while (sent < segments) {
+        if (m_txTimestamps) {
+            StampTxSendTimes(segments - sent);
+        }
+        int retval = sendmmsg(m_socketFd, headers + sent, static_cast<unsigned int>(segments - sent), 0);
+        if (retval < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                CountSendDrops(segments - sent);
+                break;
+            }
+            m_metrics.sendErrors.Add();
+            SLLog::LogError("UdpSocket::WriteSegmented - sendmmsg() failed: " + std::string(strerror(errno)));
+            return -1;
+        }
+        sent += static_cast<size_t>(retval);
+        if (m_txTimestamps) {
+            m_txNextId.fetch_add(static_cast<uint32_t>(retval), std::memory_order_relaxed);
+        }
+    }
+    m_metrics.sentDatagrams.Add(sent);
+    m_metrics.sentBytes.Add(std::min(size, sent * segmentSize));
+
+    return static_cast<int>(sent);
+}
+
+IoEngine UdpSocket::GetIoEngine() const {
+    return m_ioUring ? IoEngine::EIoUring : IoEngine::EEpoll;
+}
+
+PacketPool& UdpSocket::GetPacketPool() {
+    return *m_packetPool;
+}
+
+PacketPoolStats UdpSocket::GetPacketPoolStats() const {
+    return m_packetPool->GetStats();
+}
+
+uint64_t UdpSocket::GetSendDrops() const {
+    return m_sendDrops.load(std::memory_order_relaxed);
+}
+
+uint64_t UdpSocket::GetKernelDrops() const {
+    return m_kernelDrops.load(std::memory_order_relaxed);
+}
+
+uint64_t UdpSocket::GetTruncatedDatagrams() const {
+    return m_truncatedDatagrams.load(std::memory_order_relaxed);
+}
+
+int UdpSocket::GetReceiveBufferSize() const {
+    int bytes = 0;
+    socklen_t length = sizeof(bytes);
+    if (m_socketFd == -1 || getsockopt(m_socketFd, SOL_SOCKET, SO_RCVBUF, &bytes, &length) == -1) {
+        return -1;
+    }
+    return bytes;
+}
+
+const std::string& UdpSocket::GetMetricLabels() const {
+    return m_metricLabels;
+}
+
+const LatencyHistogram& UdpSocket::GetTxLatency() const {
+    return m_txLatency;
+}
+
+int UdpSocket::FlushData() {
+    if (m_sendBatchSize == 1) {
+        return 0;
+    }
+
+    std::lock_guard<std::mutex> lock(m_sendMutex);
+    return FlushDataLocked();
+}
+
+int UdpSocket::FlushDataLocked() {
+    if (m_sendQueued == 0) {
+        return 0;
+    }
+    if (m_ioUring) {
+        return FlushRingSendQueue();
+    }
+
+    for (size_t i = 0; i < m_sendQueued; ++i) {
+        m_sendIovecs[i].iov_base = m_sendPackets[i].MutableData();
+        m_sendIovecs[i].iov_len = m_sendPackets[i].Size();
+
+        msghdr& hdr = m_sendHeaders[i].msg_hdr;
+        hdr = {};
+        hdr.msg_name = &m_sendAddrs[i];
+        hdr.msg_namelen = sizeof(sockaddr_in);
+        hdr.msg_iov = &m_sendIovecs[i];
+        hdr.msg_iovlen = 1;
+        m_sendHeaders[i].msg_len = 0;
+    }
+
+    // sendmmsg() may send less than requested; keep going until the queue is empty or an error occurs
+    size_t sent = 0;
+    size_t dropped = 0;
+    while (sent < m_sendQueued) {
+        if (m_txTimestamps) {
+            StampTxSendTimes(m_sendQueued - sent);
+        }
+        int retval = sendmmsg(m_socketFd, m_sendHeaders.data() + sent,
+                              static_cast<unsigned int>(m_sendQueued - sent), 0);
+        if (retval < 0) {
+            if (errno == EINTR) {
+                continue;
+            }
+            if (errno == EAGAIN || errno == EWOULDBLOCK || errno == ENOBUFS) {
+                // Send buffer full: drop the rest of the queue rather than block the caller
+                CountSendDrops(m_sendQueued - sent);
+                dropped = m_sendQueued - sent;
+                break;
+            }
+            m_metrics.sendErrors.Add();
+            SLLog::LogError("UdpSocket::FlushData - sendmmsg() failed: " + std::string(strerror(errno)));
+            break;
+        }
+        sent += static_cast<size_t>(retval);
+        if (m_txTimestamps) {
+            m_txNextId.fetch_add(static_cast<uint32_t>(retval), std::memory_order_relaxed);
+        }
+    }
+
+    uint64_t sentBytes = 0;
+    for (size_t i = 0; i < sent; ++i) {
+        sentBytes += m_sendHeaders[i].msg_len;
+    }
+    m_metrics.sentDatagrams.Add(sent);
+    m_metrics.sentBytes.Add(sentBytes);
+
+    // Give the payload buffers back to the pool
+    for (size_t i = 0; i < m_sendQueued; ++i) {
+        m_sendPackets[i].Release();
+    }
+    bool failed = (sent + dropped < m_sendQueued);
+    m_sendQueued = 0;
+
+    return failed ? -1 : static_cast<int>(sent);
+}
+
+void UdpSocket::CountSendDrops(size_t count) {
+    uint64_t previous = m_sendDrops.fetch_add(count);
+    uint64_t drops = previous + count;
+
+    // Log each time the total crosses a power of two
+    if (previous == 0 || __builtin_clzll(previous) != __builtin_clzll(drops)) {
+        SLLog::LogWarn("UdpSocket::CountSendDrops - Send buffer full, dropped " + std::to_string(drops) +
+                       " datagram(s) so far");
+    }
+}
+
+void UdpSocket::HandleEvents(uint32_t events) {
+    AdaptReceiveBuffer();
+
+    if (m_ioUring) {
+        HandleRingEvents();
+        return;
+    }
+
+    if (m_txTimestamps && (events & EPOLLERR)) {
+        ReadErrorQueue();
+    }
+
+    if (m_options.busyPollBudget.count() > 0) {
+        BusyPoll();
+        return;
+    }
+
+    // Bound the work per readiness event, so one busy socket cannot starve the others on the same loop
+    static constexpr int MAX_RECEIVE_CALLS_PER_EVENT = 64;
+
+    for (int i = 0; i < MAX_RECEIVE_CALLS_PER_EVENT && m_running.load(); ++i) {
+        bool more = (m_batchSize > 1) ? ReceiveBatch() : ReceiveSingle();
+        if (!more) {
+            break;
+        }
+    }
+}
+
+void UdpSocket::BusyPoll() {
+    auto deadline = std::chrono::steady_clock::now() + m_options.busyPollBudget;
+
+    while (m_running.load(std::memory_order_relaxed)) {
+        AdaptReceiveBuffer();
+        uint64_t receivedBefore = m_receivedPackets;
+        bool more = (m_batchSize > 1) ? ReceiveBatch() : ReceiveSingle();
+
+        auto now = std::chrono::steady_clock::now();
+        if (more || m_receivedPackets != receivedBefore) {
+            deadline = now + m_options.busyPollBudget;
+            continue;
+        }
+        if (now >= deadline) {
+            break;
+        }
+
+        // Idle: pick up the transmit timestamps, which otherwise wait for the next EPOLLERR
+        if (m_txTimestamps) {
+            ReadErrorQueue();
+        }
+        CpuRelax();
+    }
+}
+
+bool UdpSocket::ReceiveSingle() {
+    PacketBuffer* buffer = m_packetPool->Allocate();
+    if (!buffer) {
+        return DropDatagram();
+    }
+    PacketView packet(buffer, 0, sockaddr_in{});
+
+    sockaddr_in senderAddr = {};
+    iovec iov = { packet.MutableData(), m_bufferSize };
+
+    msghdr hdr = {};
+    hdr.msg_name = &senderAddr;
+    hdr.msg_namelen = sizeof(senderAddr);
+    hdr.msg_iov = &iov;
+    hdr.msg_iovlen = 1;
+    if (!m_batchControl.empty()) {
+        hdr.msg_control = m_batchControl[0].data;
+        hdr.msg_controllen = sizeof(ControlBuffer);
+    }
+
+    // MSG_TRUNC: the full length of a datagram that did not fit
+    ssize_t bytesReceived = recvmsg(m_socketFd, &hdr, MSG_TRUNC);
+    if (bytesReceived < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            m_metrics.receiveErrors.Add();
+            SLLog::LogError("recvmsg() failed: " + std::string(strerror(errno)));
+        }
+        return false;
+    }
+    if (hdr.msg_flags & MSG_TRUNC) {
+        CountTruncatedDatagram(static_cast<size_t>(bytesReceived));
+        return true;
+    }
+
+    //! Enable for debugging purposes
+    //! SLLog::LogWarn("Received Data: " + std::string(packet.AsStringView()));
+    packet.SetSize(static_cast<size_t>(bytesReceived));
+    packet.SetSenderAddr(senderAddr);
+    AddReceivedPacket(std::move(packet), hdr, m_rxTimestamps ? RealtimeNowNs() : 0);
+    NotifyObservers(m_packets);
+    m_packets.clear();
+
+    return true;
+}
+
+bool UdpSocket::ReceiveBatch() {
+    size_t count = m_packetPool->Allocate(m_batchBuffers.data(), m_batchSize);
+    if (count == 0) {
+        return DropDatagram();
+    }
+
+    for (size_t i = 0; i < count; ++i) {
+        m_batchIovecs[i].iov_base = m_batchBuffers[i]->data;
+        m_batchIovecs[i].iov_len = m_bufferSize;
+
+        msghdr& hdr = m_batchHeaders[i].msg_hdr;
+        hdr = {};
+        hdr.msg_name = &m_batchAddrs[i];
+        hdr.msg_namelen = sizeof(sockaddr_in);
+        hdr.msg_iov = &m_batchIovecs[i];
+        hdr.msg_iovlen = 1;
+        if (!m_batchControl.empty()) {
+            hdr.msg_control = m_batchControl[i].data;
+            hdr.msg_controllen = sizeof(ControlBuffer);
+        }
+        m_batchHeaders[i].msg_len = 0;
+    }
+
+    // MSG_TRUNC: the full length of a datagram that did not fit
+    int received = recvmmsg(m_socketFd, m_batchHeaders.data(), static_cast<unsigned int>(count),
+                            MSG_DONTWAIT | MSG_TRUNC, nullptr);
+    if (received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR) {
+            m_metrics.receiveErrors.Add();
+            SLLog::LogError("recvmmsg() failed: " + std::string(strerror(errno)));
+        }
+        received = 0;
+    }
+
+    // Hand back the buffers the kernel did not fill
+    for (size_t i = static_cast<size_t>(received); i < count; ++i) {
+        PacketPool::Release(m_batchBuffers[i]);
+    }
+
+    uint64_t readTimeNs = (m_rxTimestamps && received > 0) ? RealtimeNowNs() : 0;
+    for (int i = 0; i < received; ++i) {
+        if (m_batchHeaders[i].msg_hdr.msg_flags & MSG_TRUNC) {
+            PacketPool::Release(m_batchBuffers[i]);
+            CountTruncatedDatagram(m_batchHeaders[i].msg_len);
+            continue;
+        }
+        AddReceivedPacket(PacketView(m_batchBuffers[i], m_batchHeaders[i].msg_len, m_batchAddrs[i]),
+                          m_batchHeaders[i].msg_hdr, readTimeNs);
+    }
+
+    if (!m_packets.empty()) {
+        NotifyObservers(m_packets);
+        m_packets.clear();
+    }
+
+    // Replies queued by observers while handling this batch go out in one go
+    FlushData();
+
+    // A partial batch means the socket has been drained
+    return received > 0 && static_cast<size_t>(received) == count;
+}
+
+bool UdpSocket::DropDatagram() {
+    // All receive buffers are held by observers: drop the datagram rather than spin on a readable socket
+    ssize_t bytesReceived = recv(m_socketFd, m_dropBuffer.data(), m_dropBuffer.size(), MSG_DONTWAIT);
+    if (bytesReceived < 0) {
+        return false;
+    }
+
+    uint64_t drops = ++m_receiveDrops;
+    if ((drops & (drops - 1)) == 0) {
+        SLLog::LogWarn("UdpSocket::DropDatagram - Packet pool exhausted, dropped " + std::to_string(drops) +
+                       " datagram(s) so far");
+    }
+
+    return true;
+}
+
+void UdpSocket::NotifyObservers(std::vector<PacketView>& packets) {
+    auto observers = m_observers.Read();
+    for (size_t i = 0; i < observers->size(); ++i) {
+        IUdpObserver* observer = (*observers)[i];
+        if (!observer) {
+            continue;
+        }
+
+        if (i + 1 == observers->size()) {
+            observer->NewUdpPacketBatchCallback(packets);
+        } else {
+            // Every other observer gets its own references on the same buffers
+            m_clonedPackets.assign(packets.begin(), packets.end());
+            observer->NewUdpPacketBatchCallback(m_clonedPackets);
+            m_clonedPackets.clear();
         }
     }
 }
@@ -5,10 +5,14 @@
 *****************************************************************************/
 
 #include "udp_client_tester.hpp"
+#include "udp_load_generator.hpp"
+#include "metrics_endpoint.hpp"
 #include "sl_log.hpp"
 #include <csignal>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <memory>
 #include <regex>
 
 volatile bool running = true;
@@ -30,10 +34,64 @@ bool isValidIpAddress(const std::string& ipAddress) {
     return std::regex_match(ipAddress, ipPattern);
 }
 
+void printUsage(const char* program) {
+    hek::SLLog::LogError("Usage: " + std::string(program) + " <port> <ipAddress> [--rate <pps>[k|M] | --bitrate <bps>[k|M|G]]"
+                         " [--size <bytes>|<min>-<max>|imix] [--flows <count>] [--duration <seconds>] [--batch <count>]"
+                         " [--gso <segments>] [--io-uring] [--busy-poll <us>] [--rx-cpus <list>] [--handler-cpus <list>|sibling] [--timer-cpus <list>]"
+                         " [--fifo <priority>] [--rcvbuf <bytes>[k|M]] [--sndbuf <bytes>[k|M]] [--rcvbuf-max <bytes>[k|M]]"
+                         " [--metrics <socket path>]");
+}
+
+// Parse a positive number with an optional k, M or G suffix, eg 10k or 1.5G
+bool parseRate(const char* text, double& outRate) {
+    char* end;
+    double rate = std::strtod(text, &end);
+    if (*end == 'k') {
+        rate *= 1e3;
+        ++end;
+    } else if (*end == 'M') {
+        rate *= 1e6;
+        ++end;
+    } else if (*end == 'G') {
+        rate *= 1e9;
+        ++end;
+    }
+    if (*end != '\0' || !(rate > 0)) {
+        return false;
+    }
+    outRate = rate;
+    return true;
+}
+
+// Parse a payload size: a fixed size, a uniformly distributed <min>-<max> range, or imix
+bool parsePayloadSize(const char* text, hek::UdpLoadGeneratorOptions& options) {
+    if (std::strcmp(text, "imix") == 0) {
+        options.sizeMode = hek::PayloadSizeMode::EImix;
+        options.minPayloadSize = 64;
+        options.maxPayloadSize = 1472;
+        return true;
+    }
+
+    char* end;
+    long minSize = std::strtol(text, &end, 10);
+    long maxSize = minSize;
+    if (*end == '-') {
+        maxSize = std::strtol(end + 1, &end, 10);
+    }
+    if (*end != '\0' || minSize <= 0 || maxSize < minSize || maxSize > 65507) {
+        return false;
+    }
+
+    options.sizeMode = (minSize == maxSize) ? hek::PayloadSizeMode::EFixed : hek::PayloadSizeMode::EUniform;
+    options.minPayloadSize = static_cast<size_t>(minSize);
+    options.maxPayloadSize = static_cast<size_t>(maxSize);
+    return true;
+}
+
 int main(int argc, char* argv[]) {
     // Check if the user provided a port number and IP address
-    if (argc != 3) {
-        hek::SLLog::LogError("Usage: " + std::string(argv[0]) + " <port> <ipAddress>");
+    if (argc < 3) {
+        printUsage(argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -52,11 +110,148 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
+    // Optional arguments: any rate selects the load generator mode
+    hek::UdpLoadGeneratorOptions loadOptions;
+    bool loadMode = false;
+    hek::UdpClientTesterOptions clientOptions;
+    hek::ThreadConfig timerThread;
+    std::string metricsPath;
+    for (int i = 3; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--rate") == 0 && i + 1 < argc) {
+            if (!parseRate(argv[++i], loadOptions.packetsPerSecond)) {
+                hek::SLLog::LogError("Invalid rate. Please provide datagrams per second, eg 10000 or 10k");
+                return EXIT_FAILURE;
+            }
+            loadMode = true;
+        } else if (std::strcmp(argv[i], "--bitrate") == 0 && i + 1 < argc) {
+            if (!parseRate(argv[++i], loadOptions.bitsPerSecond)) {
+                hek::SLLog::LogError("Invalid bitrate. Please provide bits per second, eg 100M");
+                return EXIT_FAILURE;
+            }
+            loadMode = true;
+        } else if (std::strcmp(argv[i], "--size") == 0 && i + 1 < argc) {
+            if (!parsePayloadSize(argv[++i], loadOptions)) {
+                hek::SLLog::LogError("Invalid payload size. Please provide eg 64, 64-1472 or imix (max 65507)");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--flows") == 0 && i + 1 < argc) {
+            long flows = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || flows <= 0 || flows > 1024) {
+                hek::SLLog::LogError("Invalid flow count. Please provide a value between 1 and 1024");
+                return EXIT_FAILURE;
+            }
+            loadOptions.flowCount = static_cast<size_t>(flows);
+        } else if (std::strcmp(argv[i], "--duration") == 0 && i + 1 < argc) {
+            double seconds = std::strtod(argv[++i], &end);
+            if (*end != '\0' || !(seconds > 0)) {
+                hek::SLLog::LogError("Invalid duration. Please provide a number of seconds, eg 10");
+                return EXIT_FAILURE;
+            }
+            loadOptions.duration = std::chrono::milliseconds(static_cast<int64_t>(seconds * 1000));
+        } else if (std::strcmp(argv[i], "--batch") == 0 && i + 1 < argc) {
+            long batch = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || batch <= 0 || batch > 1024) {
+                hek::SLLog::LogError("Invalid batch size. Please provide a value between 1 and 1024");
+                return EXIT_FAILURE;
+            }
+            loadOptions.batchSize = static_cast<size_t>(batch);
+        } else if (std::strcmp(argv[i], "--gso") == 0 && i + 1 < argc) {
+            long segments = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || segments < 2 || segments > static_cast<long>(hek::UdpSocket::MAX_GSO_SEGMENTS)) {
+                hek::SLLog::LogError("Invalid GSO segment count. Please provide a value between 2 and " +
+                                     std::to_string(hek::UdpSocket::MAX_GSO_SEGMENTS));
+                return EXIT_FAILURE;
+            }
+            loadOptions.gsoSegments = static_cast<size_t>(segments);
+        } else if (std::strcmp(argv[i], "--io-uring") == 0) {
+            clientOptions.ioEngine = hek::IoEngine::EIoUring;
+        } else if (std::strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            long busyPollMicros = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || busyPollMicros <= 0 || busyPollMicros > 1000000) {
+                hek::SLLog::LogError("Invalid busy poll budget. Please provide microseconds between 1 and 1000000, eg 50");
+                return EXIT_FAILURE;
+            }
+            clientOptions.busyPollBudget = std::chrono::microseconds(busyPollMicros);
+        } else if (std::strcmp(argv[i], "--rx-cpus") == 0 && i + 1 < argc) {
+            if (!hek::ParseCpuList(argv[++i], clientOptions.receiverThread.cpus)) {
+                hek::SLLog::LogError("Invalid CPU list. Please provide eg 2 or 0,2,4-7");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--handler-cpus") == 0 && i + 1 < argc) {
+            if (std::strcmp(argv[++i], "sibling") == 0) {
+                clientOptions.handlerOnCacheSibling = true;
+            } else if (!hek::ParseCpuList(argv[i], clientOptions.handlerThread.cpus)) {
+                hek::SLLog::LogError("Invalid CPU list. Please provide eg 2, 0,2,4-7 or sibling");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--timer-cpus") == 0 && i + 1 < argc) {
+            if (!hek::ParseCpuList(argv[++i], timerThread.cpus)) {
+                hek::SLLog::LogError("Invalid CPU list. Please provide eg 2 or 0,2,4-7");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--fifo") == 0 && i + 1 < argc) {
+            long priority = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || priority < 1 || priority > 99) {
+                hek::SLLog::LogError("Invalid real-time priority. Please provide a value between 1 and 99");
+                return EXIT_FAILURE;
+            }
+            for (hek::ThreadConfig* config : { &clientOptions.receiverThread, &clientOptions.handlerThread, &timerThread }) {
+                config->schedPolicy = SCHED_FIFO;
+                config->schedPriority = static_cast<int>(priority);
+            }
+        } else if (std::strcmp(argv[i], "--rcvbuf") == 0 && i + 1 < argc) {
+            if (!hek::ParseByteSize(argv[++i], clientOptions.socketBuffers.receiveBytes)) {
+                hek::SLLog::LogError("Invalid receive buffer size. Please provide bytes, eg 4M");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--sndbuf") == 0 && i + 1 < argc) {
+            if (!hek::ParseByteSize(argv[++i], clientOptions.socketBuffers.sendBytes)) {
+                hek::SLLog::LogError("Invalid send buffer size. Please provide bytes, eg 4M");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--rcvbuf-max") == 0 && i + 1 < argc) {
+            if (!hek::ParseByteSize(argv[++i], clientOptions.socketBuffers.maxReceiveBytes)) {
+                hek::SLLog::LogError("Invalid maximum receive buffer size. Please provide bytes, eg 64M");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+
     // Register signal handler for CTRL-C
     std::signal(SIGINT, signalHandler);
 
+    // Serve the counters of the sockets, handlers and timers on a local Unix-domain socket
+    std::unique_ptr<hek::MetricsEndpoint> metricsEndpoint;
+    if (!metricsPath.empty()) {
+        metricsEndpoint = std::make_unique<hek::MetricsEndpoint>();
+        if (metricsEndpoint->Init(metricsPath) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (loadMode) {
+        loadOptions.receiverThread = clientOptions.receiverThread;
+        loadOptions.ioEngine = clientOptions.ioEngine;
+        loadOptions.socketBuffers = clientOptions.socketBuffers;
+        hek::UdpLoadGenerator generator(static_cast<uint16_t>(port), ipAddress, loadOptions);
+        if (!generator.IsInitialized()) {
+            return EXIT_FAILURE;
+        }
+
+        generator.LogReport(generator.Run(running));
+        return EXIT_SUCCESS;
+    }
+
     // Create the client with the provided IP address and port
-    hek::UdpClientTester client(static_cast<uint16_t>(port), ipAddress);
+    clientOptions.receiverThread.name = "udp-rx";
+    clientOptions.handlerThread.name = "udp-handler";
+    hek::TimerWheel::Default().SetThreadConfig(timerThread);
+    hek::UdpClientTester client(static_cast<uint16_t>(port), ipAddress, clientOptions);
 
     hek::SLLog::LogInfo("Started UDP Server on IP " + ipAddress + " and port " + std::to_string(port) + ". Press CTRL-C to stop.");
 
@@ -5,23 +5,48 @@
 *****************************************************************************/
 
 #include "udp_server_tester.hpp"
+#include "metrics_endpoint.hpp"
 #include "sl_log.hpp"
 #include <csignal>
 #include <cstdlib>
+#include <cstring>
 #include <limits>
+#include <memory>
+#include <vector>
 
 volatile bool running = true;
 
+static constexpr auto REPORT_INTERVAL = std::chrono::seconds(10);
+
 void signalHandler(int signal) {
     if (signal == SIGINT) {
         running = false;
     }
 }
 
+void printUsage(const char* program) {
+    hek::SLLog::LogError("Usage: " + std::string(program) + " <port> [--shards <count>] [--cpu-steering] [--workers <count>]"
+                         " [--queue-capacity <count>] [--overflow drop-newest|drop-oldest|block] [--dispatch thread|inline] [--timestamps]"
+                         " [--gro] [--io-uring] [--busy-poll <us>] [--rx-cpus <list>] [--handler-cpus <list>|sibling] [--fifo <priority>]"
+                         " [--rcvbuf <bytes>[k|M]] [--sndbuf <bytes>[k|M]] [--rcvbuf-max <bytes>[k|M]] [--metrics <socket path>]");
+}
+
+void logLatencyStages(const hek::LatencyStages& stages, const std::vector<std::unique_ptr<hek::UdpServerTester>>& shards) {
+    auto txLatency = std::make_unique<hek::LatencyHistogram>();
+    for (const auto& shard : shards) {
+        txLatency->Add(shard->GetTxLatency());
+    }
+
+    hek::SLLog::LogInfo("Latency stages - socket queue:  " + stages.socketQueue.Summary());
+    hek::SLLog::LogInfo("Latency stages - handler queue: " + stages.handlerQueue.Summary());
+    hek::SLLog::LogInfo("Latency stages - processing:    " + stages.processing.Summary());
+    hek::SLLog::LogInfo("Latency stages - send to TX:    " + txLatency->Summary());
+}
+
 int main(int argc, char* argv[]) {
     // Check if the user provided a port number
-    if (argc != 2) {
-        hek::SLLog::LogError("Usage: " + std::string(argv[0]) + " <port>");
+    if (argc < 2) {
+        printUsage(argv[0]);
         return EXIT_FAILURE;
     }
 
@@ -33,16 +58,209 @@ int main(int argc, char* argv[]) {
         return EXIT_FAILURE;
     }
 
+    // Optional arguments
+    long shardCount = 1;
+    long workerCount = 1;
+    long queueCapacity = 0;
+    hek::OverflowPolicy overflowPolicy = hek::OverflowPolicy::EBlockProducer;
+    hek::DispatchMode dispatchMode = hek::DispatchMode::EHandleThread;
+    bool cpuSteering = false;
+    bool timestamps = false;
+    bool gro = false;
+    bool ioUring = false;
+    long busyPollMicros = 0;
+    hek::ThreadConfig receiverThread;
+    hek::ThreadConfig handlerThread;
+    bool handlerOnCacheSibling = false;
+    hek::SocketBufferSizes socketBuffers;
+    std::string metricsPath;
+    for (int i = 2; i < argc; ++i) {
+        if (std::strcmp(argv[i], "--shards") == 0 && i + 1 < argc) {
+            shardCount = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || shardCount <= 0 || shardCount > 1024) {
+                hek::SLLog::LogError("Invalid shard count. Please provide a value between 1 and 1024");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--workers") == 0 && i + 1 < argc) {
+            workerCount = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || workerCount <= 0 || workerCount > 1024) {
+                hek::SLLog::LogError("Invalid worker count. Please provide a value between 1 and 1024");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--queue-capacity") == 0 && i + 1 < argc) {
+            queueCapacity = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || queueCapacity < 0) {
+                hek::SLLog::LogError("Invalid queue capacity. Please provide a positive value, or 0 for the default");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--overflow") == 0 && i + 1 < argc) {
+            std::string policy = argv[++i];
+            if (policy == "drop-newest") {
+                overflowPolicy = hek::OverflowPolicy::EDropNewest;
+            } else if (policy == "drop-oldest") {
+                overflowPolicy = hek::OverflowPolicy::EDropOldest;
+            } else if (policy == "block") {
+                overflowPolicy = hek::OverflowPolicy::EBlockProducer;
+            } else {
+                hek::SLLog::LogError("Invalid overflow policy: " + policy);
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--dispatch") == 0 && i + 1 < argc) {
+            std::string mode = argv[++i];
+            if (mode == "thread") {
+                dispatchMode = hek::DispatchMode::EHandleThread;
+            } else if (mode == "inline") {
+                dispatchMode = hek::DispatchMode::EInline;
+            } else {
+                hek::SLLog::LogError("Invalid dispatch mode: " + mode);
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--cpu-steering") == 0) {
+            cpuSteering = true;
+        } else if (std::strcmp(argv[i], "--timestamps") == 0) {
+            timestamps = true;
+        } else if (std::strcmp(argv[i], "--gro") == 0) {
+            gro = true;
+        } else if (std::strcmp(argv[i], "--io-uring") == 0) {
+            ioUring = true;
+        } else if (std::strcmp(argv[i], "--rx-cpus") == 0 && i + 1 < argc) {
+            if (!hek::ParseCpuList(argv[++i], receiverThread.cpus)) {
+                hek::SLLog::LogError("Invalid CPU list. Please provide eg 2 or 0,2,4-7");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--handler-cpus") == 0 && i + 1 < argc) {
+            if (std::strcmp(argv[++i], "sibling") == 0) {
+                handlerOnCacheSibling = true;
+            } else if (!hek::ParseCpuList(argv[i], handlerThread.cpus)) {
+                hek::SLLog::LogError("Invalid CPU list. Please provide eg 2, 0,2,4-7 or sibling");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--fifo") == 0 && i + 1 < argc) {
+            long priority = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || priority < 1 || priority > 99) {
+                hek::SLLog::LogError("Invalid real-time priority. Please provide a value between 1 and 99");
+                return EXIT_FAILURE;
+            }
+            for (hek::ThreadConfig* config : { &receiverThread, &handlerThread }) {
+                config->schedPolicy = SCHED_FIFO;
+                config->schedPriority = static_cast<int>(priority);
+            }
+        } else if (std::strcmp(argv[i], "--busy-poll") == 0 && i + 1 < argc) {
+            busyPollMicros = std::strtol(argv[++i], &end, 10);
+            if (*end != '\0' || busyPollMicros <= 0 || busyPollMicros > 1000000) {
+                hek::SLLog::LogError("Invalid busy poll budget. Please provide microseconds between 1 and 1000000, eg 50");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--rcvbuf") == 0 && i + 1 < argc) {
+            if (!hek::ParseByteSize(argv[++i], socketBuffers.receiveBytes)) {
+                hek::SLLog::LogError("Invalid receive buffer size. Please provide bytes, eg 4M");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--sndbuf") == 0 && i + 1 < argc) {
+            if (!hek::ParseByteSize(argv[++i], socketBuffers.sendBytes)) {
+                hek::SLLog::LogError("Invalid send buffer size. Please provide bytes, eg 4M");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--rcvbuf-max") == 0 && i + 1 < argc) {
+            if (!hek::ParseByteSize(argv[++i], socketBuffers.maxReceiveBytes)) {
+                hek::SLLog::LogError("Invalid maximum receive buffer size. Please provide bytes, eg 64M");
+                return EXIT_FAILURE;
+            }
+        } else if (std::strcmp(argv[i], "--metrics") == 0 && i + 1 < argc) {
+            metricsPath = argv[++i];
+        } else {
+            printUsage(argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (overflowPolicy == hek::OverflowPolicy::EDropOldest && workerCount < 2) {
+        // The single handler's queue is an SpscRing, which only the handler thread may pop from
+        hek::SLLog::LogError("Overflow policy drop-oldest needs --workers 2 or more");
+        return EXIT_FAILURE;
+    }
+
     // Register signal handler for CTRL-C
     std::signal(SIGINT, signalHandler);
 
-    hek::UdpServerTester observer(static_cast<uint16_t>(port));
+    // Serve the counters of the sockets, handlers and timers on a local Unix-domain socket
+    std::unique_ptr<hek::MetricsEndpoint> metricsEndpoint;
+    if (!metricsPath.empty()) {
+        metricsEndpoint = std::make_unique<hek::MetricsEndpoint>();
+        if (metricsEndpoint->Init(metricsPath) != 0) {
+            return EXIT_FAILURE;
+        }
+    }
+
+    // Every shard has its own SO_REUSEPORT socket, receiver thread and handler thread(s)
+    hek::UdpServerTesterOptions options = hek::UdpServerTester::DefaultOptions();
+    options.socketOptions.reusePort = (shardCount > 1);
+    options.socketOptions.reusePortSteeringGroupSize = (shardCount > 1 && cpuSteering) ? static_cast<uint32_t>(shardCount) : 0;
+    options.handlerWorkers = static_cast<size_t>(workerCount);
+    options.handlerQueueCapacity = static_cast<size_t>(queueCapacity);
+    options.overflowPolicy = overflowPolicy;
+    options.dispatchMode = dispatchMode;
+    options.sequenceTrackers = std::make_shared<hek::FlowSequenceTrackers>();
+    if (busyPollMicros > 0) {
+        // Low-latency mode: spin on the socket and answer the Pings right on the receiver thread
+        options.socketOptions.busyPollBudget = std::chrono::microseconds(busyPollMicros);
+        options.dispatchMode = hek::DispatchMode::EInline;
+    }
+    // Receive bulk transfers coalesced by the kernel; the handlers still see the individual datagrams
+    options.socketOptions.gro = gro;
+    options.socketOptions.ioEngine = ioUring ? hek::IoEngine::EIoUring : hek::IoEngine::EEpoll;
+    options.socketOptions.socketBuffers = socketBuffers;
+    if (timestamps) {
+        // Split the server side latency of the Pings into stages, using kernel software timestamps
+        options.socketOptions.rxTimestamps = true;
+        options.socketOptions.txTimestamps = true;
+        options.latencyStages = std::make_shared<hek::LatencyStages>();
+    }
+
+    // Shard i runs its receiver on the i-th CPU of --rx-cpus, and its handler(s) on the i-th of --handler-cpus
+    receiverThread.name = "udp-rx";
+    handlerThread.name = "udp-handler";
+    options.handlerOnCacheSibling = handlerOnCacheSibling;
 
-    hek::SLLog::LogInfo("Started UDP Server on port " + std::to_string(port) + ". Press CTRL-C to stop.");
+    std::vector<std::unique_ptr<hek::UdpServerTester>> shards;
+    for (long i = 0; i < shardCount; ++i) {
+        hek::UdpServerTesterOptions shardOptions = options;
+        shardOptions.socketOptions.receiverThread = receiverThread.ForIndex(static_cast<size_t>(i));
+        shardOptions.handlerThread = handlerThread.ForIndex(static_cast<size_t>(i));
+        shards.push_back(std::make_unique<hek::UdpServerTester>(static_cast<uint16_t>(port), shardOptions));
+    }
+
+    hek::SLLog::LogInfo("Started UDP Server on port " + std::to_string(port) + " with " + std::to_string(shardCount) +
+                        " shard(s). Press CTRL-C to stop.");
 
-    // Main loop to keep the program running
+    // Main loop to keep the program running, reporting throughput and Ping sequence accounting
+    auto lastReport = std::chrono::steady_clock::now();
+    uint64_t lastHandled = 0;
     while (running) {
         std::this_thread::sleep_for(std::chrono::milliseconds(100));
+
+        auto now = std::chrono::steady_clock::now();
+        if (now - lastReport >= REPORT_INTERVAL) {
+            uint64_t handled = 0;
+            for (const auto& shard : shards) {
+                handled += shard->GetHandledCount();
+            }
+            double seconds = std::chrono::duration<double>(now - lastReport).count();
+            if (handled != lastHandled) {
+                SLLOG_INFO("Handled %.0f datagrams/s from %zu flow(s): %s",
+                           static_cast<double>(handled - lastHandled) / seconds, options.sequenceTrackers->FlowCount(),
+                           options.sequenceTrackers->GetTotals().Summary().c_str());
+            }
+            if (handled != lastHandled && options.latencyStages) {
+                logLatencyStages(*options.latencyStages, shards);
+            }
+            lastHandled = handled;
+            lastReport = now;
+        }
+    }
+
+    hek::SLLog::LogInfo("Sequence accounting of all Pings: " + options.sequenceTrackers->GetTotals().Summary());
+    if (options.latencyStages) {
+        logLatencyStages(*options.latencyStages, shards);
     }
 
     hek::SLLog::LogInfo("Stopping UDP Server...");